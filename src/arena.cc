@@ -0,0 +1,38 @@
+#include "arena.hh"
+
+#include <stdint.h>
+
+Arena::~Arena()
+{
+	for (void *chunk: chunks)
+		free(chunk);
+}
+
+void *Arena::allocate(size_t size, size_t alignment)
+{
+	assert(alignment && (alignment & (alignment - 1)) == 0);
+	assert(alignment <= alignof(max_align_t));
+	char *const q= (char *)(((uintptr_t)p + alignment - 1) & ~(uintptr_t)(alignment - 1));
+	if (p && (size_t)(p_end - q) >= size) {
+		p= q + size;
+		return q;
+	}
+
+	if (size > SIZE_CHUNK / 4) {
+		void *chunk= malloc(size);
+		if (! chunk)
+			throw std::bad_alloc();
+		/* The free part of the current chunk is kept */
+		chunks.push_back(chunk);
+		return chunk;
+	}
+
+	/* malloc() returns memory aligned for any type */
+	char *chunk= (char *) malloc(SIZE_CHUNK);
+	if (! chunk)
+		throw std::bad_alloc();
+	chunks.push_back(chunk);
+	p= chunk + size;
+	p_end= chunk + SIZE_CHUNK;
+	return chunk;
+}
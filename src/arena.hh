@@ -0,0 +1,70 @@
+#ifndef ARENA_HH
+#define ARENA_HH
+
+/*
+ * An arena is a bump allocator for many small objects that are all freed at the same time,
+ * namely when the arena is destroyed.  Memory is taken from chunks of SIZE_CHUNK bytes;
+ * larger objects get a chunk of their own.  Deallocating an object does nothing.
+ *
+ * Objects are put into an arena with std::allocate_shared() and an Arena_Allocator.  The
+ * destructors of the objects are still called as usual when the last shared_ptr to them is
+ * gone, but all such shared_ptrs must be gone before the arena is destroyed.  The
+ * tokenizer uses an arena for the tokens of a file, which are not needed after parsing,
+ * except for the tokens of rules that are parsed lazily (option -R), which keep the arena
+ * of their file.
+ */
+
+#include <assert.h>
+#include <stdlib.h>
+
+#include <new>
+#include <vector>
+
+class Arena
+{
+public:
+	Arena()= default;
+	Arena(const Arena &)= delete;
+	Arena &operator=(const Arena &)= delete;
+	~Arena();
+
+	void *allocate(size_t size, size_t alignment);
+
+private:
+	static constexpr size_t SIZE_CHUNK= 64 * 1024;
+
+	std::vector <void *> chunks;
+	char *p= nullptr, *p_end= nullptr;
+	/* The free part of the last chunk */
+};
+
+template <typename T>
+class Arena_Allocator
+{
+public:
+	typedef T value_type;
+
+	Arena &arena;
+
+	explicit Arena_Allocator(Arena &arena_): arena(arena_) { }
+
+	template <typename U>
+	Arena_Allocator(const Arena_Allocator <U> &other): arena(other.arena) { }
+
+	T *allocate(size_t n) {
+		return (T *) arena.allocate(n * sizeof(T), alignof(T));
+	}
+
+	void deallocate(T *, size_t) { }
+
+	template <typename U>
+	bool operator==(const Arena_Allocator <U> &other) const {
+		return &arena == &other.arena;
+	}
+	template <typename U>
+	bool operator!=(const Arena_Allocator <U> &other) const {
+		return &arena != &other.arena;
+	}
+};
+
+#endif /* ! ARENA_HH */
@@ -0,0 +1,206 @@
+#include "artifact_cache.hh"
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <set>
+
+#include "build_log.hh"
+#include "content_hash.hh"
+#include "copier.hh"
+#include "format.hh"
+#include "options.hh"
+#include "trace.hh"
+
+const char *Artifact_Cache::dir= nullptr;
+bool Artifact_Cache::is_init= false;
+string Artifact_Cache::dir_current;
+size_t Artifact_Cache::count_hits= 0;
+size_t Artifact_Cache::count_misses= 0;
+size_t Artifact_Cache::count_published= 0;
+size_t Artifact_Cache::count_tmp= 0;
+
+bool Artifact_Cache::is_enabled()
+{
+	if (! is_init)
+		init();
+	return dir;
+}
+
+string Artifact_Cache::get_key(const string &text, const string &command)
+{
+	assert(dir);
+	string text_key= "STU_CACHE_1";
+	text_key += '\0';
+	text_key += dir_current;
+	text_key += '\0';
+	text_key += text;
+
+	/* Variables set in the command itself are included too, which does not
+	 * matter */
+	std::set <string> names{"PATH", ENV_STU_SHELL};
+	for (size_t i= command.find('$'); i != string::npos; i= command.find('$', i)) {
+		++i;
+		if (i < command.size() && command[i] == '{')
+			++i;
+		size_t j= i;
+		while (j < command.size() && (isalnum((unsigned char)command[j])
+				|| command[j] == '_'))
+			++j;
+		if (j > i && ! isdigit((unsigned char)command[i]))
+			names.insert(command.substr(i, j - i));
+	}
+	for (const string &name: names)
+		append_variable(text_key, name);
+
+	return frmt("%016jx%016jx",
+		(uintmax_t)Content_Hash::hash(text_key.data(), text_key.size()),
+		(uintmax_t)Build_Log::hash(text_key));
+}
+
+bool Artifact_Cache::restore(const string &key, const std::vector <string> &filenames,
+	const Place &place)
+{
+	TRACE_FUNCTION();
+	TRACE("key= %s", key);
+	string dir_key= frmt("%s/%s", dir, key.c_str());
+	struct stat buf;
+	if (stat(dir_key.c_str(), &buf) < 0) {
+		if (errno != ENOENT)
+			print_warning(place, format_errno("stat", dir_key));
+		++count_misses;
+		return false;
+	}
+	for (size_t i= 0; i < filenames.size(); ++i) {
+		const string &filename= filenames[i];
+		string source= frmt("%s/%zu", dir_key.c_str(), i);
+		string filename_tmp= frmt("%s.stu-cache.%jd", filename.c_str(),
+			(intmax_t)getpid());
+		string message;
+		if (! Copier::copy_file(filename_tmp, source, message)) {
+			/* E.g. the directory of the target does not exist yet */
+			if (errno != ENOENT)
+				print_warning(place, message);
+			unlink(filename_tmp.c_str());
+			++count_misses;
+			return false;
+		}
+		if (rename(filename_tmp.c_str(), filename.c_str()) < 0) {
+			print_warning(place, format_errno("rename", filename_tmp));
+			unlink(filename_tmp.c_str());
+			++count_misses;
+			return false;
+		}
+	}
+	++count_hits;
+	return true;
+}
+
+void Artifact_Cache::publish(const string &key, const std::vector <string> &filenames,
+	const Place &place)
+{
+	TRACE_FUNCTION();
+	TRACE("key= %s", key);
+	string dir_key= frmt("%s/%s", dir, key.c_str());
+	struct stat buf;
+	if (stat(dir_key.c_str(), &buf) == 0)
+		return;
+	for (const string &filename: filenames)
+		if (lstat(filename.c_str(), &buf) < 0 || ! S_ISREG(buf.st_mode))
+			return;
+
+	if (mkdir(dir, 0777) < 0 && errno != EEXIST) {
+		print_warning(place, format_errno("mkdir", dir));
+		return;
+	}
+	string dir_tmp= frmt("%s/tmp.%jd.%zu", dir, (intmax_t)getpid(), count_tmp++);
+	if (mkdir(dir_tmp.c_str(), 0777) < 0) {
+		print_warning(place, format_errno("mkdir", dir_tmp));
+		return;
+	}
+	Copier::start_background(publish_files,
+		new Publish{filenames, dir_tmp, dir_key, place, "", false});
+
+	/* Output the warnings of earlier entries as soon as possible */
+	while (void *data= Copier::get_background())
+		finish_publish((Publish *)data);
+}
+
+void Artifact_Cache::finish()
+{
+	TRACE_FUNCTION();
+	while (void *data= Copier::wait_background())
+		finish_publish((Publish *)data);
+}
+
+void Artifact_Cache::print_statistics()
+{
+	if (! dir)
+		return;
+	printf("STATISTICS  artifact cache = %zu hits, %zu misses, %zu published\n",
+	       count_hits, count_misses, count_published);
+}
+
+void Artifact_Cache::init()
+{
+	is_init= true;
+	const char *d= getenv(ENV_STU_CACHE_DIR);
+	if (! d || ! *d)
+		return;
+	char *cwd= getcwd(nullptr, 0);
+	if (! cwd) {
+		print_errno("getcwd");
+		return;
+	}
+	dir_current= cwd;
+	free(cwd);
+	dir= d;
+}
+
+void Artifact_Cache::append_variable(string &text, const string &name)
+{
+	const char *value= getenv(name.c_str());
+	text += '\0';
+	text += name;
+	if (value) {
+		text += '=';
+		text += value;
+	}
+}
+
+void Artifact_Cache::publish_files(void *data)
+{
+	Publish *publish= (Publish *)data;
+	const string &dir_tmp= publish->dir_tmp;
+	for (size_t i= 0; i < publish->filenames.size(); ++i) {
+		if (! Copier::copy_file(frmt("%s/%zu", dir_tmp.c_str(), i),
+				publish->filenames[i], publish->message)) {
+			remove_tmp(dir_tmp, i + 1);
+			return;
+		}
+	}
+	if (rename(dir_tmp.c_str(), publish->dir_key.c_str()) < 0) {
+		/* Another invocation of Stu has published the same entry */
+		if (errno != EEXIST && errno != ENOTEMPTY)
+			publish->message= format_errno("rename", dir_tmp);
+		remove_tmp(dir_tmp, publish->filenames.size());
+		return;
+	}
+	publish->published= true;
+}
+
+void Artifact_Cache::finish_publish(Publish *publish)
+{
+	if (! publish->message.empty())
+		print_warning(publish->place, publish->message);
+	if (publish->published)
+		++count_published;
+	delete publish;
+}
+
+void Artifact_Cache::remove_tmp(const string &dir_tmp, size_t count)
+{
+	for (size_t i= 0; i < count; ++i)
+		unlink(frmt("%s/%zu", dir_tmp.c_str(), i).c_str());
+	rmdir(dir_tmp.c_str());
+}
@@ -0,0 +1,97 @@
+#ifndef ARTIFACT_CACHE_HH
+#define ARTIFACT_CACHE_HH
+
+/*
+ * The artifact cache keeps the file targets built by commands in the directory given by
+ * $STU_CACHE_DIR, and restores them instead of running the command again when the same
+ * command is to be run with the same inputs.  It is only used when $STU_CACHE_DIR is set
+ * and not empty.
+ *
+ * The key of an entry is a 128-bit hash of the current directory, the instantiated
+ * command, the parameters and variables passed to it, the names of the targets, the
+ * names and content hashes of the file dependencies that are neither trivial nor
+ * persistent, and the values of $PATH, $STU_SHELL, and of the environment variables that
+ * appear in the command as $NAME or ${NAME}.  Each entry is a directory named after the
+ * key, containing the targets as files named 0, 1, etc.  Entries are created in a
+ * temporary directory that is then renamed, such that concurrent invocations of Stu
+ * never see a partial entry.
+ *
+ * Files are copied in both directions in the same way as by copy rules, i.e., cloned
+ * when the filesystem supports it.  Hard links are not used, because a restored file
+ * must have the current time as modification time, and must not share its data with the
+ * cache when a command changes it in place.  Restored files are written under a
+ * temporary name and then renamed.  Entries are published by the worker threads of
+ * copy rules (see copier.hh), such that the main loop does not wait for the copies;
+ * each build waits for them at its end.  Restoring is done by the main loop, because
+ * its outcome decides whether the command is run.
+ *
+ * Only rules with a command whose targets are all files, and whose dependencies are all
+ * plain files, are cached, i.e., not rules with dynamic, phony or concatenated
+ * dependencies.  Targets that are not regular files are not cached.  The output of
+ * commands is not stored.  Stu never removes entries from the cache; they may be removed
+ * at any time.  Problems with the cache are output as warnings, after which the command
+ * is run as usual.
+ */
+
+#include <string>
+#include <vector>
+
+#include "error.hh"
+#include "place.hh"
+
+class Artifact_Cache
+{
+public:
+	static bool is_enabled();
+
+	static std::string get_key(const std::string &text, const std::string &command);
+	/* The key for the given description of the job, to which the relevant
+	 * environment variables are added.  COMMAND is the text of the command. */
+
+	static bool restore(const std::string &key, const std::vector <std::string> &filenames,
+		const Place &place);
+	/* Copy the files of the entry into FILENAMES.  Return FALSE when there is no
+	 * entry, or on error, which has been output as a warning. */
+
+	static void publish(const std::string &key, const std::vector <std::string> &filenames,
+		const Place &place);
+	/* Start storing the files in a new entry, unless the entry exists already */
+
+	static void finish();
+	/* Wait until the entries being published are complete */
+
+	static void print_statistics();
+	/* Output nothing when the cache is not used */
+
+private:
+	static const char *dir;
+	/* $STU_CACHE_DIR; null when not used */
+	static bool is_init;
+	static std::string dir_current;
+
+	static size_t count_hits, count_misses, count_published, count_tmp;
+
+	struct Publish {
+		std::vector <std::string> filenames;
+		std::string dir_tmp, dir_key;
+		Place place;
+		std::string message;
+		/* The warning to output; empty when there is none */
+		bool published;
+	};
+
+	static void init();
+
+	static void append_variable(std::string &text, const std::string &name);
+
+	static void publish_files(void *data);
+	/* Executed in a worker thread; DATA is a Publish object */
+
+	static void finish_publish(Publish *publish);
+	/* Output the warning and delete PUBLISH */
+
+	static void remove_tmp(const std::string &dir_tmp, size_t count);
+	/* Remove the temporary directory with COUNT files */
+};
+
+#endif /* ! ARTIFACT_CACHE_HH */
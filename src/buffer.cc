@@ -13,6 +13,8 @@ void Buffer::push(shared_ptr <const Dep> d)
 	assert(d->is_normalized());
 	if (order_vec)
 		v.emplace_back(d);
+	else if (order == Order::CRITICAL)
+		p.push({History::get(d), index_next++, d});
 	else
 		q.push(d);
 }
@@ -27,6 +29,10 @@ shared_ptr <const Dep> Buffer::pop()
 		shared_ptr <const Dep> ret= v[s - 1];
 		v.resize(s - 1);
 		return ret;
+	} else if (order == Order::CRITICAL) {
+		shared_ptr <const Dep> ret= p.top().dep;
+		p.pop();
+		return ret;
 	} else {
 		shared_ptr <const Dep> ret= q.front();
 		q.pop();
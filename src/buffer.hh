@@ -6,7 +6,9 @@
  * depending on the mode in which Stu is run, i.e., whether targets are built in
  * depth-first order (the default), or in random order.  Which is used is
  * determined by the global variable OPTION_VEC defined in global.hh, which is
- * set once before any Buffer object is created.
+ * set once before any Buffer object is created.  In critical order, a priority
+ * queue is used, which returns the dependency with the longest recorded chain of
+ * jobs first, and otherwise behaves like the queue.
  */
 
 #include <memory>
@@ -14,6 +16,7 @@
 #include <random>
 
 #include "dep.hh"
+#include "history.hh"
 
 extern std::default_random_engine buffer_generator;
 
@@ -30,10 +33,24 @@ private:
 	std::queue <shared_ptr <const Dep> > q;
 	std::vector <shared_ptr <const Dep> > v;
 
+	struct Entry_Critical {
+		double seconds;
+		size_t index; /* Position in order of insertion */
+		shared_ptr <const Dep> dep;
+		bool operator<(const Entry_Critical &e) const {
+			return seconds != e.seconds ? seconds < e.seconds
+				: index > e.index;
+		}
+	};
+	std::priority_queue <Entry_Critical> p;
+	size_t index_next= 0;
+
 public:
 	size_t size() const {
 		if (order_vec)
 			return v.size();
+		else if (order == Order::CRITICAL)
+			return p.size();
 		else
 			return q.size();
 	}
@@ -41,6 +58,8 @@ public:
 	bool empty() const {
 		if (order_vec)
 			return v.empty();
+		else if (order == Order::CRITICAL)
+			return p.empty();
 		else
 			return q.empty();
 	}
@@ -0,0 +1,147 @@
+#include "build_log.hh"
+
+#include <fcntl.h>
+
+#include "error.hh"
+#include "format.hh"
+#include "history.hh"
+#include "state_file.hh"
+#include "timestamp.hh"
+#include "trace.hh"
+
+Fingerprint::Fingerprint(const struct stat *buf)
+	: size(buf->st_size), dev(buf->st_dev), ino(buf->st_ino)
+{
+#if USE_MTIM
+	sec= buf->st_mtim.tv_sec;
+	nsec= buf->st_mtim.tv_nsec;
+#else
+	sec= buf->st_mtime;
+#endif
+}
+
+std::unordered_map <string, Build_Log::Record> Build_Log::records;
+size_t Build_Log::count_records_file= 0;
+size_t Build_Log::count_records_new= 0;
+string Build_Log::buffer_new;
+bool Build_Log::is_valid= true;
+
+void Build_Log::read()
+{
+	TRACE_FUNCTION();
+	string content;
+	if (! State_File::read(FILENAME_LOG, content))
+		return;
+
+	if (content.size() < sizeof(HEADER)
+		|| memcmp(content.data(), HEADER, sizeof(HEADER))) {
+		TRACE("Invalid header");
+		is_valid= false;
+		return;
+	}
+	const char *p= content.data() + sizeof(HEADER);
+	const char *end= content.data() + content.size();
+	while (p < end) {
+		string filename;
+		Record record;
+		if (! parse(p, end, filename, record)) {
+			/* E.g. after a crash during a write.  The file is rewritten
+			 * without the incomplete record, such that records can be
+			 * appended to it again. */
+			TRACE("Incomplete record");
+			is_valid= false;
+			break;
+		}
+		records[filename]= std::move(record);
+		++count_records_file;
+	}
+	TRACE("count_records_file= %s", frmt("%zu", count_records_file));
+}
+
+void Build_Log::write()
+{
+	TRACE_FUNCTION();
+	bool rewrite= ! is_valid || count_records_file == 0
+		|| (count_records_file > COUNT_RECORDS_COMPACT
+			&& count_records_file > 2 * records.size());
+	if (buffer_new.empty() && ! (rewrite && count_records_file))
+		return;
+
+	if (! State_File::make_dir())
+		return;
+
+	if (! rewrite) {
+		if (State_File::write(FILENAME_LOG, buffer_new, O_APPEND))
+			count_records_file += count_records_new;
+		buffer_new.clear();
+		count_records_new= 0;
+		return;
+	}
+
+	string buffer(HEADER, sizeof(HEADER));
+	for (const auto &i: records)
+		append(buffer, i.first, i.second);
+	if (! State_File::replace(FILENAME_LOG, buffer))
+		return;
+	buffer_new.clear();
+	count_records_new= 0;
+	count_records_file= records.size();
+	is_valid= true;
+}
+
+const Build_Log::Record *Build_Log::get(const string &filename)
+{
+	auto i= records.find(filename);
+	return i == records.end() ? nullptr : &i->second;
+}
+
+void Build_Log::set(const string &filename, Record &&record)
+{
+	TRACE_FUNCTION();
+	TRACE("filename= %s", filename);
+	append(buffer_new, filename, record);
+	++count_records_new;
+	records[filename]= std::move(record);
+}
+
+uint64_t Build_Log::hash(const string &text)
+/* FNV-1a */
+{
+	uint64_t h= 0xcbf29ce484222325;
+	for (unsigned char c: text) {
+		h ^= c;
+		h *= 0x100000001b3;
+	}
+	return h;
+}
+
+void Build_Log::append(string &buffer, const string &filename, const Record &record)
+{
+	State_File::append_string(buffer, filename);
+	State_File::append_number(buffer, record.hash_command);
+	State_File::append_fingerprint(buffer, record.fingerprint);
+	State_File::append_number(buffer, record.inputs.size());
+	for (const Input &input: record.inputs) {
+		State_File::append_string(buffer, input.filename);
+		State_File::append_fingerprint(buffer, input.fingerprint);
+		State_File::append_number(buffer, input.hash);
+	}
+}
+
+bool Build_Log::parse(const char *&p, const char *end, string &filename, Record &record)
+{
+	uint64_t count_inputs;
+	if (! State_File::parse_string(p, end, filename)
+		|| ! State_File::parse_number(p, end, record.hash_command)
+		|| ! State_File::parse_fingerprint(p, end, record.fingerprint)
+		|| ! State_File::parse_number(p, end, count_inputs)
+		|| count_inputs > (uint64_t)(end - p))
+		return false;
+	record.inputs.resize(count_inputs);
+	for (Input &input: record.inputs)
+		if (! State_File::parse_string(p, end, input.filename)
+			|| ! State_File::parse_fingerprint(p, end, input.fingerprint)
+			|| ! State_File::parse_number(p, end, input.hash))
+			return false;
+	return true;
+}
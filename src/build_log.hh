@@ -0,0 +1,129 @@
+#ifndef BUILD_LOG_HH
+#define BUILD_LOG_HH
+
+/*
+ * The build log records, for each file target built by a command, a hash of the
+ * command, the fingerprints of the files the command depended on, and the fingerprint
+ * of the target after it was built.  A fingerprint consists of the modification time,
+ * the size, and the device and inode numbers of a file.  For dependencies that are
+ * compared by content, the hash of the content is recorded too.  The log is used in
+ * two ways:
+ *
+ *   - When the command of a target has changed since the target was built, the target
+ *     is rebuilt, even if it is newer than its dependencies.
+ *   - When a target is older than one of its dependencies, but the target and all its
+ *     dependencies still have the fingerprints recorded when it was built, the target
+ *     is not rebuilt.  Dependencies compared by content may have another fingerprint,
+ *     as long as the hash of their content is unchanged; the record is then updated
+ *     with the new fingerprint.
+ *
+ * Targets without a record are only checked using timestamps.  Targets without a
+ * command are not recorded.
+ *
+ * The log is kept in the binary file .stu/log in the current directory.  The records
+ * of the targets built in a run are appended to it at the end of the run, using a
+ * single write(), such that concurrent invocations of Stu do not interleave records.
+ * When Stu is killed, the records are lost, and the targets are checked using
+ * timestamps only in the next run.  When the file is read, later records for a target
+ * replace earlier ones.  When the file contains many replaced records, it is rewritten
+ * instead of appended to.  The file begins with a header identifying its
+ * format; files with another header are ignored and overwritten, and an incomplete
+ * record at the end is discarded.  Numbers and strings are encoded as described in
+ * state_file.hh.
+ */
+
+#include <sys/stat.h>
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class Fingerprint
+{
+public:
+	int64_t sec= 0, nsec= 0;
+	uint64_t size= 0, dev= 0, ino= 0;
+	/* All zero for files that do not exist */
+
+	Fingerprint()= default;
+	explicit Fingerprint(const struct stat *buf);
+
+	bool operator==(const Fingerprint &fingerprint) const {
+		return sec == fingerprint.sec && nsec == fingerprint.nsec
+			&& size == fingerprint.size && dev == fingerprint.dev
+			&& ino == fingerprint.ino;
+	}
+	bool operator!=(const Fingerprint &fingerprint) const {
+		return ! (*this == fingerprint);
+	}
+};
+
+class Build_Log
+{
+public:
+	class Input
+	{
+	public:
+		std::string filename;
+		Fingerprint fingerprint;
+		uint64_t hash;
+		/* Content_Hash::HASH_NONE when the input is not compared by content */
+	};
+
+	class Record
+	{
+	public:
+		uint64_t hash_command;
+		Fingerprint fingerprint;
+		/* Of the target itself */
+		std::vector <Input> inputs;
+		/* Sorted by filename */
+	};
+
+	static void read();
+	/* Read the log file, if it exists.  Called once before anything is built. */
+
+	static void write();
+	/* Append the new records to the log file, or rewrite it when it contains many
+	 * replaced records.  Called after everything was built, i.e., once, or after
+	 * each build with -w. */
+
+	static const Record *get(const std::string &filename);
+	/* Null when there is no record for the file */
+
+	static void set(const std::string &filename, Record &&record);
+	/* Replace the record of FILENAME */
+
+	static uint64_t hash(const std::string &text);
+
+private:
+	static constexpr const char *FILENAME_LOG= ".stu/log";
+	static constexpr const char HEADER[8]= {'S', 'T', 'U', 'L', 'O', 'G', '\0', '\4'};
+	/* The last byte is the version of the format */
+
+	static constexpr size_t COUNT_RECORDS_COMPACT= 1000;
+	/* Rewrite the file when it has more than this number of records, and more than
+	 * twice the number of distinct targets */
+
+	static std::unordered_map <std::string, Record> records;
+
+	static size_t count_records_file;
+	/* The number of records in the log file, including replaced ones */
+
+	static std::string buffer_new;
+	static size_t count_records_new;
+	/* The records set in this run, to be appended to the log file, and their
+	 * number */
+
+	static bool is_valid;
+	/* The log file does not exist, or begins with HEADER followed by complete
+	 * records */
+
+	static void append(std::string &buffer, const std::string &filename,
+		const Record &record);
+	static bool parse(const char *&p, const char *end,
+		std::string &filename, Record &record);
+	/* Return FALSE when the record is incomplete */
+};
+
+#endif /* ! BUILD_LOG_HH */
@@ -0,0 +1,152 @@
+#include "concurrency.hh"
+
+#include <math.h>
+#include <sched.h>
+
+#include "options.hh"
+
+long Concurrency::limit= 0;
+double Concurrency::seconds_sample= -1;
+
+long Concurrency::count_cpus()
+{
+	TRACE_FUNCTION();
+	long count= 1;
+#ifdef _SC_NPROCESSORS_ONLN
+	count= sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+#ifdef CPU_COUNT
+	cpu_set_t set;
+	if (sched_getaffinity(0, sizeof(set), &set) == 0 && CPU_COUNT(&set) > 0)
+		count= CPU_COUNT(&set);
+#endif
+	long count_cgroup= read_cgroup_cpus();
+	if (count_cgroup > 0 && count_cgroup < count)
+		count= count_cgroup;
+	TRACE("count= %s", frmt("%ld", count));
+	return std::max(count, 1L);
+}
+
+void Concurrency::adjust(long count_running)
+{
+	TRACE_FUNCTION();
+	if (! is_adaptive())
+		return;
+
+	struct timespec ts;
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0) {
+		print_errno("clock_gettime");
+		error_exit();
+	}
+	double seconds= ts.tv_sec + ts.tv_nsec * 1e-9;
+	if (seconds_sample < 0 || seconds - seconds_sample >= SECONDS_SAMPLE) {
+		seconds_sample= seconds;
+		sample(count_running);
+	}
+
+	options_jobs= std::max(limit - count_running, count_running ? 0L : 1L);
+	TRACE("options_jobs= %s", frmt("%ld", options_jobs));
+}
+
+bool Concurrency::is_adaptive()
+{
+	return option_j_auto || option_l > 0 || option_L > 0;
+}
+
+void Concurrency::sample(long count_running)
+{
+	TRACE_FUNCTION();
+	limit= options_jobs_max;
+
+	if (option_j_auto) {
+		long count_cgroup= read_cgroup_cpus();
+		if (count_cgroup > 0)
+			limit= std::min(limit, count_cgroup);
+	}
+
+	if (option_l > 0) {
+		/* The load average already includes the jobs we are running, and
+		 * therefore we may start as many jobs as are missing to reach the maximal
+		 * load.  When it is exceeded, jobs must finish first. */
+		double load;
+		if (getloadavg(&load, 1) == 1)
+			limit= std::min(limit,
+				count_running + (long)floor(option_l - load));
+	}
+
+	if (option_L > 0) {
+		/* Under memory pressure, don't start new jobs */
+		double pressure= read_pressure("/proc/pressure/memory");
+		if (pressure >= option_L)
+			limit= std::min(limit, count_running);
+	}
+
+	limit= std::max(limit, 1L);
+	TRACE("limit= %s", frmt("%ld", limit));
+}
+
+long Concurrency::read_cgroup_cpus()
+{
+	FILE *file= fopen("/proc/self/cgroup", "r");
+	if (!file)
+		return -1;
+	char *line= nullptr;
+	size_t size= 0;
+	ssize_t len;
+	string path;
+	bool found= false;
+	while ((len= getline(&line, &size, file)) >= 0) {
+		/* The cgroup v2 hierarchy has the ID zero and no controllers */
+		if (len < 4 || strncmp(line, "0::/", 4)) continue;
+		if (line[len - 1] == '\n')
+			line[len - 1]= '\0';
+		path= line + 3;
+		found= true;
+		break;
+	}
+	free(line);
+	fclose(file);
+	if (! found)
+		return -1;
+
+	/* The effective quota is the smallest one of the cgroup and its ancestors */
+	long count= -1;
+	for (;;) {
+		while (path.size() > 1 && path.back() == '/')
+			path.pop_back();
+		string filename= "/sys/fs/cgroup" + path
+			+ (path == "/" ? "" : "/") + "cpu.max";
+		file= fopen(filename.c_str(), "r");
+		if (file) {
+			char quota[32];
+			long period;
+			if (fscanf(file, "%31s %ld", quota, &period) == 2
+				&& strcmp(quota, "max") && period > 0)
+			{
+				char *end;
+				long q= strtol(quota, &end, 10);
+				if (*end == '\0' && q > 0) {
+					long c= (q + period - 1) / period;
+					if (count < 0 || c < count)
+						count= c;
+				}
+			}
+			fclose(file);
+		}
+		if (path == "/")
+			break;
+		path.resize(path.rfind('/') + 1);
+	}
+	return count;
+}
+
+double Concurrency::read_pressure(const char *filename)
+{
+	FILE *file= fopen(filename, "r");
+	if (!file)
+		return -1;
+	double pressure;
+	int r= fscanf(file, "some avg10=%lf", &pressure);
+	fclose(file);
+	return r == 1 && pressure >= 0 ? pressure : -1;
+}
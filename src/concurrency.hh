@@ -0,0 +1,47 @@
+#ifndef CONCURRENCY_HH
+#define CONCURRENCY_HH
+
+/*
+ * Adaptive number of parallel jobs.  With -j auto, the number of jobs is the number of
+ * CPUs available to Stu.  With -j auto, -l and -L, the number of jobs that may run at
+ * once is additionally lowered at runtime, based on the cgroup v2 CPU quota, the load
+ * average, and the memory pressure as given by the Linux pressure stall information.
+ * Values that cannot be read on the current system are ignored.  OPTIONS_JOBS_MAX is
+ * never exceeded.
+ */
+
+class Concurrency
+{
+public:
+	static long count_cpus();
+	/* The number of CPUs available to Stu, taking into account the CPU affinity and
+	 * the cgroup CPU quota; at least one */
+
+	static void adjust(long count_running);
+	/* Set OPTIONS_JOBS to the number of jobs that may be started now, given the
+	 * number of running jobs.  To be called only when no executor is being executed.
+	 * May set it to zero when jobs are running, but never when no job is running. */
+
+private:
+	static long limit;
+	/* Number of jobs that may run at once, as determined by the last sample */
+
+	static double seconds_sample;
+	/* Time of the last sample, in seconds of the monotonic clock; negative when no
+	 * sample has been taken yet */
+
+	static constexpr double SECONDS_SAMPLE= 1.0;
+	/* The minimal time between two samples.  The load average and the pressure
+	 * information are themselves only updated every few seconds. */
+
+	static bool is_adaptive();
+	static void sample(long count_running);
+	static long read_cgroup_cpus();
+	/* The CPU quota of our cgroup and its ancestors, rounded up, or -1 when there is
+	 * none */
+	static double read_pressure(const char *filename);
+	/* The "some avg10" value in percent from the given pressure file, or -1 when not
+	 * available */
+};
+
+#endif /* ! CONCURRENCY_HH */
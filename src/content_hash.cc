@@ -0,0 +1,380 @@
+#include "content_hash.hh"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+alignas(64) const unsigned char Content_Hash::secret[SIZE_SECRET]= {
+	0xb8, 0xfe, 0x6c, 0x39, 0x23, 0xa4, 0x4b, 0xbe, 0x7c, 0x01, 0x81, 0x2c, 0xf7, 0x21, 0xad, 0x1c,
+	0xde, 0xd4, 0x6d, 0xe9, 0x83, 0x90, 0x97, 0xdb, 0x72, 0x40, 0xa4, 0xa4, 0xb7, 0xb3, 0x67, 0x1f,
+	0xcb, 0x79, 0xe6, 0x4e, 0xcc, 0xc0, 0xe5, 0x78, 0x82, 0x5a, 0xd0, 0x7d, 0xcc, 0xff, 0x72, 0x21,
+	0xb8, 0x08, 0x46, 0x74, 0xf7, 0x43, 0x24, 0x8e, 0xe0, 0x35, 0x90, 0xe6, 0x81, 0x3a, 0x26, 0x4c,
+	0x3c, 0x28, 0x52, 0xbb, 0x91, 0xc3, 0x00, 0xcb, 0x88, 0xd0, 0x65, 0x8b, 0x1b, 0x53, 0x2e, 0xa3,
+	0x71, 0x64, 0x48, 0x97, 0xa2, 0x0d, 0xf9, 0x4e, 0x38, 0x19, 0xef, 0x46, 0xa9, 0xde, 0xac, 0xd8,
+	0xa8, 0xfa, 0x76, 0x3f, 0xe3, 0x9c, 0x34, 0x3f, 0xf9, 0xdc, 0xbb, 0xc7, 0xc7, 0x0b, 0x4f, 0x1d,
+	0x8a, 0x51, 0xe0, 0x4b, 0xcd, 0xb4, 0x59, 0x31, 0xc8, 0x9f, 0x7e, 0xc9, 0xd9, 0x78, 0x73, 0x64,
+	0xea, 0xc5, 0xac, 0x83, 0x34, 0xd3, 0xeb, 0xc3, 0xc5, 0x81, 0xa0, 0xff, 0xfa, 0x13, 0x63, 0xeb,
+	0x17, 0x0d, 0xdd, 0x51, 0xb7, 0xf0, 0xda, 0x49, 0xd3, 0x16, 0x55, 0x26, 0x29, 0xd4, 0x68, 0x9e,
+	0x2b, 0x16, 0xbe, 0x58, 0x7d, 0x47, 0xa1, 0xfc, 0x8f, 0xf8, 0xb8, 0xd1, 0x7a, 0xd0, 0x31, 0xce,
+	0x45, 0xcb, 0x3a, 0x8f, 0x95, 0x16, 0x04, 0x28, 0xaf, 0xd7, 0xfb, 0xca, 0xbb, 0x4b, 0x40, 0x7e,
+};
+
+std::unordered_map <string, Content_Hash::Entry> Content_Hash::entries;
+size_t Content_Hash::count_files= 0;
+uint64_t Content_Hash::count_bytes= 0;
+void (*Content_Hash::accumulate)(uint64_t *, const char *, size_t)=
+	&Content_Hash::accumulate_init;
+
+uint64_t Content_Hash::get(const string &filename, const Fingerprint &fingerprint)
+{
+	TRACE_FUNCTION();
+	TRACE("filename= %s", filename);
+	auto i= entries.find(filename);
+	if (i != entries.end() && i->second.fingerprint == fingerprint) {
+		TRACE("Cached");
+		return i->second.hash;
+	}
+	uint64_t h= compute(filename.c_str());
+	if (h != HASH_NONE)
+		entries[filename]= {fingerprint, h};
+	return h;
+}
+
+uint64_t Content_Hash::hash(const char *data, size_t size)
+{
+	uint64_t h;
+	if (size <= 16)
+		h= hash_16(data, size);
+	else if (size <= 128)
+		h= hash_128(data, size);
+	else if (size <= 240)
+		h= hash_240(data, size);
+	else
+		h= hash_long(data, size);
+	return h == HASH_NONE ? 1 : h;
+}
+
+void Content_Hash::print_statistics()
+{
+	if (count_files == 0)
+		return;
+	printf("STATISTICS  files hashed = %zu (%ju bytes)\n",
+	       count_files, (uintmax_t)count_bytes);
+}
+
+uint64_t Content_Hash::compute(const char *filename)
+{
+	TRACE_FUNCTION();
+	int fd= open(filename, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return HASH_NONE;
+	struct stat buf;
+	if (fstat(fd, &buf) < 0) {
+		close(fd);
+		return HASH_NONE;
+	}
+	uint64_t h= HASH_NONE;
+	if (S_ISREG(buf.st_mode) && buf.st_size > 0) {
+		void *data= mmap(nullptr, buf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (data != MAP_FAILED) {
+			h= hash((const char *)data, buf.st_size);
+			munmap(data, buf.st_size);
+			count_bytes += buf.st_size;
+		}
+	}
+	if (h == HASH_NONE) {
+		/* Empty files, and files that cannot be mapped, such as
+		 * files in /proc */
+		string content;
+		char buffer[1 << 16];
+		ssize_t r;
+		while ((r= read(fd, buffer, sizeof(buffer))) != 0) {
+			if (r < 0 && errno == EINTR)
+				continue;
+			if (r < 0) {
+				close(fd);
+				return HASH_NONE;
+			}
+			content.append(buffer, r);
+		}
+		h= hash(content.data(), content.size());
+		count_bytes += content.size();
+	}
+	close(fd);
+	++count_files;
+	return h;
+}
+
+uint64_t Content_Hash::hash_16(const char *p, size_t size)
+{
+	if (size > 8) {
+		uint64_t lo= read_64(p) ^ (read_64(secret + 24) ^ read_64(secret + 32));
+		uint64_t hi= read_64(p + size - 8) ^ (read_64(secret + 40) ^ read_64(secret + 48));
+		return avalanche(size + swap_64(lo) + hi + multiply_fold(lo, hi));
+	}
+	if (size >= 4) {
+		uint64_t input= read_32(p + size - 4) + ((uint64_t)read_32(p) << 32);
+		return rrmxmx(input ^ (read_64(secret + 8) ^ read_64(secret + 16)), size);
+	}
+	if (size > 0) {
+		uint32_t combined= ((uint32_t)(unsigned char)p[0] << 16)
+			| ((uint32_t)(unsigned char)p[size >> 1] << 24)
+			| (uint32_t)(unsigned char)p[size - 1]
+			| ((uint32_t)size << 8);
+		return avalanche_xxh64(combined ^ (uint64_t)(read_32(secret) ^ read_32(secret + 4)));
+	}
+	return avalanche_xxh64(read_64(secret + 56) ^ read_64(secret + 64));
+}
+
+uint64_t Content_Hash::hash_128(const char *p, size_t size)
+/* Pairs of 16 bytes from both ends, working inwards */
+{
+	uint64_t acc= size * PRIME64_1;
+	if (size > 32) {
+		if (size > 64) {
+			if (size > 96) {
+				acc += mix_16(p + 48, secret + 96);
+				acc += mix_16(p + size - 64, secret + 112);
+			}
+			acc += mix_16(p + 32, secret + 64);
+			acc += mix_16(p + size - 48, secret + 80);
+		}
+		acc += mix_16(p + 16, secret + 32);
+		acc += mix_16(p + size - 32, secret + 48);
+	}
+	acc += mix_16(p, secret);
+	acc += mix_16(p + size - 16, secret + 16);
+	return avalanche(acc);
+}
+
+uint64_t Content_Hash::hash_240(const char *p, size_t size)
+{
+	uint64_t acc= size * PRIME64_1;
+	for (size_t i= 0; i < 8; ++i)
+		acc += mix_16(p + 16 * i, secret + 16 * i);
+	acc= avalanche(acc);
+	uint64_t acc_end= mix_16(p + size - 16, secret + 119);
+	for (size_t i= 8; i < size / 16; ++i)
+		acc_end += mix_16(p + 16 * i, secret + 16 * (i - 8) + 3);
+	return avalanche(acc + acc_end);
+}
+
+uint64_t Content_Hash::hash_long(const char *p, size_t size)
+{
+	alignas(32) uint64_t acc[8]= {
+		PRIME32_3, PRIME64_1, PRIME64_2, PRIME64_3,
+		PRIME64_4, PRIME32_2, PRIME64_5, PRIME32_1,
+	};
+	accumulate(acc, p, size);
+	uint64_t h= size * PRIME64_1;
+	for (size_t i= 0; i < 4; ++i)
+		h += multiply_fold(acc[2 * i] ^ read_64(secret + 11 + 16 * i),
+			acc[2 * i + 1] ^ read_64(secret + 11 + 16 * i + 8));
+	return avalanche(h);
+}
+
+void Content_Hash::accumulate_init(uint64_t *acc, const char *p, size_t size)
+{
+#if USE_SIMD
+	__builtin_cpu_init();
+	accumulate= __builtin_cpu_supports("avx2") ? &accumulate_avx2 : &accumulate_sse2;
+#else
+	accumulate= &accumulate_scalar;
+#endif
+	accumulate(acc, p, size);
+}
+
+void Content_Hash::accumulate_scalar(uint64_t *acc, const char *p, size_t size)
+/* The last stripe overlaps the previous ones, and is mixed with a separate part of the
+ * secret.  The accumulators are not scrambled after the last, incomplete block. */
+{
+	const size_t count_blocks= (size - 1) / SIZE_BLOCK;
+	for (size_t n= 0; n < count_blocks; ++n) {
+		for (size_t i= 0; i < COUNT_STRIPES_BLOCK; ++i)
+			stripe_scalar(acc, p + n * SIZE_BLOCK + i * SIZE_STRIPE, secret + 8 * i);
+		scramble_scalar(acc);
+	}
+	const size_t count_stripes= (size - 1 - count_blocks * SIZE_BLOCK) / SIZE_STRIPE;
+	for (size_t i= 0; i < count_stripes; ++i)
+		stripe_scalar(acc, p + count_blocks * SIZE_BLOCK + i * SIZE_STRIPE,
+			secret + 8 * i);
+	stripe_scalar(acc, p + size - SIZE_STRIPE, secret + SIZE_SECRET - SIZE_STRIPE - 7);
+}
+
+void Content_Hash::stripe_scalar(uint64_t *acc, const char *p, const unsigned char *s)
+{
+	for (size_t i= 0; i < 8; ++i) {
+		uint64_t data= read_64(p + 8 * i);
+		uint64_t key= data ^ read_64(s + 8 * i);
+		acc[i ^ 1] += data;
+		acc[i] += (key & 0xFFFFFFFF) * (key >> 32);
+	}
+}
+
+void Content_Hash::scramble_scalar(uint64_t *acc)
+{
+	for (size_t i= 0; i < 8; ++i) {
+		uint64_t a= acc[i];
+		a ^= a >> 47;
+		a ^= read_64(secret + SIZE_SECRET - SIZE_STRIPE + 8 * i);
+		acc[i]= a * PRIME32_1;
+	}
+}
+
+#if USE_SIMD
+
+void Content_Hash::accumulate_sse2(uint64_t *acc, const char *p, size_t size)
+/* Each vector holds two accumulators.  The accumulators are kept in registers for the
+ * whole input. */
+{
+	__m128i a[4];
+	for (size_t j= 0; j < 4; ++j)
+		a[j]= _mm_load_si128((const __m128i *)acc + j);
+	const size_t count_blocks= (size - 1) / SIZE_BLOCK;
+	for (size_t n= 0; n < count_blocks; ++n) {
+		for (size_t i= 0; i < COUNT_STRIPES_BLOCK; ++i)
+			stripe_sse2(a, p + n * SIZE_BLOCK + i * SIZE_STRIPE, secret + 8 * i);
+		scramble_sse2(a);
+	}
+	const size_t count_stripes= (size - 1 - count_blocks * SIZE_BLOCK) / SIZE_STRIPE;
+	for (size_t i= 0; i < count_stripes; ++i)
+		stripe_sse2(a, p + count_blocks * SIZE_BLOCK + i * SIZE_STRIPE, secret + 8 * i);
+	stripe_sse2(a, p + size - SIZE_STRIPE, secret + SIZE_SECRET - SIZE_STRIPE - 7);
+	for (size_t j= 0; j < 4; ++j)
+		_mm_store_si128((__m128i *)acc + j, a[j]);
+}
+
+void Content_Hash::stripe_sse2(__m128i *a, const char *p, const unsigned char *s)
+{
+	for (size_t j= 0; j < 4; ++j) {
+		const __m128i data= _mm_loadu_si128((const __m128i *)p + j);
+		const __m128i key= _mm_xor_si128(data, _mm_loadu_si128((const __m128i *)s + j));
+		const __m128i product= _mm_mul_epu32(key, _mm_srli_epi64(key, 32));
+		const __m128i swapped= _mm_shuffle_epi32(data, _MM_SHUFFLE(1, 0, 3, 2));
+		a[j]= _mm_add_epi64(a[j], _mm_add_epi64(product, swapped));
+	}
+}
+
+void Content_Hash::scramble_sse2(__m128i *a)
+/* There is no multiplication of 64 bits; the upper half is multiplied separately */
+{
+	const __m128i prime= _mm_set1_epi32((int)PRIME32_1);
+	for (size_t j= 0; j < 4; ++j) {
+		__m128i v= _mm_xor_si128(a[j], _mm_srli_epi64(a[j], 47));
+		v= _mm_xor_si128(v, _mm_loadu_si128(
+			(const __m128i *)(secret + SIZE_SECRET - SIZE_STRIPE) + j));
+		const __m128i lo= _mm_mul_epu32(v, prime);
+		const __m128i hi= _mm_mul_epu32(_mm_srli_epi64(v, 32), prime);
+		a[j]= _mm_add_epi64(lo, _mm_slli_epi64(hi, 32));
+	}
+}
+
+__attribute__((target("avx2")))
+void Content_Hash::accumulate_avx2(uint64_t *acc, const char *p, size_t size)
+/* As accumulate_sse2(), with four accumulators per vector */
+{
+	__m256i a[2];
+	for (size_t j= 0; j < 2; ++j)
+		a[j]= _mm256_load_si256((const __m256i *)acc + j);
+	const size_t count_blocks= (size - 1) / SIZE_BLOCK;
+	for (size_t n= 0; n < count_blocks; ++n) {
+		for (size_t i= 0; i < COUNT_STRIPES_BLOCK; ++i)
+			stripe_avx2(a, p + n * SIZE_BLOCK + i * SIZE_STRIPE, secret + 8 * i);
+		scramble_avx2(a);
+	}
+	const size_t count_stripes= (size - 1 - count_blocks * SIZE_BLOCK) / SIZE_STRIPE;
+	for (size_t i= 0; i < count_stripes; ++i)
+		stripe_avx2(a, p + count_blocks * SIZE_BLOCK + i * SIZE_STRIPE, secret + 8 * i);
+	stripe_avx2(a, p + size - SIZE_STRIPE, secret + SIZE_SECRET - SIZE_STRIPE - 7);
+	for (size_t j= 0; j < 2; ++j)
+		_mm256_store_si256((__m256i *)acc + j, a[j]);
+}
+
+__attribute__((target("avx2")))
+void Content_Hash::stripe_avx2(__m256i *a, const char *p, const unsigned char *s)
+{
+	for (size_t j= 0; j < 2; ++j) {
+		const __m256i data= _mm256_loadu_si256((const __m256i *)p + j);
+		const __m256i key= _mm256_xor_si256(data,
+			_mm256_loadu_si256((const __m256i *)s + j));
+		const __m256i product= _mm256_mul_epu32(key, _mm256_srli_epi64(key, 32));
+		const __m256i swapped= _mm256_shuffle_epi32(data, _MM_SHUFFLE(1, 0, 3, 2));
+		a[j]= _mm256_add_epi64(a[j], _mm256_add_epi64(product, swapped));
+	}
+}
+
+__attribute__((target("avx2")))
+void Content_Hash::scramble_avx2(__m256i *a)
+{
+	const __m256i prime= _mm256_set1_epi32((int)PRIME32_1);
+	for (size_t j= 0; j < 2; ++j) {
+		__m256i v= _mm256_xor_si256(a[j], _mm256_srli_epi64(a[j], 47));
+		v= _mm256_xor_si256(v, _mm256_loadu_si256(
+			(const __m256i *)(secret + SIZE_SECRET - SIZE_STRIPE) + j));
+		const __m256i lo= _mm256_mul_epu32(v, prime);
+		const __m256i hi= _mm256_mul_epu32(_mm256_srli_epi64(v, 32), prime);
+		a[j]= _mm256_add_epi64(lo, _mm256_slli_epi64(hi, 32));
+	}
+}
+
+#endif /* USE_SIMD */
+
+uint64_t Content_Hash::mix_16(const char *p, const unsigned char *s)
+{
+	return multiply_fold(read_64(p) ^ read_64(s), read_64(p + 8) ^ read_64(s + 8));
+}
+
+uint64_t Content_Hash::multiply_fold(uint64_t a, uint64_t b)
+/* From four products of 32 bits, since __int128 is not part of C++ */
+{
+	const uint64_t lo_lo= (a & 0xFFFFFFFF) * (b & 0xFFFFFFFF);
+	const uint64_t hi_lo= (a >> 32) * (b & 0xFFFFFFFF);
+	const uint64_t lo_hi= (a & 0xFFFFFFFF) * (b >> 32);
+	const uint64_t hi_hi= (a >> 32) * (b >> 32);
+	const uint64_t cross= (lo_lo >> 32) + (hi_lo & 0xFFFFFFFF) + lo_hi;
+	const uint64_t upper= (hi_lo >> 32) + (cross >> 32) + hi_hi;
+	const uint64_t lower= (cross << 32) | (lo_lo & 0xFFFFFFFF);
+	return upper ^ lower;
+}
+
+uint64_t Content_Hash::avalanche(uint64_t h)
+{
+	h ^= h >> 37;
+	h *= PRIME_MX1;
+	return h ^ (h >> 32);
+}
+
+uint64_t Content_Hash::avalanche_xxh64(uint64_t h)
+{
+	h ^= h >> 33;
+	h *= PRIME64_2;
+	h ^= h >> 29;
+	h *= PRIME64_3;
+	return h ^ (h >> 32);
+}
+
+uint64_t Content_Hash::rrmxmx(uint64_t h, size_t size)
+{
+	h ^= rotate(h, 49) ^ rotate(h, 24);
+	h *= PRIME_MX2;
+	h ^= (h >> 35) + size;
+	h *= PRIME_MX2;
+	return h ^ (h >> 28);
+}
+
+uint64_t Content_Hash::read_64(const void *p)
+/* The byte order of the machine is used.  XXH3 is defined in little-endian order, and
+ * therefore hashes differ from it on big-endian machines, which does not matter since
+ * hashes are only compared on the same machine. */
+{
+	uint64_t ret;
+	memcpy(&ret, p, sizeof(ret));
+	return ret;
+}
+
+uint32_t Content_Hash::read_32(const void *p)
+{
+	uint32_t ret;
+	memcpy(&ret, p, sizeof(ret));
+	return ret;
+}
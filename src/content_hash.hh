@@ -0,0 +1,116 @@
+#ifndef CONTENT_HASH_HH
+#define CONTENT_HASH_HH
+
+/*
+ * Hashes of the content of files, for dependencies that are compared by content (flag
+ * -h and option -H).  The hash is the 64-bit XXH3 of the file, as defined by xxHash
+ * 0.8, with the default secret and the seed zero.  Inputs of up to 240 bytes are hashed
+ * by separate code paths.  Longer inputs are processed in stripes of 64 bytes, which are
+ * mixed into eight accumulators of 64 bits; on x86, using SSE2, or AVX2 when the CPU
+ * supports it, as determined at runtime, as in scan.hh.  When USE_SIMD is 0, the
+ * accumulators are updated one by one.  Files are mapped into memory with mmap()
+ * instead of being read.
+ *
+ * Hashes are cached by the fingerprint of the file, which includes the device and inode
+ * numbers, the modification time and the size.  Within one invocation of Stu, a file is
+ * only read again when its fingerprint has changed.  Across invocations, the build log
+ * stores the hash together with the fingerprint of each input, such that a file that
+ * was not changed is never read again.
+ */
+
+#include <string>
+#include <unordered_map>
+
+#include "build_log.hh"
+#include "scan.hh"
+
+class Content_Hash
+{
+public:
+	static constexpr uint64_t HASH_NONE= 0;
+	/* Not a valid hash */
+
+	static uint64_t get(const std::string &filename, const Fingerprint &fingerprint);
+	/* The hash of the content of FILENAME, which has FINGERPRINT.  HASH_NONE when
+	 * the file cannot be read. */
+
+	static uint64_t hash(const char *data, size_t size);
+	/* Never HASH_NONE */
+
+	static void print_statistics();
+	/* Output nothing when no file was hashed */
+
+private:
+	static constexpr uint64_t PRIME32_1= 0x9E3779B1U;
+	static constexpr uint64_t PRIME32_2= 0x85EBCA77U;
+	static constexpr uint64_t PRIME32_3= 0xC2B2AE3DU;
+	static constexpr uint64_t PRIME64_1= 0x9E3779B185EBCA87ULL;
+	static constexpr uint64_t PRIME64_2= 0xC2B2AE3D27D4EB4FULL;
+	static constexpr uint64_t PRIME64_3= 0x165667B19E3779F9ULL;
+	static constexpr uint64_t PRIME64_4= 0x85EBCA77C2B2AE63ULL;
+	static constexpr uint64_t PRIME64_5= 0x27D4EB2F165667C5ULL;
+	static constexpr uint64_t PRIME_MX1= 0x165667919E3779F9ULL;
+	static constexpr uint64_t PRIME_MX2= 0x9FB21C651E98DF25ULL;
+	/* The primes of xxHash */
+
+	static constexpr size_t SIZE_SECRET= 192;
+	static constexpr size_t SIZE_STRIPE= 64;
+	static constexpr size_t COUNT_STRIPES_BLOCK= (SIZE_SECRET - SIZE_STRIPE) / 8;
+	static constexpr size_t SIZE_BLOCK= SIZE_STRIPE * COUNT_STRIPES_BLOCK;
+	/* Each stripe of a block uses the secret from an offset eight bytes further.  The
+	 * accumulators are scrambled after each block. */
+
+	alignas(64) static const unsigned char secret[SIZE_SECRET];
+
+	struct Entry {
+		Fingerprint fingerprint;
+		uint64_t hash;
+	};
+
+	static std::unordered_map <std::string, Entry> entries;
+	static size_t count_files;
+	static uint64_t count_bytes;
+
+	static void (*accumulate)(uint64_t *acc, const char *p, size_t size);
+	/* Initially accumulate_init(), which replaces itself by the best
+	 * implementation.  Process all stripes of an input of more than 240 bytes. */
+
+	static uint64_t compute(const char *filename);
+	/* Read the file and hash it */
+
+	static uint64_t hash_16(const char *p, size_t size);
+	static uint64_t hash_128(const char *p, size_t size);
+	static uint64_t hash_240(const char *p, size_t size);
+	static uint64_t hash_long(const char *p, size_t size);
+	/* For inputs of up to 16, 128, 240 bytes, and of more than 240 bytes */
+
+	static void accumulate_init(uint64_t *acc, const char *p, size_t size);
+	static void accumulate_scalar(uint64_t *acc, const char *p, size_t size);
+	static void stripe_scalar(uint64_t *acc, const char *p, const unsigned char *s);
+	static void scramble_scalar(uint64_t *acc);
+#if USE_SIMD
+	static void accumulate_sse2(uint64_t *acc, const char *p, size_t size);
+	static void stripe_sse2(__m128i *a, const char *p, const unsigned char *s);
+	static void scramble_sse2(__m128i *a);
+	static void accumulate_avx2(uint64_t *acc, const char *p, size_t size);
+	static void stripe_avx2(__m256i *a, const char *p, const unsigned char *s);
+	static void scramble_avx2(__m256i *a);
+#endif
+
+	static uint64_t mix_16(const char *p, const unsigned char *s);
+	static uint64_t multiply_fold(uint64_t a, uint64_t b);
+	/* The upper and the lower half of the 128-bit product, XORed */
+	static uint64_t avalanche(uint64_t h);
+	static uint64_t avalanche_xxh64(uint64_t h);
+	static uint64_t rrmxmx(uint64_t h, size_t size);
+	static uint64_t read_64(const void *p);
+	static uint32_t read_32(const void *p);
+	static uint64_t swap_64(uint64_t x) {
+		return __builtin_bswap64(x);
+	}
+	static uint64_t rotate(uint64_t x, int r) {
+		return (x << r) | (x >> (64 - r));
+	}
+};
+
+#endif /* ! CONTENT_HASH_HH */
@@ -0,0 +1,360 @@
+#include "copier.hh"
+
+#include <fcntl.h>
+#include <limits>
+#include <signal.h>
+#include <sys/stat.h>
+
+#include "worker.hh"
+
+pid_t Copier::pid_next= PID_FIRST;
+size_t Copier::count_running= 0;
+std::atomic <bool> Copier::is_terminated(false);
+std::atomic <pid_t> Copier::pid_first_valid(PID_FIRST);
+std::atomic <size_t> Copier::count_copying(0);
+size_t Copier::count_background= 0;
+pthread_mutex_t Copier::mutex;
+pthread_cond_t Copier::cond;
+pthread_cond_t Copier::cond_background;
+size_t Copier::count_threads= 0;
+size_t Copier::count_idle= 0;
+std::vector <Copier::Task> *Copier::tasks= nullptr;
+std::vector <Copier::Result> *Copier::results= nullptr;
+std::vector <void *> *Copier::datas_background= nullptr;
+
+pid_t Copier::start(string target, string source)
+{
+	TRACE_FUNCTION();
+	TRACE("target= %s", target);
+	TRACE("source= %s", source);
+	assert(pid_next < std::numeric_limits <pid_t>::max());
+	pid_t pid= pid_next++;
+	++count_running;
+	queue(Task{pid, target, source, nullptr, nullptr});
+	return pid;
+}
+
+void Copier::start_background(void (*function)(void *), void *data)
+{
+	TRACE_FUNCTION();
+	assert(function);
+	++count_background;
+	queue(Task{0, "", "", function, data});
+}
+
+void *Copier::get_background()
+{
+	if (count_background == 0)
+		return nullptr;
+	void *data= nullptr;
+	pthread_mutex_lock(&mutex);
+	if (! datas_background->empty()) {
+		data= datas_background->back();
+		datas_background->pop_back();
+	}
+	pthread_mutex_unlock(&mutex);
+	if (data)
+		--count_background;
+	return data;
+}
+
+void *Copier::wait_background()
+{
+	TRACE_FUNCTION();
+	if (count_background == 0)
+		return nullptr;
+	pthread_mutex_lock(&mutex);
+	while (datas_background->empty())
+		pthread_cond_wait(&cond_background, &mutex);
+	void *data= datas_background->back();
+	datas_background->pop_back();
+	pthread_mutex_unlock(&mutex);
+	--count_background;
+	return data;
+}
+
+pid_t Copier::wait(int *status)
+{
+	if (count_running == 0)
+		return 0;
+
+	Result result;
+	bool found= false;
+	pthread_mutex_lock(&mutex);
+	while (! found && ! results->empty()) {
+		result= std::move(results->back());
+		results->pop_back();
+		/* Results of cancelled copies are dropped */
+		found= result.pid >= pid_first_valid;
+	}
+	pthread_mutex_unlock(&mutex);
+	if (! found)
+		return 0;
+
+	--count_running;
+	if (result.errnum) {
+		/* The same exit status as cp */
+		errno= result.errnum;
+		print_errno(result.call, result.filename);
+		*status= 1 << 8;
+	} else {
+		*status= 0;
+	}
+	assert(WIFEXITED(*status));
+	return result.pid;
+}
+
+bool Copier::copy_file(const string &target, const string &source, string &message)
+{
+	/* No TRACE_FUNCTION(), as tracing is not thread-safe */
+	Task task{0, target, source, nullptr, nullptr};
+	Result result;
+	copy(task, result);
+	if (result.errnum) {
+		errno= result.errnum;
+		message= format_errno(result.call, result.filename);
+		return false;
+	}
+	return true;
+}
+
+void Copier::terminate()
+{
+	/* [ASYNC-SIGNAL-SAFE] Atomic variables and nanosleep() only */
+	is_terminated= true;
+	while (count_copying) {
+		struct timespec t= {0, 1000000};
+		nanosleep(&t, nullptr);
+	}
+}
+
+void Copier::reset()
+{
+	TRACE_FUNCTION();
+	if (tasks) {
+		/* Background functions are still executed */
+		std::vector <Task> tasks_background;
+		pthread_mutex_lock(&mutex);
+		for (Task &task: *tasks)
+			if (task.function)
+				tasks_background.push_back(std::move(task));
+		tasks->swap(tasks_background);
+		results->clear();
+		pthread_mutex_unlock(&mutex);
+	}
+	/* Copies that are still taken by worker threads are cancelled by their PID */
+	pid_first_valid= pid_next;
+	is_terminated= false;
+	count_running= 0;
+}
+
+void Copier::queue(Task &&task)
+{
+	if (! tasks) {
+		/* No thread exists yet */
+		Worker::init(&mutex, &cond, &cond_background);
+		tasks= new std::vector <Task>;
+		results= new std::vector <Result>;
+		datas_background= new std::vector <void *>;
+	}
+
+	pthread_mutex_lock(&mutex);
+	tasks->push_back(std::move(task));
+	bool need_thread= count_idle < tasks->size()
+		&& count_threads < COUNT_THREADS_MAX;
+	pthread_cond_signal(&cond);
+	pthread_mutex_unlock(&mutex);
+
+	if (need_thread)
+		start_thread();
+}
+
+void Copier::start_thread()
+{
+	TRACE_FUNCTION();
+	int r= Worker::start(run);
+	if (r) {
+		/* Copies already queued are executed by existing threads */
+		errno= r;
+		if (count_threads == 0) {
+			print_errno("pthread_create");
+			error_exit();
+		}
+		return;
+	}
+	pthread_mutex_lock(&mutex);
+	++count_threads;
+	pthread_mutex_unlock(&mutex);
+}
+
+void *Copier::run(void *)
+{
+	pthread_mutex_lock(&mutex);
+	while (true) {
+		while (tasks->empty()) {
+			++count_idle;
+			pthread_cond_wait(&cond, &mutex);
+			--count_idle;
+		}
+		Task task= std::move(tasks->front());
+		tasks->erase(tasks->begin());
+		if (task.function) {
+			pthread_mutex_unlock(&mutex);
+			task.function(task.data);
+			pthread_mutex_lock(&mutex);
+			datas_background->push_back(task.data);
+			pthread_cond_signal(&cond_background);
+			continue;
+		}
+		/* Counted while the mutex is held, such that reset() cannot clear
+		 * TASKS between taking a task and counting it */
+		++count_copying;
+		pthread_mutex_unlock(&mutex);
+
+		Result result;
+		copy(task, result);
+
+		pthread_mutex_lock(&mutex);
+		--count_copying;
+		results->push_back(std::move(result));
+		/* Wake up the main thread in Job::wait() */
+		kill(getpid(), SIGCHLD);
+	}
+}
+
+void Copier::copy(const Task &task, Result &result)
+{
+	result.pid= task.pid;
+	result.errnum= 0;
+	result.call= nullptr;
+
+	int fd_source= -1, fd_target= -1;
+	struct stat buf;
+
+	if (is_cancelled(task)) {
+		errno= ECANCELED;
+		result.call= "open";
+		result.filename= task.target;
+		goto error;
+	}
+	fd_source= open(task.source.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd_source < 0) {
+		result.call= "open";
+		result.filename= task.source;
+		goto error;
+	}
+	if (fstat(fd_source, &buf) < 0) {
+		result.call= "fstat";
+		result.filename= task.source;
+		goto error;
+	}
+	fd_target= open(task.target.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+		buf.st_mode & 0777);
+	if (fd_target < 0) {
+		result.call= "open";
+		result.filename= task.target;
+		goto error;
+	}
+
+#if USE_COPY_FILE_RANGE
+	if (ioctl(fd_target, FICLONE, fd_source) == 0)
+		goto done;
+#endif
+	if (! copy_range(task, fd_source, fd_target, result)) {
+		char buffer[1 << 16];
+		while (true) {
+			if (is_cancelled(task)) {
+				errno= ECANCELED;
+				result.call= "write";
+				result.filename= task.target;
+				goto error;
+			}
+			ssize_t r= read(fd_source, buffer, sizeof(buffer));
+			if (r < 0 && errno == EINTR)
+				continue;
+			if (r < 0) {
+				result.call= "read";
+				result.filename= task.source;
+				goto error;
+			}
+			if (r == 0)
+				break;
+			for (ssize_t w= 0; w < r; ) {
+				ssize_t rr= write(fd_target, buffer + w, r - w);
+				if (rr < 0 && errno == EINTR)
+					continue;
+				if (rr < 0) {
+					result.call= "write";
+					result.filename= task.target;
+					goto error;
+				}
+				w += rr;
+			}
+		}
+	} else if (result.call) {
+		result.filename= task.target;
+		goto error;
+	}
+
+#if USE_COPY_FILE_RANGE
+ done:
+#endif
+	/* Cloning and truncating an empty file do not necessarily change the
+	 * timestamp */
+	if (futimens(fd_target, nullptr) < 0) {
+		result.call= "futimens";
+		result.filename= task.target;
+		goto error;
+	}
+	close(fd_source);
+	if (close(fd_target) < 0) {
+		fd_source= fd_target= -1;
+		result.call= "close";
+		result.filename= task.target;
+		goto error;
+	}
+	return;
+
+ error:
+	result.errnum= errno;
+	if (fd_source >= 0)
+		close(fd_source);
+	if (fd_target >= 0)
+		close(fd_target);
+}
+
+bool Copier::copy_range(const Task &task, int fd_source, int fd_target,
+	Result &result)
+{
+#if USE_COPY_FILE_RANGE
+	bool copied= false;
+	while (true) {
+		if (copied && is_cancelled(task)) {
+			errno= ECANCELED;
+			result.call= "copy_file_range";
+			return true;
+		}
+		ssize_t r= copy_file_range(fd_source, nullptr, fd_target, nullptr,
+			SIZE_CHUNK, 0);
+		if (r < 0 && errno == EINTR)
+			continue;
+		if (r < 0) {
+			if (! copied && (errno == EXDEV || errno == EINVAL
+					|| errno == ENOSYS || errno == EOPNOTSUPP))
+				return false;
+			result.call= "copy_file_range";
+			return true;
+		}
+		if (r == 0)
+			/* Files in /proc and other special files appear to be empty */
+			return copied;
+		copied= true;
+	}
+#else
+	(void) task;
+	(void) fd_source;
+	(void) fd_target;
+	(void) result;
+	return false;
+#endif
+}
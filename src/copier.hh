@@ -0,0 +1,160 @@
+#ifndef COPIER_HH
+#define COPIER_HH
+
+/*
+ * Copy rules executed within the Stu process.  When $STU_CP is not set, copy rules do
+ * not start a cp process, but are executed by a small pool of worker threads.  Each
+ * copy is a job like any other:  it is counted against -j, is stored in the job list
+ * under a pseudo-PID, and its termination is returned by Job::wait() with a wait status
+ * as that of cp.  Pseudo-PIDs are larger than any PID used by the kernel.  Worker
+ * threads block all signals, and send SIGCHLD to the process when a copy has finished,
+ * such that the main loop waits for processes and copies in the same way.
+ *
+ * On Linux, files are first cloned with FICLONE, which shares the data blocks on
+ * filesystems that support it, then copied with copy_file_range(), and finally with
+ * read() and write().  The target file is created with the permissions of the source
+ * file, minus the umask, and its timestamp is set to the current time, as cp does.
+ *
+ * The worker threads also execute functions in the background for other parts of Stu,
+ * such as the publishing of entries in the artifact cache.  These are not jobs.
+ *
+ * Copies cannot be killed as processes can.  Instead, when Stu terminates its jobs,
+ * worker threads check a flag before opening the files of a copy and between chunks of
+ * data, and the main thread waits until no copy is in progress before it removes the
+ * partially built targets.
+ */
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+#ifndef USE_COPY_FILE_RANGE
+#   if HAVE_COPY_FILE_RANGE
+#      define USE_COPY_FILE_RANGE 1
+#   else
+#      define USE_COPY_FILE_RANGE 0
+#   endif
+#endif
+
+#if USE_COPY_FILE_RANGE
+#   include <linux/fs.h>
+#   include <sys/ioctl.h>
+#endif
+
+#include <pthread.h>
+
+class Copier
+{
+public:
+	static pid_t start(std::string target, std::string source);
+	/* Queue a copy and return its pseudo-PID */
+
+	static pid_t wait(int *status);
+	/* Return the pseudo-PID of a finished copy and set its wait STATUS, or return 0
+	 * when no copy has finished.  Does not block.  Errors are output here. */
+
+	static bool copy_file(const std::string &target, const std::string &source,
+		std::string &message);
+	/* Copy in the calling thread, in the same way as copy rules.  On error, set
+	 * MESSAGE and return FALSE.  May be called from worker threads. */
+
+	static void start_background(void (*function)(void *), void *data);
+	/* Call FUNCTION with DATA in a worker thread.  This is not a job:  it is not
+	 * counted against -j and is not returned by wait().  FUNCTION must not output
+	 * anything, nor use any other state of the main thread. */
+
+	static void *get_background();
+	/* Return the DATA of a background function that has returned, or null when none
+	 * has.  Does not block. */
+
+	static void *wait_background();
+	/* Like get_background(), but wait for a background function to return.  Return
+	 * null when none is left. */
+
+	static bool is_pid(pid_t pid) {  return pid >= PID_FIRST;  }
+	/* [ASYNC-SIGNAL-SAFE] */
+
+	static size_t get_count_running() {  return count_running;  }
+	/* The number of copies started and not yet returned by wait() */
+
+	static void terminate();
+	/* [ASYNC-SIGNAL-SAFE] Cancel all copies, and wait until no worker thread is
+	 * copying anymore */
+
+	static void reset();
+	/* Forget the copies cancelled by terminate(), such that copies can be started
+	 * again */
+
+private:
+	static constexpr pid_t PID_FIRST= (pid_t)1 << 30;
+	/* Linux PIDs are at most 2^22, and other systems use even smaller values */
+
+	static constexpr size_t COUNT_THREADS_MAX= 4;
+	/* Copies are I/O-bound, so more threads rarely help */
+
+	struct Task {
+		pid_t pid;
+		std::string target, source;
+		void (*function)(void *);
+		void *data;
+		/* FUNCTION is null for copies */
+	};
+
+	struct Result {
+		pid_t pid;
+		int errnum;
+		/* Zero on success */
+		const char *call;
+		std::string filename;
+		/* The failed system call and its argument, when ERRNUM is set */
+	};
+
+	static constexpr size_t SIZE_CHUNK= 1 << 24;
+	/* Copies are cancelled between chunks of this size */
+
+	static pid_t pid_next;
+	static size_t count_running;
+	/* Only accessed from the main thread */
+
+	static std::atomic <bool> is_terminated;
+	static std::atomic <pid_t> pid_first_valid;
+	/* Copies with a smaller pseudo-PID were cancelled before the last reset() */
+	static std::atomic <size_t> count_copying;
+	/* The number of copies taken by worker threads and not yet finished */
+
+	static size_t count_background;
+	/* The number of background functions not yet returned by get_background() or
+	 * wait_background().  Only accessed from the main thread. */
+
+	static pthread_mutex_t mutex;
+	static pthread_cond_t cond, cond_background;
+	static size_t count_threads, count_idle;
+	static std::vector <Task> *tasks;
+	static std::vector <Result> *results;
+	static std::vector <void *> *datas_background;
+	/* Of the background functions that have returned */
+	/* Protected by MUTEX.  The vectors are allocated once and never freed, such that
+	 * worker threads can still access them while the process exits. */
+
+	static void queue(Task &&task);
+
+	static void start_thread();
+	static void *run(void *);
+	/* The main function of worker threads */
+
+	static void copy(const Task &task, Result &result);
+	/* Executed in worker threads */
+
+	static bool copy_range(const Task &task, int fd_source, int fd_target,
+		Result &result);
+	/* Return FALSE when copy_file_range() cannot be used for these files, in which
+	 * case nothing was copied */
+
+	static bool is_cancelled(const Task &task) {
+		return is_pid(task.pid)
+			&& (is_terminated || task.pid < pid_first_valid);
+	}
+	/* Copies made by copy_file() are never cancelled */
+};
+
+#endif /* ! COPIER_HH */
@@ -12,12 +12,15 @@ bool Cycle::find(
 	TRACE("parent= %s", show_trace(*parent));
 	TRACE("child= %s", show_trace(*child));
 	std::vector <Executor *> path;
+	std::unordered_set <Executor *> visited;
 	path.push_back(parent);
-	return find(path, child, dep_link);
+	visited.insert(parent);
+	return find(path, visited, child, dep_link);
 }
 
 bool Cycle::find(
 	std::vector <Executor *> &path,
+	std::unordered_set <Executor *> &visited,
 	Executor *child,
 	shared_ptr <const Dep> dep_link)
 {
@@ -29,8 +32,10 @@ bool Cycle::find(
 	for (auto &i: path.back()->get_parents()) {
 		Executor *next= i.first;
 		assert(next != nullptr);
+		if (! visited.insert(next).second)
+			continue;
 		path.push_back(next);
-		bool found= find(path, child, dep_link);
+		bool found= find(path, visited, child, dep_link);
 		if (found)
 			return true;
 		path.pop_back();
@@ -1,6 +1,8 @@
 #ifndef CYCLE_HH
 #define CYCLE_HH
 
+#include <unordered_set>
+
 #include "executor.hh"
 
 class Cycle
@@ -18,10 +20,14 @@ public:
 private:
 	static bool find(
 		std::vector <Executor *> &path,
+		std::unordered_set <Executor *> &visited,
 		Executor *child,
 		shared_ptr <const Dep> dep_link);
 	/* Helper function.  PATH is the currently explored path.  PATH[0] is the original
-	 * PARENT; PATH[end] is the oldest grandparent found yet. */
+	 * PARENT; PATH[end] is the oldest grandparent found yet.  VISITED contains the
+	 * executors already explored, such that executors reachable over multiple paths
+	 * are explored only once; otherwise the search would take time exponential in the
+	 * depth of the graph when executors have many parents. */
 
 	static void print(
 		const std::vector <Executor *> &path,
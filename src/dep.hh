@@ -180,6 +180,14 @@ public:
 		check();
 	}
 
+	Plain_Dep(const Placed_Flags &placed_flags_, Placed_Target &&placed_target_)
+		: Dep(placed_flags_),
+		  placed_target(std::move(placed_target_)),
+		  place(placed_target.place)
+	{
+		check();
+	}
+
 	Plain_Dep(
 		const Placed_Flags &placed_flags_,
 		const Placed_Target &placed_target_,
@@ -1,14 +1,18 @@
 #include "executor.hh"
 
+#include <algorithm>
 #include <limits.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
 
+#include <unordered_set>
+
 #include "cycle.hh"
 #include "concat_executor.hh"
 #include "dynamic_executor.hh"
 #include "explain.hh"
 #include "file_executor.hh"
+#include "job_list.hh"
 #include "parser.hh"
 #include "root_executor.hh"
 #include "tokenizer.hh"
@@ -64,12 +68,14 @@ void Executor::read_dynamic(
 			& (F_OPTIONAL | F_TRIVIAL);
 
 		if (! delim) {
-			/* Dynamic dependency in full Stu syntax */
+			/* Dynamic dependency in full Stu syntax.  The tokens are freed
+			 * together with ARENA at the end of this block. */
+			Arena arena;
 			std::vector <shared_ptr <Token> > tokens;
 			Place place_end;
 
 			Tokenizer::parse_tokens_file(
-				tokens,
+				tokens, arena,
 				Tokenizer::DYNAMIC, place_end, filename,
 				placed_target.place, -1,
 				allow_enoent, false);
@@ -148,6 +154,22 @@ void Executor::read_dynamic(
 	}
 }
 
+void Executor::reset()
+{
+	TRACE_FUNCTION();
+	assert(Job_List::get_size() == 0);
+	File_Executor::reset();
+	/* After a finished build, no executor is active anymore.  Each executor
+	 * appears once for each of its targets. */
+	std::unordered_set <Executor *> executors;
+	for (const auto &i: executors_by_hash_dep)
+		executors.insert(i.second.second);
+	executors_by_hash_dep.clear();
+	for (Executor *executor: executors)
+		delete executor;
+	out_message_done= false;
+}
+
 Executor *Executor::get_executor(shared_ptr <const Dep> dep)
 {
 	TRACE_FUNCTION(show_trace(*this));
@@ -423,16 +445,27 @@ void Executor::notify_variable(const std::map <string, string> &)
 Proceed Executor::execute_children()
 {
 	TRACE_FUNCTION(show_trace(*this));
-	assert(options_jobs > 0);
+	assert(! is_cut_short());
 
 	/* Since disconnect() may change executor->children, we must first
-	 * copy it over locally, and then iterate through it */
+	 * copy it over locally, and then iterate through it.  Children that are only
+	 * waiting for jobs are skipped. */
 	std::vector <Executor *> executors_children_vector
-		(children.begin(), children.end());
+		(children_ready.begin(), children_ready.end());
 	Proceed proceed_all= 0;
 
+	/* Children are taken from the back, so put those with the longest chain of jobs
+	 * there */
+	if (order == Order::CRITICAL) {
+		std::stable_sort(executors_children_vector.begin(),
+			executors_children_vector.end(),
+			[](const Executor *a, const Executor *b) {
+				return a->critical_path < b->critical_path;
+			});
+	}
+
 	while (! executors_children_vector.empty()) {
-		assert(options_jobs > 0);
+		assert(! is_cut_short());
 		if (order_vec) {
 			/* Exchange a random position with last position */
 			size_t p_last= executors_children_vector.size() - 1;
@@ -465,8 +498,10 @@ Proceed Executor::execute_children()
 
 		if (!proceed_child) {
 			disconnect(child, dep_child);
+		} else {
+			update_ready(child, proceed_child);
 		}
-		if (proceed_all & P_WAIT && options_jobs == 0)
+		if (proceed_all & P_WAIT && is_cut_short())
 			return proceed_all;
 	}
 
@@ -474,6 +509,10 @@ Proceed Executor::execute_children()
 		assert(option_k);
 	}
 
+	/* Children that were not executed are waiting for jobs */
+	if (children.size() > children_ready.size())
+		proceed_all |= P_WAIT;
+
 	if (proceed_all == 0) {
 		/* If there are still children, they must have returned P_WAIT or
 		 * P_CALL_AGAIN. */
@@ -583,6 +622,17 @@ void Executor::disconnect(Executor *const child, shared_ptr <const Dep> dep_chil
 		}
 	}
 
+	/* Record the files on which the command depends, for the build log */
+	if (File_Executor *file_executor= dynamic_cast <File_Executor *> (this))
+		file_executor->add_input(dep_child, child);
+
+	/* Propagate the critical path */
+	if (order == Order::CRITICAL) {
+		child->finish_critical_path();
+		critical_path_children= std::max(
+			critical_path_children, child->critical_path);
+	}
+
 	/* Propagate variables */
 	if ((dep_child->flags.get_flags() & F_VARIABLE)) {
 		assert(dynamic_cast <File_Executor *> (child));
@@ -613,6 +663,7 @@ void Executor::disconnect(Executor *const child, shared_ptr <const Dep> dep_chil
 	assert(children.count(child) == 1);
 	assert(child->parents.count(this) == 1);
 	children.erase(child);
+	children_ready.erase(child);
 	child->parents.erase(this);
 
 	if (child->want_delete()) delete child;
@@ -629,7 +680,7 @@ const Place &Executor::get_place() const
 Proceed Executor::execute_phase_A(shared_ptr <const Dep> dep_link)
 {
 	TRACE_FUNCTION(show_trace(dep_link));
-	assert(options_jobs > 0);
+	assert(! is_cut_short());
 	assert(dep_link);
 	if (finished(dep_link->flags.get_flags())) {
 		TRACE("Finished");
@@ -656,7 +707,7 @@ Proceed Executor::execute_phase_A(shared_ptr <const Dep> dep_link)
 		proceed |= proceed_children;
 		assert(is_valid(proceed));
 		if (proceed & P_WAIT) {
-			if (options_jobs == 0) {
+			if (is_cut_short()) {
 				TRACE("Wait; no jobs left");
 				return proceed;
 			}
@@ -664,7 +715,7 @@ Proceed Executor::execute_phase_A(shared_ptr <const Dep> dep_link)
 	}
 
 	assert(error == 0 || option_k);
-	assert(options_jobs > 0);
+	assert(! is_cut_short());
 
 	while (! buffer_A.empty()) {
 		TRACE("A: Buffer A not empty");
@@ -674,8 +725,7 @@ Proceed Executor::execute_phase_A(shared_ptr <const Dep> dep_link)
 		assert(is_valid(proceed_child));
 		TRACE("proceed_child= %s", show(proceed_child));
 		proceed |= proceed_child;
-		assert(options_jobs >= 0);
-		if (proceed & P_WAIT && options_jobs == 0) {
+		if (proceed & P_WAIT && is_cut_short()) {
 			TRACE("No jobs left");
 			return proceed;
 		}
@@ -691,7 +741,7 @@ Proceed Executor::execute_phase_A(shared_ptr <const Dep> dep_link)
 			frmt("%ld", options_jobs));
 		proceed |= proceed_children;
 		assert(is_valid(proceed));
-		if (proceed & P_WAIT && options_jobs == 0) {
+		if (proceed & P_WAIT && is_cut_short()) {
 			TRACE("Random: return %s", show(proceed));
 			return proceed;
 		}
@@ -725,7 +775,7 @@ Proceed Executor::execute_phase_B(shared_ptr <const Dep> dep_link)
 {
 	TRACE_FUNCTION(show_trace(*this));
 	assert(buffer_A.empty());
-	assert(options_jobs > 0);
+	assert(! is_cut_short());
 	Proceed proceed= 0;
 
 	while (! (buffer_A.empty() && buffer_B.empty())) {
@@ -733,7 +783,7 @@ Proceed Executor::execute_phase_B(shared_ptr <const Dep> dep_link)
 		if (! buffer_A.empty()) {
 			TRACE("B: Buffer A not empty");
 			Proceed proceed_A= execute_phase_A(dep_link);
-			if (proceed_A & P_WAIT && options_jobs == 0) {
+			if (proceed_A & P_WAIT && is_cut_short()) {
 				return proceed | proceed_A;
 			}
 			if (!proceed_A && error) {
@@ -748,8 +798,7 @@ Proceed Executor::execute_phase_B(shared_ptr <const Dep> dep_link)
 			TRACE("Popped from buffer_B dep_child=%s", show_trace(dep_child));
 			Proceed proceed_child= connect(dep_link, dep_child);
 			proceed |= proceed_child;
-			assert(options_jobs >= 0);
-			if (proceed_child & P_WAIT && options_jobs == 0) {
+			if (proceed_child & P_WAIT && is_cut_short()) {
 				TRACE("No jobs left");
 				return proceed;
 			}
@@ -757,6 +806,13 @@ Proceed Executor::execute_phase_B(shared_ptr <const Dep> dep_link)
 	}
 	assert(buffer_A.empty());
 	assert(buffer_B.empty());
+
+	/* Children connected from buffer B may still be running when jobs are left */
+	if (! children.empty()) {
+		TRACE("Children not empty, proceed= %s", show(proceed));
+		assert(proceed);
+		return proceed;
+	}
 	proceed= 0;
 	return proceed;
 }
@@ -779,6 +835,8 @@ void Executor::push_result(shared_ptr <const Dep> dd)
 			& (F_RESULT_NOTIFY | F_RESULT_COPY);
 		if (flags) {
 			i.first->notify_result(dd, this, flags, i.second);
+			/* The parent may have new dependencies to work on */
+			i.first->notify_ready();
 		}
 	}
 }
@@ -931,6 +989,7 @@ Proceed Executor::connect(
 	Executor *child= get_executor(dep_child);
 	if (!child) return 0;
 	children.insert(child);
+	children_ready.insert(child);
 	if (dep_child->flags.get_flags() & F_RESULT_NOTIFY) {
 		for (const auto &dependency:
 			     child->result[(dep_child->flags.get_flags() & F_PHASE_B) != 0])
@@ -944,7 +1003,10 @@ Proceed Executor::connect(
 	Proceed proceed_child= child->execute(dep_child);
 	TRACE("proceed_child= %s", show(proceed_child));
 	assert(is_valid(proceed_child));
-	if (proceed_child) return proceed_child;
+	if (proceed_child) {
+		update_ready(child, proceed_child);
+		return proceed_child;
+	}
 	bool child_finished= child->finished(dep_child->flags.get_flags());
 	TRACE("child_finished= %s", frmt("%d", child_finished));
 	if (child_finished) {
@@ -953,6 +1015,27 @@ Proceed Executor::connect(
 	return 0;
 }
 
+void Executor::update_ready(Executor *child, Proceed proceed_child)
+/* When CHILD returned P_WAIT without having been cut short, all its ready children were
+ * executed, i.e., it only waits for jobs to finish or for a job slot. */
+{
+	assert(children.count(child) == 1);
+	if (proceed_child == P_WAIT && ! is_cut_short()
+		&& child->children_ready.empty()) {
+		TRACE("Child is waiting");
+		children_ready.erase(child);
+	}
+}
+
+void Executor::notify_ready()
+{
+	for (auto &i: parents) {
+		assert(i.first->children.count(this) == 1);
+		if (i.first->children_ready.insert(this).second)
+			i.first->notify_ready();
+	}
+}
+
 bool Executor::same_dependency_for_print(
 	shared_ptr <const Dep> d1,
 	shared_ptr <const Dep> d2)
@@ -89,9 +89,10 @@ public:
 	virtual Proceed execute(shared_ptr <const Dep> dep_link)= 0;
 	/* Start the next job(s).  This will also terminate jobs when they don't need to
 	 * be run anymore, and thus it can be called when K = 0 just to terminate jobs
-	 * that need to be terminated.  Can only return LATER in random mode.  When
-	 * returning LATER, not all possible child jobs where started.  Child
-	 * implementations call this implementation.  Never returns P_CONTINUE: When
+	 * that need to be terminated.  In parallel mode, everything that does not need a
+	 * job is executed even when all job slots are in use.  Can only return LATER in
+	 * random mode.  When returning LATER, not all possible child jobs where started.
+	 * Child implementations call this implementation.  Never returns P_CONTINUE: When
 	 * everything is finished, the FINISHED bit is set.  In DONE, set those bits that
 	 * have been done.  When the call is over, clear the PENDING bit.  DEPENDENCY_LINK
 	 * is only null when called on the root executor, because it is the only executor
@@ -129,6 +130,14 @@ public:
 	static bool same_rule(const Executor *executor_a, const Executor *executor_b);
 	/* Whether both executors have the same parametrized rule.  Only used for finding
 	 * cycles. */
+	static void reset();
+	/* Forget all executors after a build, such that the targets are checked anew in
+	 * the next build.  Used with -w. */
+	static bool is_cut_short() {  return options_jobs == 0 && ! option_parallel;  }
+	/* Whether execution is cut short because all job slots are in use.  In parallel
+	 * mode, executors go on with everything that does not need a job slot.  Otherwise,
+	 * the sequential order of execution is kept. */
+
 	static bool hide_link_from_message(Flags flags) {
 		return flags & F_RESULT_NOTIFY;
 	}
@@ -150,6 +159,23 @@ protected:
 
 	std::set <Executor *> children;
 
+	std::set <Executor *> children_ready;
+	/* The subset of CHILDREN that may make progress when executed.  Children that
+	 * are only waiting for running jobs are not included; they are added again by
+	 * notify_ready() when one of those jobs has finished.  Thus, the traversal after a
+	 * job has finished only visits the part of the graph affected by it, instead of
+	 * all active executors. */
+
+	double critical_path= 0;
+	/* Only used in critical order:  the estimated length in seconds of the longest
+	 * chain of jobs needed to finish this executor, including its own job.  Initialized
+	 * from the history by executors that have targets, and used to order children in
+	 * execute_children().  Updated by finish_critical_path(). */
+
+	double critical_path_children= 0;
+	/* Only used in critical order:  the maximal CRITICAL_PATH of all children that
+	 * have been disconnected */
+
 	Timestamp timestamp= Timestamp::UNDEFINED;
 	/* Latest timestamp of a (direct or indirect) dependency that was not rebuilt.
 	 * Files that were rebuilt are not considered, since they make the target be
@@ -186,7 +212,11 @@ protected:
 	virtual ~Executor()= default;
 
 	Proceed execute_children();
-	/* Execute already-active children */
+	/* Execute already-active children that are ready */
+
+	void notify_ready();
+	/* THIS may make progress again, e.g. because one of its jobs has finished.
+	 * Insert THIS into CHILDREN_READY of all parents, recursively upwards. */
 
 	Proceed execute_phase_A(shared_ptr <const Dep> dep_link);
 	/* DEP_LINK is not null */
@@ -203,6 +233,7 @@ protected:
 		assert(buffer_A.empty());
 		assert(buffer_B.empty());
 		assert(children.empty());
+		assert(children_ready.empty());
 	}
 
 	const Buffer &get_buffer_A() const { return buffer_A; }
@@ -225,6 +256,12 @@ protected:
 		shared_ptr <const Dep> dep_this,
 		shared_ptr <const Dep> dep_child);
 
+	virtual void finish_critical_path() {
+		critical_path= std::max(critical_path, critical_path_children);
+	}
+	/* Called in critical order when THIS is disconnected from a parent, to set the
+	 * final value of CRITICAL_PATH */
+
 	virtual int get_depth() const {return 0; }
 	/* -1 when undefined as in concatenated executors and the root executor, in which
 	 * case PARAM_RULE is always null. */
@@ -242,7 +279,7 @@ protected:
 	static std::unordered_map <Hash_Dep, std::pair <Target_Index, Executor *> >
 		executors_by_hash_dep;
 	/* All cached Executor objects by each of their Target.  Such Executor objects are
-	 * never deleted. */
+	 * only deleted by reset(). */
 
 	static int trivial_index(shared_ptr <const Dep> d) {
 		return d->flags.get_flags() & F_TRIVIAL ? 1 : 0;
@@ -265,6 +302,10 @@ private:
 		Hash_Dep hash_dep,
 		bool &found_error);
 
+	void update_ready(Executor *child, Proceed proceed_child);
+	/* Remove CHILD from CHILDREN_READY if it returned PROCEED_CHILD only because
+	 * it is waiting for jobs to finish */
+
 	static bool same_dependency_for_print(shared_ptr <const Dep> d1,
 					      shared_ptr <const Dep> d2);
 };
@@ -64,7 +64,8 @@ void explain_flags()
 {
 	if (! option_E) return;
 	fputs("Explanation: The valid flags are -p (persistent dependency), -o (optional\n"
-		"dependency), and -t (trivial dependency).\n",
+		"dependency), -t (trivial dependency), and -h (dependency compared by\n"
+		"content).\n",
 		stderr);
 }
 
@@ -160,7 +161,7 @@ void explain_startup_time()
 void explain_target_flags()
 {
 	if (! option_E) return;
-	fputs("Explanation: Only the flags -p/-o/-n/-0/-C/-P can be used before targets\n"
+	fputs("Explanation: Only the flags -p/-o/-n/-0/-C/-P/-h can be used before targets\n"
 		"of a rule.  In that case, the flags will always apply to that target.\n"
 		"Flags cannot be used before phony targets.  If a rule has multiple\n"
 		"targets, each flag only applies to the target immediately following it.\n",
@@ -1,8 +1,14 @@
 #include "file_executor.hh"
 
+#include "artifact_cache.hh"
+#include "content_hash.hh"
+#include "jobserver.hh"
 #include "signal.hh"
+#include "stat_cache.hh"
 
 std::unordered_map <string, Timestamp> File_Executor::phonies;
+std::vector <File_Executor *> File_Executor::executors_waiting;
+std::deque <File_Executor *> File_Executor::executors_waiting_slot;
 
 File_Executor::File_Executor(
 	shared_ptr <const Dep> dep,
@@ -61,10 +67,28 @@ File_Executor::File_Executor(
 	for (size_t i= 0; i < hash_deps.size(); ++i)
 		executors_by_hash_dep[hash_deps[i]]= {i, this};
 
+	if (order == Order::CRITICAL)
+		for (const Hash_Dep &hash_dep: hash_deps)
+			critical_path= std::max(critical_path, History::get(hash_dep));
+
 	if (rule != nullptr) {
 		TRACE("There is a rule for this executor");
 		for (auto &d: rule->deps)
 			push(d);
+
+		/* The targets and the direct dependencies are checked soon */
+		std::vector <string> filenames_prefetch;
+		for (const Hash_Dep &hash_dep: hash_deps)
+			if (hash_dep.is_file())
+				filenames_prefetch.push_back(
+					hash_dep.get_name_nondynamic());
+		for (auto &d: rule->deps) {
+			shared_ptr <const Plain_Dep> plain_dep= to <Plain_Dep> (d);
+			if (plain_dep && ! (plain_dep->flags.get_flags() & F_TARGET_PHONY))
+				filenames_prefetch.push_back(
+					plain_dep->placed_target.placed_name.unparametrized());
+		}
+		Stat_Cache::prefetch(filenames_prefetch);
 	} else {
 		TRACE("There is no rule for this executor");
 
@@ -160,44 +184,88 @@ File_Executor::File_Executor(
 }
 
 File_Executor::~File_Executor()
-/* Objects of this type are never deleted */
+/* Objects of this type are only deleted by Executor::reset() */
 {
-	unreachable();
-#if 0
-	/* We put this here as a reminder if this is ever activated */
 	free(timestamps_old);
 	if (filenames) {
-		for (size_t i= 0; i < targets.size(); ++i)
-			if (filenames[i])
-				free(filenames[i]);
+		for (size_t i= 0; i < hash_deps.size(); ++i)
+			free(filenames[i]);
 		free(filenames);
 	}
 	free(target_flags);
-#endif /* 0 */
 }
 
 void File_Executor::wait()
 /* We wait for a single job to finish, and then return so that the next job can be
- * started.  It would also be possible to process as many finished jobs as possible, and
- * then return, but the current implementation prefers to first start the next job before
- * waiting for the next finished job. */
+ * started.  With the -b option, we also process all other jobs that have already
+ * finished, so that the dependency graph is traversed only once for all of them.  By
+ * default, we prefer to first start the next job before waiting for the next finished
+ * job. */
 {
 	int status;
-	const pid_t pid= Job::wait(&status);
-	timestamp_last= Timestamp::now();
-
-	size_t index;
-	File_Executor *executor= Job_List::find(pid, index);
-	if (!executor) {
-		should_not_happen();
-		print_warning(Place(),
-			frmt("the function waitpid(2) returned the unknown process ID %jd",
-				(intmax_t)pid));
+	pid_t pid= Job::wait(&status, true, Jobserver::get_fd_waiting());
+	if (pid == 0) {
+		/* The jobserver has a token for the executors waiting for one */
+		notify_waiting();
 		return;
 	}
+	size_t count= 0;
+
+	do {
+		timestamp_last= Timestamp::now();
+		++count;
+
+		size_t index;
+		File_Executor *executor= Job_List::find(pid, index);
+		if (!executor) {
+			should_not_happen();
+			print_warning(Place(),
+				frmt("the function waitpid(2) returned the unknown process ID %jd",
+					(intmax_t)pid));
+			continue;
+		}
+
+		executor->waited(pid, index, status);
+		++options_jobs;
+		executor->notify_ready();
+		if (! executors_waiting.empty())
+			notify_waiting();
+	} while (option_b && ! option_i && Job_List::get_size()
+		&& (pid= Job::wait(&status, false)) > 0);
+
+	if (option_b)
+		Job::count_batch(count);
+}
+
+void File_Executor::reset()
+{
+	phonies.clear();
+	executors_waiting.clear();
+	executors_waiting_slot.clear();
+}
+
+void File_Executor::notify_waiting()
+{
+	TRACE_FUNCTION();
+	for (File_Executor *executor: executors_waiting) {
+		executor->waiting= false;
+		executor->notify_ready();
+	}
+	executors_waiting.clear();
+}
 
-	executor->waited(pid, index, status);
-	++options_jobs;
+bool File_Executor::notify_waiting_slot()
+{
+	TRACE_FUNCTION();
+	bool notified= false;
+	for (long i= 0; i < options_jobs && ! executors_waiting_slot.empty(); ++i) {
+		File_Executor *executor= executors_waiting_slot.front();
+		executors_waiting_slot.pop_front();
+		executor->waiting_slot= false;
+		executor->notify_ready();
+		notified= true;
+	}
+	return notified;
 }
 
 void File_Executor::waited(pid_t pid, size_t index, int status)
@@ -213,13 +281,26 @@ void File_Executor::waited(pid_t pid, size_t index, int status)
 		Signal_Blocker sb;
 		Job_List::remove(index);
 	}
+	Pool::release(rule->pool_uses);
+	Jobserver::release(Job_List::get_size());
 
 	/* The file(s) may have been built, so forget that it was known to not exist */
 	state &= ~State::MISSING;
+	for (const Hash_Dep &hash_dep: hash_deps)
+		if (hash_dep.is_file())
+			Stat_Cache::invalidate(hash_dep.get_name_c_str_nondynamic());
+	Stat_Cache::invalidate_missing();
 
 	if (job.waited(status, pid)) {
 		state |=  State::EXISTING;
 		state &= ~State::MISSING;
+
+		if (order == Order::CRITICAL) {
+			critical_path= History::now() - seconds_start
+				+ critical_path_children;
+			for (const Hash_Dep &hash_dep: hash_deps)
+				History::set(hash_dep, critical_path);
+		}
 		/* Subsequently set to State::MISSING if at least one target file is missing */
 
 		/* Check that the file targets were built */
@@ -228,6 +309,11 @@ void File_Executor::waited(pid_t pid, size_t index, int status)
 			if (! hash_dep.is_file()) continue;
 			check_file_was_built(hash_dep, rule->targets[i]->place);
 		}
+		if (! error) {
+			restat();
+			write_build_log();
+			publish_cache();
+		}
 		/* In parallel mode, print "done" message */
 		if (option_parallel && !option_s) {
 			string text= show(hash_deps[0], S_NORMAL);
@@ -334,6 +420,8 @@ bool File_Executor::remove_if_existing(bool output)
 		}
 		removed= true;
 
+		if (output)
+			Stat_Cache::invalidate(filename);
 		if (0 > unlink(filename)) {
 			if (output) {
 				rule->place << format_errno("unlink", filename);
@@ -495,7 +583,10 @@ Proceed File_Executor::execute(shared_ptr <const Dep> dep_link)
 	assert(children.empty());
 	assert(error == 0);
 
-	make_timestamps_old();
+	/* When we are executed again after waiting for a pool, the old timestamps are
+	 * already known */
+	if (! (state & State::CHECKED))
+		make_timestamps_old();
 
 	/*
 	 * Check whether executor has to be built
@@ -527,6 +618,8 @@ Proceed File_Executor::execute(shared_ptr <const Dep> dep_link)
 				timestamp= timestamps_old[i];
 			}
 		}
+		if (rule && ! no_execution)
+			check_build_log(dep_link);
 	}
 
 	if (! (state & State::NEED_BUILD)) {
@@ -583,8 +676,6 @@ Proceed File_Executor::execute(shared_ptr <const Dep> dep_link)
 
 	out_message_done= true;
 
-	assert(options_jobs > 0);
-
 	/* For content rules, we don't need to start a job, and therefore this is executed
 	 * even if JOBS is zero. */
 	if (rule->is_content) {
@@ -592,12 +683,48 @@ Proceed File_Executor::execute(shared_ptr <const Dep> dep_link)
 		assert(hash_deps.front().is_file());
 		TRACE("Create content");
 		print_command();
+		save_outputs();
 		write_content(hash_deps.front().get_name_c_str_nondynamic(),
 			*(rule->command));
+		if (! error)
+			restat();
+		write_build_log();
 		done.set_all();
 		return 0;
 	}
 
+	/* Restoring the targets from the artifact cache does not need a job either */
+	if (! cache_checked) {
+		cache_checked= true;
+		if (check_cache()) {
+			done.set_all();
+			return 0;
+		}
+	}
+
+	if (options_jobs == 0) {
+		TRACE("Waiting for job slot");
+		assert(Job_List::get_size() != 0);
+		if (! waiting_slot) {
+			waiting_slot= true;
+			executors_waiting_slot.push_back(this);
+		}
+		return P_WAIT;
+	}
+
+	/* Wait until all pools of the rule have enough capacity left, and until we have
+	 * a jobserver token.  Both are always available when no job is running. */
+	if (! Pool::is_available(rule->pool_uses)
+		|| ! Jobserver::acquire(Job_List::get_size())) {
+		TRACE("Waiting for pool or jobserver");
+		assert(Job_List::get_size() != 0);
+		if (! waiting) {
+			waiting= true;
+			executors_waiting.push_back(this);
+		}
+		return P_WAIT;
+	}
+
 	/* We have to start a job now */
 	print_command();
 	for (const Hash_Dep &hash_dep: hash_deps) {
@@ -623,6 +750,7 @@ Proceed File_Executor::execute(shared_ptr <const Dep> dep_link)
 	mapping_parameter.clear();
 	mapping_variable.clear();
 
+	save_outputs();
 	make_remove_data();
 	pid_t pid;
 	size_t index; /* In EXECUTORS_BY_PID_* */
@@ -634,13 +762,16 @@ Proceed File_Executor::execute(shared_ptr <const Dep> dep_link)
 		 * in which the job would failed to be clean up. */
 		Signal_Blocker sb;
 
-		if (start(dep_link, pid, mapping))
+		if (start(dep_link, pid, mapping)) {
+			Jobserver::release(Job_List::get_size());
 			return 0;
+		}
 		TRACE("pid= %s", frmt("%jd", (intmax_t)pid));
 		assert(pid != 0 && pid != 1);
 
 		if (pid < 0) {
 			/* Starting the job failed */
+			Jobserver::release(Job_List::get_size());
 			*this << fmt("error executing command for %s",
 				show(hash_deps.front()));
 			raise(ERR_BUILD);
@@ -650,6 +781,7 @@ Proceed File_Executor::execute(shared_ptr <const Dep> dep_link)
 
 		Job_List::add(pid, index, this);
 	}
+	Pool::acquire(rule->pool_uses);
 
 	assert(Job_List::get(index)->job.started());
 	assert(pid == Job_List::get(index)->job.get_pid());
@@ -689,6 +821,9 @@ bool File_Executor::check_file_target(
 	}
 	TRACE("flags= %s", show(Flags_View(flags)));
 
+	/* Files without a command may have been changed by the commands of other rules */
+	if (no_execution)
+		Stat_Cache::invalidate(target.get_name_c_str_nondynamic());
 	struct stat buf;
 	int ret_stat= stat_file(target.get_name_c_str_nondynamic(), &buf, flags);
 	int errno_stat= errno;
@@ -768,11 +903,325 @@ bool File_Executor::check_file_target(
 	return false;
 }
 
+void File_Executor::add_input(shared_ptr <const Dep> dep_child, const Executor *child)
+{
+	Flags flags= dep_child->flags.get_flags();
+	if (flags & (F_TRIVIAL | F_RESULT_NOTIFY))
+		return;
+	const File_Executor *file_executor= dynamic_cast <const File_Executor *> (child);
+	if (flags & F_PERSISTENT) {
+		/* A persistent dependency that was rebuilt causes a rebuild */
+		if (! file_executor || file_executor->state & State::NEED_BUILD)
+			inputs_complete= false;
+		return;
+	}
+	shared_ptr <const Plain_Dep> plain_dep= to <Plain_Dep> (dep_child);
+	if (! plain_dep || flags & F_TARGET_PHONY || ! file_executor
+		|| (file_executor->rule && ! file_executor->rule->command
+			&& ! file_executor->rule->is_copy)) {
+		inputs_complete= false;
+		return;
+	}
+	bool hash= option_H || flags & F_HASH;
+	auto i= inputs.emplace(plain_dep->placed_target.placed_name.unparametrized(), hash);
+	/* Compare by content only when all links do */
+	i.first->second &= hash;
+}
+
+string File_Executor::get_text_command() const
+{
+	/* Parameters are passed to the command as environment variables, and are
+	 * therefore not part of the command text */
+	string text;
+	text += rule->is_content ? 'c' : rule->is_copy ? 'y' : 'r';
+	if (rule->command)
+		for (const string &line: rule->command->get_lines()) {
+			text += line;
+			text += '\n';
+		}
+	text += '\0';
+	text += rule->placed_name_input.unparametrized();
+	text += '\0';
+	text += frmt("%u", rule->output_target_index);
+	text += '\0';
+	for (const auto &i: mapping_parameter) {
+		text += i.first;
+		text += '=';
+		text += i.second;
+		text += '\0';
+	}
+	return text;
+}
+
+uint64_t File_Executor::compute_hash_command() const
+{
+	return Build_Log::hash(get_text_command());
+}
+
+bool File_Executor::check_cache()
+{
+	TRACE_FUNCTION();
+	assert(! rule->is_content);
+	if (! Artifact_Cache::is_enabled() || ! rule->command || rule->is_copy
+		|| ! inputs_complete)
+		return false;
+
+	string text= get_text_command();
+	/* Variables override parameters, as when the job is started */
+	std::map <string, string> mapping= mapping_variable;
+	mapping.insert(mapping_parameter.begin(), mapping_parameter.end());
+	for (const auto &i: mapping) {
+		text += i.first;
+		text += '=';
+		text += i.second;
+		text += '\0';
+	}
+	std::vector <string> filenames_target;
+	for (const Hash_Dep &hash_dep: hash_deps) {
+		if (! hash_dep.is_file())
+			return false;
+		filenames_target.push_back(hash_dep.get_name_nondynamic());
+		text += filenames_target.back();
+		text += '\0';
+	}
+	for (const auto &i: inputs) {
+		text += i.first;
+		text += '\0';
+		struct stat buf;
+		if (Stat_Cache::stat(i.first.c_str(), &buf, false) < 0) {
+			if (errno != ENOENT)
+				return false;
+			/* An optional dependency */
+			text += '-';
+			continue;
+		}
+		uint64_t hash;
+		if (! S_ISREG(buf.st_mode)
+			|| (hash= Content_Hash::get(i.first, Fingerprint(&buf)))
+			== Content_Hash::HASH_NONE)
+			return false;
+		text += frmt("%016jx", (uintmax_t)hash);
+	}
+	cache_key= Artifact_Cache::get_key(text, rule->command->command);
+
+	save_outputs();
+	for (const string &filename: filenames_target)
+		Stat_Cache::invalidate(filename);
+	if (! Artifact_Cache::restore(cache_key, filenames_target, rule->place))
+		return false;
+
+	TRACE("Restored from the artifact cache");
+	print_command();
+	state |= State::EXISTING;
+	state &= ~State::MISSING;
+	for (size_t i= 0; i < hash_deps.size(); ++i)
+		check_file_was_built(hash_deps[i], rule->targets[i]->place);
+	if (! error) {
+		restat();
+		write_build_log();
+	}
+	return true;
+}
+
+void File_Executor::publish_cache()
+{
+	if (cache_key.empty())
+		return;
+	std::vector <string> filenames_target;
+	for (const Hash_Dep &hash_dep: hash_deps)
+		filenames_target.push_back(hash_dep.get_name_nondynamic());
+	Artifact_Cache::publish(cache_key, filenames_target, rule->place);
+}
+
+void File_Executor::check_build_log(shared_ptr <const Dep> dep_link)
+{
+	TRACE_FUNCTION();
+	hash_command= compute_hash_command();
+	bool persistent= dep_link->flags.get_flags() & F_PERSISTENT;
+	/* Fingerprints are only compared when the timestamps require a rebuild */
+	bool unchanged= state & State::NEED_BUILD && inputs_complete;
+	bool has_record= false;
+	std::vector <std::pair <string, Build_Log::Record> > records_new;
+	for (const Hash_Dep &hash_dep: hash_deps) {
+		if (! hash_dep.is_file())
+			continue;
+		const Build_Log::Record *record=
+			Build_Log::get(hash_dep.get_name_nondynamic());
+		if (! record) {
+			unchanged= false;
+			continue;
+		}
+		has_record= true;
+		if (record->hash_command != hash_command && ! persistent) {
+			TRACE("Command changed");
+			state |= State::NEED_BUILD;
+			return;
+		}
+		if (! unchanged)
+			continue;
+		struct stat buf;
+		Build_Log::Record record_new;
+		bool changed;
+		if (stat_file(hash_dep.get_name_c_str_nondynamic(), &buf,
+				hash_dep.get_front_word_nondynamic())
+			|| Fingerprint(&buf) != record->fingerprint
+			|| ! check_inputs(*record, record_new, changed))
+			unchanged= false;
+		else if (changed)
+			records_new.emplace_back(hash_dep.get_name_nondynamic(),
+				std::move(record_new));
+	}
+	if (unchanged && has_record) {
+		TRACE("Fingerprints or hashes unchanged");
+		state &= ~State::NEED_BUILD;
+		for (auto &i: records_new)
+			Build_Log::set(i.first, std::move(i.second));
+	}
+}
+
+bool File_Executor::check_inputs(const Build_Log::Record &record,
+	Build_Log::Record &record_new, bool &changed) const
+{
+	if (inputs.size() != record.inputs.size())
+		return false;
+	record_new= record;
+	changed= false;
+	size_t k= 0;
+	for (const auto &i: inputs) {
+		const Build_Log::Input &input= record.inputs[k];
+		if (i.first != input.filename)
+			return false;
+		struct stat buf;
+		Fingerprint fingerprint;
+		if (Stat_Cache::stat(i.first.c_str(), &buf, false) == 0)
+			fingerprint= Fingerprint(&buf);
+		if (fingerprint != input.fingerprint) {
+			if (! i.second || input.hash == Content_Hash::HASH_NONE
+				|| Content_Hash::get(i.first, fingerprint) != input.hash)
+				return false;
+			TRACE("Content of %s unchanged", i.first);
+			record_new.inputs[k].fingerprint= fingerprint;
+			changed= true;
+		}
+		++k;
+	}
+	return true;
+}
+
+void File_Executor::write_build_log()
+{
+	TRACE_FUNCTION();
+	Build_Log::Record record;
+	record.hash_command= hash_command;
+	for (const auto &i: inputs) {
+		struct stat buf;
+		Build_Log::Input input{i.first, Fingerprint(), Content_Hash::HASH_NONE};
+		if (Stat_Cache::stat(i.first.c_str(), &buf, false) == 0) {
+			input.fingerprint= Fingerprint(&buf);
+			if (i.second)
+				input.hash= Content_Hash::get(i.first, input.fingerprint);
+		}
+		record.inputs.push_back(std::move(input));
+	}
+	for (const Hash_Dep &hash_dep: hash_deps) {
+		if (! hash_dep.is_file())
+			continue;
+		struct stat buf;
+		if (stat_file(hash_dep.get_name_c_str_nondynamic(), &buf,
+				hash_dep.get_front_word_nondynamic()))
+			continue;
+		record.fingerprint= Fingerprint(&buf);
+		Build_Log::set(hash_dep.get_name_nondynamic(), Build_Log::Record(record));
+	}
+}
+
+void File_Executor::save_outputs()
+{
+	TRACE_FUNCTION();
+	outputs_old.clear();
+	bool hash= false;
+	for (size_t i= 0; i < hash_deps.size(); ++i)
+		if (hash_deps[i].is_file()
+			&& (option_H || rule->targets[i]->flags.get_flags() & F_HASH))
+			hash= true;
+	if (! hash)
+		return;
+	outputs_old.resize(hash_deps.size());
+	for (size_t i= 0; i < hash_deps.size(); ++i) {
+		Output_Old &output= outputs_old[i];
+		output.hash= Content_Hash::HASH_NONE;
+		if (! hash_deps[i].is_file()
+			|| !(option_H || rule->targets[i]->flags.get_flags() & F_HASH))
+			continue;
+		const char *filename= hash_deps[i].get_name_c_str_nondynamic();
+		/* Symlinks declared with -P are not compared */
+		if (stat_file(filename, &output.buf,
+				hash_deps[i].get_front_word_nondynamic())
+			|| ! S_ISREG(output.buf.st_mode))
+			continue;
+		output.hash= Content_Hash::get(filename, Fingerprint(&output.buf));
+	}
+}
+
+void File_Executor::restat()
+{
+	TRACE_FUNCTION();
+	if (outputs_old.empty())
+		return;
+	bool unchanged= true;
+	Timestamp timestamp_old= Timestamp::UNDEFINED;
+	for (size_t i= 0; i < hash_deps.size(); ++i) {
+		if (! hash_deps[i].is_file()) {
+			/* Phonies are always considered changed */
+			unchanged= false;
+			continue;
+		}
+		const Output_Old &output= outputs_old[i];
+		const char *filename= hash_deps[i].get_name_c_str_nondynamic();
+		struct stat buf;
+		if (output.hash == Content_Hash::HASH_NONE
+			|| stat_file(filename, &buf, hash_deps[i].get_front_word_nondynamic())
+			|| ! S_ISREG(buf.st_mode)
+			|| Content_Hash::get(filename, Fingerprint(&buf)) != output.hash) {
+			unchanged= false;
+			continue;
+		}
+		TRACE("Unchanged %s", filename);
+		struct timespec times[2];
+		times[0].tv_sec= 0;
+		times[0].tv_nsec= UTIME_OMIT;
+#if USE_MTIM
+		times[1]= output.buf.st_mtim;
+#else
+		/* Timestamps have a precision of one second */
+		times[1].tv_sec= output.buf.st_mtime;
+		times[1].tv_nsec= 0;
+#endif
+		Stat_Cache::invalidate(filename);
+		if (utimensat(AT_FDCWD, filename, times, 0)) {
+			print_warning(rule->targets[i]->place,
+				format_errno("utimensat", filename));
+			unchanged= false;
+			continue;
+		}
+		Timestamp timestamp_file(&output.buf);
+		if (! timestamp_old.defined() || timestamp_old < timestamp_file)
+			timestamp_old= timestamp_file;
+	}
+	outputs_old.clear();
+	if (! unchanged)
+		return;
+	TRACE("All targets unchanged");
+	timestamp= timestamp_old;
+	state &= ~State::NEED_BUILD;
+}
+
 void File_Executor::write_content(
 	const char *filename,
 	const Command &command)
 {
 	TRACE_FUNCTION();
+	Stat_Cache::invalidate(filename);
 	FILE *file= fopen(filename, "w");
 
 	if (file == nullptr) {
@@ -1075,11 +1524,15 @@ bool File_Executor::start(
 			}
 		}
 
+		if (order == Order::CRITICAL)
+			seconds_start= History::now();
 		pid= job.start_copy(
 			rule->targets[0]->placed_target.placed_name.unparametrized(),
 			source,
 			rule->targets[0]->place);
 	} else {
+		if (order == Order::CRITICAL)
+			seconds_start= History::now();
 		pid= job.start(
 			rule->command->command,
 			mapping,
@@ -1155,8 +1608,7 @@ int File_Executor::stat_file(const char *filename, struct stat *buf, Flags flags
 	TRACE("filename= '%s'", filename);
 	TRACE("no_follow= %s", frmt("%d", no_follow));
 
-	int r= fstatat(AT_FDCWD, filename, buf,
-		no_follow ? AT_SYMLINK_NOFOLLOW : 0);
+	int r= Stat_Cache::stat(filename, buf, no_follow);
 	TRACE("r= %s", frmt("%d", r));
 	if (r) TRACE("errno= %s", strerror(errno));
 	return r;
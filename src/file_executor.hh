@@ -12,6 +12,10 @@
  * subclasses only delegate their tasks to child executors.
  */
 
+#include <deque>
+
+#include "build_log.hh"
+
 class File_Executor
 	: public Executor
 {
@@ -47,10 +51,19 @@ public:
 	virtual Proceed execute(shared_ptr <const Dep> dep_link) override;
 	virtual bool finished(Flags flags) const override;
 	virtual void notify_variable(const std::map <string, string> &) override;
+	virtual void finish_critical_path() override { }
+	/* CRITICAL_PATH is set when the job has finished */
 
 	static void wait();
 	/* Wait for next job to finish and finish it.  Do not start anything new. */
 
+	static void reset();
+	/* Called from Executor::reset() */
+
+	static bool notify_waiting_slot();
+	/* Notify as many executors waiting for a job slot as there are free job slots.
+	 * Return whether any executor was notified. */
+
 #ifndef NDEBUG
 	virtual void render(Parts &, Rendering= 0) const override;
 #endif /* ! NDEBUG */
@@ -93,6 +106,49 @@ private:
 
 	Done done;
 
+	double seconds_start;
+	/* In critical order, the time at which the job was started, as returned by
+	 * History::now() */
+
+	bool waiting= false;
+	/* Whether THIS is in EXECUTORS_WAITING */
+
+	bool waiting_slot= false;
+	/* Whether THIS is in EXECUTORS_WAITING_SLOT */
+
+	std::map <string, bool> inputs;
+	/* The files on which the command depends, for the build log, and whether they
+	 * are compared by content.  Trivial and persistent dependencies are not
+	 * included. */
+
+	bool inputs_complete= true;
+	/* Whether INPUTS contains all dependencies whose timestamps are considered, i.e.,
+	 * there are no phony, dynamic or concatenated dependencies, and no dependencies
+	 * without a command, through which the timestamps of other files are passed */
+
+	uint64_t hash_command= 0;
+	/* Hash of the instantiated command, set when the targets are checked */
+
+	string cache_key;
+	/* The key of the targets in the artifact cache; empty when they are not
+	 * cached */
+
+	bool cache_checked= false;
+	/* Whether the artifact cache was checked */
+
+	class Output_Old
+	{
+	public:
+		uint64_t hash;
+		/* Content_Hash::HASH_NONE when the file target did not exist or is
+		 * not compared by content */
+		struct stat buf;
+	};
+
+	std::vector <Output_Old> outputs_old;
+	/* The file targets before the command was run.  Empty when no target is
+	 * compared by content.  The indexes correspond to those in HASH_DEPS. */
+
 	~File_Executor();
 
 	void waited(pid_t pid, size_t index, int status);
@@ -114,6 +170,44 @@ private:
 		bool no_execution);
 	/* Return whether we are done */
 
+	void add_input(shared_ptr <const Dep> dep_child, const Executor *child);
+	/* Called when CHILD is disconnected from THIS */
+
+	string get_text_command() const;
+	/* The text from which HASH_COMMAND is computed */
+
+	uint64_t compute_hash_command() const;
+
+	bool check_cache();
+	/* Set CACHE_KEY, and restore the targets from the artifact cache when they are
+	 * in it.  Return whether they were restored. */
+
+	void publish_cache();
+	/* Called when the targets were built */
+
+	void check_build_log(shared_ptr <const Dep> dep_link);
+	/* Force a rebuild when the command has changed, and cancel it when the targets
+	 * and all inputs have the fingerprints recorded in the build log, or, for inputs
+	 * compared by content, the recorded hashes.  Persistent targets are not rebuilt
+	 * because of a changed command. */
+
+	bool check_inputs(const Build_Log::Record &record, Build_Log::Record &record_new,
+		bool &changed) const;
+	/* Whether the inputs are unchanged with respect to RECORD.  RECORD_NEW is set
+	 * to RECORD with the current fingerprints, and CHANGED to whether they differ. */
+
+	void write_build_log();
+	/* Called when the targets were built */
+
+	void save_outputs();
+	/* Set OUTPUTS_OLD.  Called before the command is run. */
+
+	void restat();
+	/* Called when the targets were built.  File targets compared by content whose
+	 * content was not changed by the command get back their old modification time.
+	 * When this is the case for all targets, the parents of THIS are not rebuilt
+	 * because of it. */
+
 	void write_content(const char *filename, const Command &command);
 	void check_file_was_built(Hash_Dep hash_dep, const Place &place);
 	void check_file_target_without_rule(
@@ -130,6 +224,20 @@ private:
 	void make_timestamps_old();
 	void make_remove_data();
 
+	static std::vector <File_Executor *> executors_waiting;
+	/* Executors whose job could not be started because one of the pools of their
+	 * rule did not have enough capacity left, or because no jobserver token was
+	 * available.  They are notified when a job has finished. */
+
+	static void notify_waiting();
+
+	static std::deque <File_Executor *> executors_waiting_slot;
+	/* Executors whose job could not be started because all job slots were in use.
+	 * Executors that don't need a job, such as those of content rules and targets
+	 * that are up to date, continue to be executed while all job slots are in use.
+	 * Those waiting for a slot are notified in the order in which they started to
+	 * wait, as slots become free. */
+
 	static std::unordered_map <string, Timestamp> phonies;
 	/* The timestamps for phony targets.  This container plays the role of the file
 	 * system for phony targets, holding their timestamps, and remembering whether
@@ -38,6 +38,7 @@ enum
 	I_RESULT_NOTIFY,      /* -*                                          */
 	I_RESULT_COPY,        /* -%                                          */
 	I_PHASE_B,            /* -&                                          */
+	I_HASH,               /* -h                                          */
 
 	/* Counts */
 	C_ALL,
@@ -95,6 +96,12 @@ enum
 	F_PHASE_B               = 1 << I_PHASE_B,
 	/* A parent is in phase B */
 
+	F_HASH                  = 1 << I_HASH,
+	/* (-h) The dependency is considered changed only when the hash of its
+	 * content has changed; see content_hash.hh.  Before a target, the target
+	 * keeps its old modification time when its command did not change its
+	 * content. */
+
 	/* Aggregates */
 	F_ALL           = (1 << C_ALL) - 1,
 	F_COMMON_PLACED = (1 << C_COMMON_PLACED) - 1,
@@ -102,17 +109,17 @@ enum
 	F_WORD          = (1 << C_WORD) - 1,
 	F_ATTRIBUTE     = F_NEWLINE | F_NULL | F_CODE,
 	F_RESULT        = F_RESULT_NOTIFY | F_RESULT_COPY,
-	F_PLACED_TARGET = F_PERSISTENT | F_OPTIONAL | F_NO_FOLLOW | F_ATTRIBUTE,
+	F_PLACED_TARGET = F_PERSISTENT | F_OPTIONAL | F_NO_FOLLOW | F_ATTRIBUTE | F_HASH,
 	F_PLACED_TARGET_PHONY = F_PERSISTENT | F_OPTIONAL | F_ATTRIBUTE,
 	F_PLACED_DEPENDENCY= F_PERSISTENT | F_OPTIONAL | F_TRIVIAL
-		| F_NEWLINE | F_NULL | F_CODE,
+		| F_NEWLINE | F_NULL | F_CODE | F_HASH,
 	F_PLACED= F_PLACED_TARGET | F_PLACED_DEPENDENCY,
 	F_UNPLACED= F_ALL & ~F_PLACED,
 };
 
 constexpr Index I_ERR= UINT_MAX;
 
-constexpr const char flag_chars[]= "pot[@$n0CP<*%&";
+constexpr const char flag_chars[]= "pot[@$n0CP<*%&h";
 static_assert(sizeof(flag_chars) == C_ALL + 1, "Keep in sync with Flags");
 
 class Flag_Info
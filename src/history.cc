@@ -0,0 +1,99 @@
+#include "history.hh"
+
+#include "state_file.hh"
+
+std::unordered_map <Hash_Dep, double> History::seconds_by_hash_dep;
+bool History::changed= false;
+
+void History::read()
+{
+	TRACE_FUNCTION();
+	FILE *file= fopen(FILENAME_HISTORY, "r");
+	if (!file) {
+		if (errno != ENOENT)
+			print_errno("fopen", FILENAME_HISTORY);
+		return;
+	}
+
+	char *line= nullptr;
+	size_t size= 0;
+	ssize_t len;
+	while ((len= getline(&line, &size, file)) >= 0) {
+		/* Silently ignore malformed lines */
+		if (len == 0 || line[len - 1] != '\n') continue;
+		line[len - 1]= '\0';
+		char *end;
+		double seconds= strtod(line, &end);
+		if (end == line || ! (seconds >= 0) || end[0] != ' '
+			|| (end[1] != 'f' && end[1] != 'p') || end[2] != ' '
+			|| end[3] == '\0')
+			continue;
+		Hash_Dep hash_dep(end[1] == 'p' ? F_TARGET_PHONY : 0, string(end + 3));
+		seconds_by_hash_dep[hash_dep]= seconds;
+	}
+	if (ferror(file))
+		print_errno("getline", FILENAME_HISTORY);
+	free(line);
+	fclose(file);
+}
+
+void History::write()
+{
+	TRACE_FUNCTION();
+	if (! changed)
+		return;
+	changed= false;
+
+	if (! State_File::make_dir())
+		return;
+
+	string buffer;
+	for (const auto &i: seconds_by_hash_dep) {
+		const char *name= i.first.get_name_c_str_nondynamic();
+		if (strchr(name, '\n')) continue;
+		buffer += frmt("%.3f %c %s\n", i.second,
+			i.first.is_phony() ? 'p' : 'f', name);
+	}
+	State_File::replace(FILENAME_HISTORY, buffer);
+}
+
+double History::get(const Hash_Dep &hash_dep)
+{
+	auto i= seconds_by_hash_dep.find(get_key(hash_dep));
+	return i == seconds_by_hash_dep.end() ? 0 : i->second;
+}
+
+double History::get(shared_ptr <const Dep> dep)
+{
+	shared_ptr <const Plain_Dep> plain_dep= to <Plain_Dep> (dep);
+	if (! plain_dep)
+		return 0;
+	return get(plain_dep->get_target());
+}
+
+void History::set(const Hash_Dep &hash_dep, double seconds)
+{
+	TRACE_FUNCTION();
+	assert(seconds >= 0);
+	double &s= seconds_by_hash_dep[get_key(hash_dep)];
+	if (s != seconds) {
+		s= seconds;
+		changed= true;
+	}
+}
+
+double History::now()
+{
+	struct timespec ts;
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0) {
+		print_errno("clock_gettime");
+		error_exit();
+	}
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+Hash_Dep History::get_key(const Hash_Dep &hash_dep)
+{
+	return Hash_Dep(hash_dep.get_front_word_nondynamic() & F_TARGET_PHONY,
+		hash_dep.get_name_nondynamic());
+}
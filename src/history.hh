@@ -0,0 +1,55 @@
+#ifndef HISTORY_HH
+#define HISTORY_HH
+
+/*
+ * Durations of jobs recorded in previous runs of Stu, used by the 'critical' order (-m
+ * critical).  For each target, we store the length in seconds of the longest chain of
+ * jobs needed to build it, i.e., the duration of its own command plus that of the longest
+ * chain of its dependencies.  The history is kept in a text file in the current directory,
+ * with one line per target of the form
+ *
+ *         $SECONDS $TYPE $NAME
+ *
+ * where $TYPE is 'f' for files and 'p' for phonies.  Names containing newlines are not
+ * stored.  The file is only read and written when the 'critical' order is used.
+ */
+
+#include <unordered_map>
+
+#include "dep.hh"
+#include "hash_dep.hh"
+
+constexpr const char *DIRNAME_STATE= ".stu";
+constexpr const char *FILENAME_HISTORY= ".stu/history";
+
+class History
+{
+public:
+	static void read();
+	/* Read the history file, if it exists */
+
+	static void write();
+	/* Write the history file, if anything was changed */
+
+	static double get(const Hash_Dep &hash_dep);
+	/* The recorded length in seconds, or zero if unknown.  HASH_DEP must not be
+	 * dynamic. */
+
+	static double get(shared_ptr <const Dep> dep);
+	/* Zero if DEP is not a plain dependency */
+
+	static void set(const Hash_Dep &hash_dep, double seconds);
+
+	static double now();
+	/* Monotonic time in seconds, for measuring the duration of jobs */
+
+private:
+	static std::unordered_map <Hash_Dep, double> seconds_by_hash_dep;
+	/* Keys contain no flags other than F_TARGET_PHONY */
+
+	static bool changed;
+
+	static Hash_Dep get_key(const Hash_Dep &hash_dep);
+};
+
+#endif /* ! HISTORY_HH */
@@ -1,8 +1,16 @@
 #include "invocation.hh"
 
+#include "artifact_cache.hh"
+#include "concurrency.hh"
+#include "copier.hh"
+#include "jobserver.hh"
+#include "journal.hh"
+#include "server.hh"
 #include "show_option.hh"
+#include "watch.hh"
 
-Invocation::Invocation(int argc, char **argv, int &error)
+Invocation::Invocation(int argc, char **argv, int &error,
+	const Invocation *invocation_server)
 {
 	int option_index= 0;
 	int c;
@@ -43,15 +51,19 @@ Invocation::Invocation(int argc, char **argv, int &error)
 			}
 			had_option_f= true;
 			filenames.push_back(optarg);
-			Parser::get_file(optarg, -1, Executor::rule_set,
-				target_first, place_first);
+			sources.push_back(string("-f ") + optarg);
+			if (! invocation_server)
+				Parser::get_file(optarg, -1, Executor::rule_set,
+					target_first, place_first);
 		end:
 			break;
 
 		case 'F':
 			had_option_f= true;
-			Parser::get_string(optarg, Executor::rule_set,
-				target_first);
+			sources.push_back(string("-F ") + optarg);
+			if (! invocation_server)
+				Parser::get_string(optarg, Executor::rule_set,
+					target_first);
 			break;
 
 		case 'n':
@@ -97,6 +109,19 @@ Invocation::Invocation(int argc, char **argv, int &error)
 		}
 	}
 
+	if (invocation_server) {
+		if (option_D) {
+			print_error(fmt("a server is already running on %s",
+				show(Server::FILENAME_SOCKET)));
+			exit(ERR_FATAL);
+		}
+		/* The rules were read by the server */
+		if (sources != invocation_server->sources)
+			Server::decline();
+		target_first= invocation_server->target_first;
+		place_first= invocation_server->place_first;
+	}
+
 	order_vec= (order == Order::RANDOM);
 
 	if (option_i && option_parallel) {
@@ -133,7 +158,7 @@ Invocation::Invocation(int argc, char **argv, int &error)
 	}
 
 	/* Use the default Stu script if -f/-F are not used */
-	if (! had_option_f) {
+	if (! had_option_f && ! invocation_server) {
 		filenames.push_back(FILENAME_INPUT_DEFAULT);
 		int file_fd= open(FILENAME_INPUT_DEFAULT, O_RDONLY);
 		if (file_fd >= 0) {
@@ -167,6 +192,26 @@ Invocation::Invocation(int argc, char **argv, int &error)
 		exit(0);
 	}
 
+	if (option_D) {
+		if (option_w) {
+			print_error("options -D/-w cannot be used together");
+			exit(ERR_FATAL);
+		}
+		if (! deps.empty() || had_option_target) {
+			print_error(fmt("targets cannot be given with %s",
+				show(Option_View('D'))));
+			exit(ERR_FATAL);
+		}
+		Watch::init(argv);
+		return;
+	}
+
+	if (option_w) {
+		/* Errors end the build, but not the watch */
+		option_k= true;
+		Watch::init(argv);
+	}
+
 	/* If no targets are given on the command line, use the first non-variable
 	 * target */
 	if (deps.empty() && ! had_option_target) {
@@ -193,20 +238,81 @@ void Invocation::main_loop()
 {
 	TRACE_FUNCTION();
 	assert(options_jobs >= 0);
+	if (option_D)
+		Server::run(*this);
+	Jobserver::init();
+	Build_Log::read();
+	Journal::read();
+	if (order == Order::CRITICAL)
+		History::read();
+
+	while (true) {
+		int error= build();
+		Artifact_Cache::finish();
+		Build_Log::write();
+		Journal::write();
+		if (order == Order::CRITICAL)
+			History::write();
+		if (! option_w) {
+			if (error)
+				throw error;
+			return;
+		}
+		Watch::wait();
+		Executor::reset();
+		Timestamp::startup= Timestamp::now();
+	}
+}
+
+int Invocation::run(int argc, char **argv, const Invocation *invocation_server)
+{
+	int error= 0;
+	try {
+		Invocation invocation(argc, argv, error, invocation_server);
+		invocation.main_loop();
+	} catch (int e) {
+		assert(e >= 1 && e <= 3);
+		error= e;
+	}
+
+	if (option_z)
+		Job::print_statistics();
+	if (fclose(stdout)) {
+		print_errno("fclose", "<stdout>");
+		exit(ERR_FATAL);
+	}
+	/* No need to flush stderr, because it is line buffered, and if we used it, it
+	 * means there was an error anyway, so we're not losing any information. */
+	return error;
+}
+
+int Invocation::build()
+{
+	TRACE_FUNCTION();
 	Root_Executor *root_executor= new Root_Executor(deps);
 	int error= 0;
 	shared_ptr <const Root_Dep> dep_root= std::make_shared <Root_Dep> ();
 
 	try {
 		while (! root_executor->finished()) {
+			Concurrency::adjust(Job_List::get_size());
+			if (Executor::is_cut_short()) {
+				File_Executor::wait();
+				continue;
+			}
 			Proceed proceed;
 			do {
 				proceed= root_executor->execute(dep_root);
 				assert(is_valid(proceed));
 			} while (proceed & P_CALL_AGAIN);
 
-			if (proceed & P_WAIT)
+			if (proceed & P_WAIT) {
+				/* Job slots may still be free when the executors that
+				 * were waiting for them have not started a job */
+				if (File_Executor::notify_waiting_slot())
+					continue;
 				File_Executor::wait();
+			}
 		}
 
 		assert(root_executor->finished());
@@ -235,11 +341,20 @@ void Invocation::main_loop()
 		assert(e >= 1 && e <= 4);
 		if (Job_List::get_size()) {
 			Job_List::terminate_jobs(false);
+			/* The jobs were waited for.  Forget them, such that their
+			 * executors can be deleted by Executor::reset() in watch mode. */
+			Signal_Blocker sb;
+			while (Job_List::get_size()) {
+				Job_List::remove(Job_List::get_size() - 1);
+				++options_jobs;
+			}
+			Copier::reset();
+			Jobserver::release(0);
 		}
 		assert(e > 0 && e < ERR_FATAL);
 		error= e;
 	}
 
-	if (error)
-		throw error;
+	delete root_executor;
+	return error;
 }
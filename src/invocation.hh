@@ -7,14 +7,24 @@
 class Invocation
 {
 public:
-	Invocation(int argc, char **argv, int &error);
+	Invocation(int argc, char **argv, int &error, const Invocation *invocation_server);
+	/* INVOCATION_SERVER is the invocation of the server when called in a child of
+	 * the server (option -D), and null otherwise */
+
 	void main_loop();
 
+	static int run(int argc, char **argv, const Invocation *invocation_server);
+	/* Perform a whole invocation of Stu, and return the exit status */
+
 private:
 	std::vector <string> filenames;
 	/* Filenames passed using the -f option.  Entries are unique and sorted as they
 	 * were given, except for duplicates. */
 
+	std::vector <string> sources;
+	/* The options -f and -F, in the form "-f FILENAME" and "-F RULES", in the
+	 * order they were given, except duplicate -f */
+
 	std::vector <shared_ptr <const Dep> > deps;
 
 	shared_ptr <const Plain_Dep> target_first;
@@ -28,6 +38,9 @@ private:
 	 * is used on an empty file. */
 
 	bool had_option_f= false; /* Both -f and -F */
+
+	int build();
+	/* Build the targets once.  Return the error, or 0 on success. */
 };
 
 #endif /* ! INVOCATION_HH */
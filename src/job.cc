@@ -3,12 +3,24 @@
 #include <signal.h>
 #include <sys/resource.h>
 
+#include "artifact_cache.hh"
+#include "content_hash.hh"
+#include "copier.hh"
 #include "file_executor.hh"
+#include "journal.hh"
+#include "rule_cache.hh"
+#include "stat_cache.hh"
 
 size_t Job::count_jobs_exec=    0;
 size_t Job::count_jobs_success= 0;
 size_t Job::count_jobs_fail=    0;
+size_t Job::count_batches=      0;
+size_t Job::count_batch_max=    0;
 pid_t Job::pid_foreground= -1;
+#if USE_EPOLL
+int Job::fd_epoll= -2;
+int Job::fd_signal= -2;
+#endif
 
 pid_t Job::start(
 	string command,
@@ -25,13 +37,52 @@ pid_t Job::start(
 	const char *shell_shortname;
 	const char *shell= get_shell(shell_shortname);
 
-	pid= fork();
+#if USE_POSIX_SPAWN
+	pid= start_spawn(shell, shell_shortname, command, mapping,
+		filename_output, filename_input, place_command);
+	if (pid < 0)
+#endif
+		pid= start_fork(shell, shell_shortname, command, mapping,
+			filename_output, filename_input,
+			place_command, place_output, place_input);
 	if (pid < 0) {
-		place_command << format_errno("fork");
 		assert(pid == -1);
 		return -1;
 	}
 
+	/* We are the parent process */
+	assert(pid >= 1);
+	if (option_i) {
+		int fd_tty= get_fd_tty();
+		if (fd_tty >= 0) {
+			assert(pid_foreground < 0);
+			if (tcsetpgrp(fd_tty, pid) < 0)
+				print_errno("tcsetpgrp");
+			pid_foreground= pid;
+		}
+	}
+	++ count_jobs_exec;
+	return pid;
+}
+
+pid_t Job::start_fork(
+	const char *shell,
+	const char *shell_shortname,
+	string command,
+	const std::map <string, string> &mapping,
+	string filename_output,
+	string filename_input,
+	const Place &place_command,
+	const Place &place_output,
+	const Place &place_input)
+{
+	pid_t pid_fork= fork();
+	if (pid_fork < 0) {
+		place_command << format_errno("fork");
+		assert(pid_fork == -1);
+		return -1;
+	}
+
 	/* Each child process is given, as process group ID, its process ID.  This ensures
 	 * that we can kill each child by killing its corresponding process group ID.  How
 	 * process groups work:  Each process has not only a process ID (PID), but also a
@@ -43,14 +94,14 @@ pid_t Job::start(
 	 * Thus, we set the child process to have as its PGID the same value as its PID. */
 
 	/* Execute this in both the child and parent */
-	const int pid_child= pid == 0 ? getpid() : pid;
+	const int pid_child= pid_fork == 0 ? getpid() : pid_fork;
 	if (0 > setpgid(pid_child, pid_child)) {
 		/* This should only fail when we are the parent and the child has already
 		 * quit.  In that case we can ignore the error, since the child is dead
 		 * anyway, so there is no need to kill it in the future. */
 	}
 
-	if (pid == 0) {
+	if (pid_fork == 0) {
 		in_child= 1;
 		/* Instead of throwing exceptions, use print_errno() and
 		 * _Exit(ERR_FORK_CHILD). */
@@ -83,21 +134,108 @@ pid_t Job::start(
 		_Exit(ERR_FORK_CHILD);
 	}
 
-	/* We are the parent process */
-	assert(pid >= 1);
-	if (option_i) {
-		int fd_tty= get_fd_tty();
-		if (fd_tty >= 0) {
-			assert(pid_foreground < 0);
-			if (tcsetpgrp(fd_tty, pid) < 0)
-				print_errno("tcsetpgrp");
-			pid_foreground= pid;
-		}
+	return pid_fork;
+}
+
+#if USE_POSIX_SPAWN
+
+pid_t Job::start_spawn(
+	const char *shell,
+	const char *shell_shortname,
+	string command,
+	const std::map <string, string> &mapping,
+	string filename_output,
+	string filename_input,
+	const Place &place_command)
+/* The equivalent of start_fork(), with the redirections done as file actions, and the
+ * process group, signal mask and signal dispositions set via the spawn attributes.  The
+ * environment is that of create_child_env(), built as an array. */
+{
+	const posix_spawnattr_t *attr= get_spawnattr();
+	if (! attr)
+		return -1;
+
+	/* Environment:  the variables set by create_child_env() replace those of the
+	 * same name in the environment of Stu */
+	std::vector <string> env_strings;
+	env_strings.push_back(ENV_STU_STATUS "=1");
+	for (auto &i: mapping)
+		env_strings.push_back(i.first + '=' + i.second);
+	std::vector <char *> env;
+	env.reserve(env_strings.size() + 1);
+	for (char **e= environ; *e; ++e) {
+		const char *equal= strchr(*e, '=');
+		if (! equal) continue;
+		string name(*e, equal - *e);
+		if (name == ENV_STU_STATUS || mapping.count(name))
+			continue;
+		env.push_back(*e);
 	}
-	++ count_jobs_exec;
-	return pid;
+	for (string &env_string: env_strings)
+		env.push_back((char *) env_string.c_str());
+	env.push_back(nullptr);
+
+	string argv0;
+	const char **argv= create_child_argv(
+		place_command, shell_shortname, command, argv0);
+
+	constexpr mode_t mode_0666=
+		S_IRUSR|S_IWUSR|S_IRGRP|S_IWGRP|S_IROTH|S_IWOTH;
+	posix_spawn_file_actions_t file_actions;
+	if (posix_spawn_file_actions_init(&file_actions))
+		return -1;
+	pid_t pid_spawn= -1;
+	if (! filename_output.empty() && posix_spawn_file_actions_addopen(
+		    &file_actions, 1, filename_output.c_str(),
+		    O_CREAT|O_WRONLY|O_TRUNC, mode_0666))
+		goto end;
+	if (! (filename_input.empty() && option_i) && posix_spawn_file_actions_addopen(
+		    &file_actions, 0,
+		    filename_input.empty() ? "/dev/null" : filename_input.c_str(),
+		    O_RDONLY, 0))
+		goto end;
+
+	if (posix_spawn(&pid_spawn, shell, &file_actions, attr,
+			(char *const *) argv, env.data()))
+		pid_spawn= -1;
+ end:
+	posix_spawn_file_actions_destroy(&file_actions);
+	return pid_spawn;
+}
+
+const posix_spawnattr_t *Job::get_spawnattr()
+/* The attributes are the same for all jobs, and initialized on first use.  Return null
+ * when they cannot be initialized. */
+{
+	static posix_spawnattr_t attr;
+	static int state= 0; /* 0: not initialized; 1: OK; -1: error */
+	if (state)
+		return state > 0 ? &attr : nullptr;
+	state= -1;
+
+	/* The signals for which Stu has handlers are reset to their default action by
+	 * exec() anyway; in addition, the ignored job control signals are reset, as is
+	 * done in start_fork() */
+	sigset_t set_default= set_termination_productive;
+	if (posix_spawnattr_init(&attr))
+		return nullptr;
+	if (sigaddset(&set_default, SIGTTIN) ||
+	    sigaddset(&set_default, SIGTTOU) ||
+	    posix_spawnattr_setflags(&attr,
+		    POSIX_SPAWN_SETPGROUP | POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF) ||
+	    posix_spawnattr_setpgroup(&attr, 0) ||
+	    posix_spawnattr_setsigmask(&attr, &set_child) ||
+	    posix_spawnattr_setsigdefault(&attr, &set_default)) {
+		posix_spawnattr_destroy(&attr);
+		return nullptr;
+	}
+
+	state= 1;
+	return &attr;
 }
 
+#endif /* USE_POSIX_SPAWN */
+
 pid_t Job::start_copy(
 	string target,
 	string source,
@@ -111,6 +249,32 @@ pid_t Job::start_copy(
 	assert(pid == -2);
 	init_signals();
 
+	/* We don't set $STU_STATUS for copy jobs */
+	const char *cp_shortname;
+	const char *cp= get_cp(cp_shortname);
+	if (cp == nullptr) {
+		pid= Copier::start(target, source);
+		++ count_jobs_exec;
+		return pid;
+	}
+
+	/* Using '--' as an argument guarantees that the two filenames will be
+	 * interpreted as filenames and not as options, in particular when they
+	 * begin with a dash. */
+	const char *argv[]= {
+		cp_shortname, "--", source.c_str(), target.c_str(), nullptr};
+
+#if USE_POSIX_SPAWN
+	const posix_spawnattr_t *attr= get_spawnattr();
+	if (! attr || posix_spawn(&pid, cp, nullptr, attr,
+			(char *const *) argv, environ))
+		pid= -1;
+	if (pid >= 0) {
+		++ count_jobs_exec;
+		return pid;
+	}
+#endif /* USE_POSIX_SPAWN */
+
 	pid= fork();
 
 	if (pid < 0) {
@@ -129,15 +293,6 @@ pid_t Job::start_copy(
 	if (pid == 0) {
 		TRACE("In child");
 		in_child= 1;
-		/* We don't set $STU_STATUS for copy jobs */
-		const char *cp_shortname;
-		const char *cp= get_cp(cp_shortname);
-
-		/* Using '--' as an argument guarantees that the two filenames will be
-		 * interpreted as filenames and not as options, in particular when they
-		 * begin with a dash. */
-		const char *argv[]= {
-			cp_shortname, "--", source.c_str(), target.c_str(), nullptr};
 		__gcov_pre_dump();
 		int r= execv(cp, (char *const *) argv);
 		assert(r == -1);
@@ -152,17 +307,25 @@ pid_t Job::start_copy(
 	return pid;
 }
 
-pid_t Job::wait(int *status)
+pid_t Job::wait(int *status, bool block, int fd_watch)
 /* The main loop of Stu.  We wait for the two productive signals SIGCHLD and SIGUSR1.
- * When this function is called, there is always at least one child process running. */
+ * When this function is called, there is always at least one child process or copy
+ * running. */
 {
 	TRACE_FUNCTION();
  begin:
 	TRACE("Begin");
+	/* Copies executed by Stu itself */
+	pid_t pid= Copier::wait(status);
+	if (pid > 0)
+		return pid;
+
 	/* First, try wait() without blocking.  WUNTRACED is used to also get notified
 	 * when a job is suspended (e.g. with Ctrl-Z). */
-	pid_t pid= waitpid(-1, status, WNOHANG | (option_i ? WUNTRACED : 0));
+	pid= waitpid(-1, status, WNOHANG | (option_i ? WUNTRACED : 0));
 	TRACE("pid= %s", frmt("%jd", (intmax_t)pid));
+	if (pid < 0 && errno == ECHILD && Copier::get_count_running())
+		pid= 0;
 	if (pid < 0) {
 		/* Should not happen as there is always something running when
 		 * this function is called.  However, this may be common enough
@@ -187,6 +350,9 @@ pid_t Job::wait(int *status)
 		return pid;
 	}
 
+	if (! block)
+		return 0;
+
 	/* Any SIGCHLD sent after the last call to sigwait() will be ready for receiving,
 	 * even those SIGCHLD signals received between the last call to waitpid() and the
 	 * following call to sigwait().  This excludes a deadlock which would be possible
@@ -202,11 +368,10 @@ pid_t Job::wait(int *status)
 	 * handlers for non-blocked signals to be executed while sigwait()
 	 * waits, or have them executed only once sigwait() returns.  Note that
 	 * sigwaitinfo() should (in principle) not have this problem, but it is
-	 * less portable. */
+	 * less portable.  The same holds for the signalfd used by wait_signal(). */
 	{
 		Signal_Blocker signal_blocker;
-		errno= 0;
-		r= sigwait(&set_termination_productive, &sig);
+		r= wait_signal(sig, fd_watch);
 	}
 
 	if (r != 0) {
@@ -221,6 +386,11 @@ pid_t Job::wait(int *status)
 		}
 	}
 
+	if (sig == 0) {
+		TRACE("FD_WATCH is readable");
+		return 0;
+	}
+
 	int is_termination= sigismember(&set_termination, sig);
 	if (is_termination == 1) {
 		TRACE("Is termination signal");
@@ -254,6 +424,93 @@ pid_t Job::wait(int *status)
 	}
 }
 
+int Job::wait_signal(int &sig, int fd_watch)
+{
+#if USE_EPOLL
+	if (init_epoll()) {
+		if (fd_watch >= 0) {
+			struct epoll_event event;
+			event.events= EPOLLIN;
+			event.data.fd= fd_watch;
+			if (epoll_ctl(fd_epoll, EPOLL_CTL_ADD, fd_watch, &event) < 0) {
+				print_errno("epoll_ctl");
+				error_exit();
+			}
+		}
+		while (true) {
+			struct epoll_event event;
+			if (epoll_wait(fd_epoll, &event, 1, -1) < 0) {
+				if (errno == EINTR)
+					continue;
+				print_errno("epoll_wait");
+				error_exit();
+			}
+			if (event.data.fd == fd_watch) {
+				sig= 0;
+				break;
+			}
+			struct signalfd_siginfo info;
+			ssize_t r= read(fd_signal, &info, sizeof(info));
+			if (r < 0) {
+				/* The signalfd is nonblocking; EAGAIN means that
+				 * the signal has already been consumed */
+				if (errno == EAGAIN || errno == EINTR)
+					continue;
+				print_errno("read");
+				error_exit();
+			}
+			assert(r == sizeof(info));
+			sig= info.ssi_signo;
+			break;
+		}
+		if (fd_watch >= 0
+			&& epoll_ctl(fd_epoll, EPOLL_CTL_DEL, fd_watch, nullptr) < 0) {
+			print_errno("epoll_ctl");
+			error_exit();
+		}
+		return 0;
+	}
+#else
+	(void) fd_watch;
+#endif /* USE_EPOLL */
+	errno= 0;
+	return sigwait(&set_termination_productive, &sig);
+}
+
+#if USE_EPOLL
+
+bool Job::init_epoll()
+{
+	if (fd_epoll >= 0)
+		return true;
+	if (fd_epoll == -1)
+		return false;
+	fd_epoll= fd_signal= -1;
+
+	int fd_signal_new= signalfd(-1, &set_termination_productive,
+		SFD_NONBLOCK | SFD_CLOEXEC);
+	if (fd_signal_new < 0)
+		return false;
+	int fd_epoll_new= epoll_create1(EPOLL_CLOEXEC);
+	if (fd_epoll_new < 0) {
+		close(fd_signal_new);
+		return false;
+	}
+	struct epoll_event event;
+	event.events= EPOLLIN;
+	event.data.fd= fd_signal_new;
+	if (epoll_ctl(fd_epoll_new, EPOLL_CTL_ADD, fd_signal_new, &event) < 0) {
+		close(fd_epoll_new);
+		close(fd_signal_new);
+		return false;
+	}
+	fd_epoll= fd_epoll_new;
+	fd_signal= fd_signal_new;
+	return true;
+}
+
+#endif /* USE_EPOLL */
+
 bool Job::waited(int status, pid_t pid_check)
 {
 	TRACE_FUNCTION();
@@ -279,6 +536,13 @@ bool Job::waited(int status, pid_t pid_check)
 	return success;
 }
 
+void Job::count_batch(size_t count)
+{
+	assert(count >= 1);
+	++ count_batches;
+	count_batch_max= std::max(count_batch_max, count);
+}
+
 void Job::print_statistics(bool allow_unterminated_jobs)
 {
 	/* Avoid double writing in case the destructor gets still called */
@@ -305,6 +569,17 @@ void Job::print_statistics(bool allow_unterminated_jobs)
 		       count_jobs_exec, count_jobs_success, count_jobs_fail,
 		       count_jobs_exec - count_jobs_success - count_jobs_fail);
 
+	if (option_b && count_batches)
+		printf("STATISTICS  number of finished jobs processed at once = "
+		       "%.2f on average (%zu maximum)\n",
+		       (double)(count_jobs_success + count_jobs_fail) / count_batches,
+		       count_batch_max);
+
+	Stat_Cache::print_statistics();
+	Content_Hash::print_statistics();
+	Journal::print_statistics();
+	Artifact_Cache::print_statistics();
+	Rule_Cache::print_statistics();
 	printf("STATISTICS  children user   execution time = %ju.%06lu s\n",
 	       (uintmax_t)     usage.ru_utime.tv_sec,
 	       (unsigned long) usage.ru_utime.tv_usec);
@@ -328,6 +603,9 @@ void Job::kill(pid_t pid)
 	/* [ASYNC-SIGNAL-SAFE] We use only async signal-safe functions here */
 
 	assert_async(pid > 1);
+	if (Copier::is_pid(pid))
+		/* Copies are cancelled by Copier::terminate() */
+		return;
 
 	/* We send first SIGTERM, then SIGCONT */
 	if (0 > ::kill(-pid, SIGTERM)) {
@@ -461,7 +739,12 @@ const char **Job::create_child_argv(
 	 * prescribes for Make.  It is particularly important for Stu, as Stu invokes the
 	 * whole (possibly multiline) command in one step. */
 	const char *shell_options= option_x ? "-ex" : "-e";
-	static const char *argv[]= {argv0.c_str(), shell_options, "-c", arg, nullptr};
+	static const char *argv[5];
+	argv[0]= argv0.c_str();
+	argv[1]= shell_options;
+	argv[2]= "-c";
+	argv[3]= arg;
+	argv[4]= nullptr;
 
 	/* Special handling of the case when the command starts with '-' or '+'.  In that
 	 * case, we prepend a space to the command.  We cannot use '--' as prescribed by
@@ -521,7 +804,7 @@ const char *Job::get_cp(const char *&cp_shortname_)
 	if (cp == nullptr) {
 		cp= getenv(ENV_STU_CP);
 		if (cp == nullptr || cp[0] == '\0')
-			cp= "/bin/cp";
+			return nullptr;
 		cp_shortname= get_shortname(cp);
 	}
 	cp_shortname_= cp_shortname;
@@ -7,6 +7,38 @@
 #include "error.hh"
 #include "place.hh"
 
+/*
+ * Jobs are started with posix_spawn(), which avoids copying the page tables of the (possibly
+ * large) Stu process as fork() does.  When USE_POSIX_SPAWN is 0, fork() and exec() are
+ * used directly.  fork() is also used when posix_spawn() fails, in order to output the
+ * same error messages as before.
+ */
+#ifndef USE_POSIX_SPAWN
+#   define USE_POSIX_SPAWN 1
+#endif
+
+#if USE_POSIX_SPAWN
+#   include <spawn.h>
+#endif
+
+/*
+ * On Linux, the productive and termination signals are received in wait() via a signalfd
+ * that is registered in an epoll instance, instead of via sigwait().  When either cannot
+ * be created, sigwait() is used.
+ */
+#ifndef USE_EPOLL
+#   if HAVE_EPOLL
+#      define USE_EPOLL 1
+#   else
+#      define USE_EPOLL 0
+#   endif
+#endif
+
+#if USE_EPOLL
+#   include <sys/epoll.h>
+#   include <sys/signalfd.h>
+#endif
+
 class Job
 /* A child process of Stu that executes the command for a given rule.  An object of this
  * type can execute a job only once. */
@@ -46,11 +78,20 @@ public:
 		string target,
 		string source,
 		const Place &place);
-	/* Start a copy job.  The return value has the same semantics as in start(). */
+	/* Start a copy job.  The return value has the same semantics as in start().
+	 * When $STU_CP is not set, the copy is executed by Stu itself and the return
+	 * value is a pseudo-PID; see copier.hh. */
 
-	static pid_t wait(int *status);
+	static pid_t wait(int *status, bool block= true, int fd_watch= -1);
 	/* Wait for the next process to terminate; provide the STATUS as
-	 * used in wait(2).  Return the PID of the waited-for process (>=0). */
+	 * used in wait(2).  Return the PID of the waited-for process (>=0).  If BLOCK
+	 * is false, return 0 when no process has terminated yet.  If FD_WATCH is not
+	 * -1, also return 0 when it becomes readable; this needs the epoll instance,
+	 * without which FD_WATCH is ignored. */
+
+	static void count_batch(size_t count);
+	/* Called with the number of jobs that were processed after a single call to
+	 * wait() with BLOCK set, for the statistics of the -b option */
 
 	static void print_statistics(bool allow_unterminated_jobs= false);
 	/* Print the statistics about jobs, regardless of OPTION_STATISTICS.  If the
@@ -75,10 +116,48 @@ private:
 	 * Success:  Finished, with success
 	 * Fail:     Finished, without success */
 
+	static size_t count_batches, count_batch_max;
+	/* Number of calls to count_batch(), and maximal count passed to it */
+
 	static pid_t pid_foreground;
 	/* The job that is in the foreground, or -1 when none is */
 
 	static void ask_continue(pid_t pid);
+	static int wait_signal(int &sig, int fd_watch);
+	/* Wait for one of the termination or productive signals and return it in SIG.
+	 * Return 0 on success, or an error code as returned by sigwait().  SIG is set
+	 * to 0 when FD_WATCH has become readable. */
+#if USE_EPOLL
+	static int fd_epoll, fd_signal;
+	/* -2:  not yet initialized; -1:  not available, sigwait() is used.  The signalfd
+	 * is registered in the epoll instance and receives the termination and
+	 * productive signals. */
+	static bool init_epoll();
+	/* Return whether the signalfd can be used */
+#endif /* USE_EPOLL */
+	static pid_t start_fork(
+		const char *shell,
+		const char *shell_shortname,
+		string command,
+		const std::map <string, string> &mapping,
+		string filename_output,
+		string filename_input,
+		const Place &place_command,
+		const Place &place_output,
+		const Place &place_input);
+	/* Return -1 on error, after having output an error message */
+#if USE_POSIX_SPAWN
+	static pid_t start_spawn(
+		const char *shell,
+		const char *shell_shortname,
+		string command,
+		const std::map <string, string> &mapping,
+		string filename_output,
+		string filename_input,
+		const Place &place_command);
+	/* Return -1 without outputting an error message when posix_spawn() fails */
+	static const posix_spawnattr_t *get_spawnattr();
+#endif /* USE_POSIX_SPAWN */
 	static void create_child_env(const std::map <string, string> &mapping);
 	static const char **create_child_argv(
 		const Place &place_command,
@@ -87,6 +166,7 @@ private:
 		string &argv0);
 	static const char *get_shell(const char *&shell_shortname);
 	static const char *get_cp(const char *&cp_shortname);
+	/* Null when $STU_CP is not set */
 	static const char *get_shortname(const char *name);
 	static void create_child_output_redirection(string filename_output, const Place &);
 	static void create_child_input_redirection(string filename_input, const Place &);
@@ -1,20 +1,25 @@
 #include "job_list.hh"
 
+#include "copier.hh"
+
 size_t Job_List::size= 0;
 pid_t *Job_List::pids= nullptr;
 File_Executor **Job_List::executors= nullptr;
+size_t *Job_List::slots= nullptr;
+size_t Job_List::mask= 0;
 
 File_Executor *Job_List::find(pid_t pid, size_t &index)
 {
 	assert(size);
 	assert(pids);
 	assert(executors);
+	assert(slots);
 
-	for (size_t i= 0; i < size; ++i) {
-		if (pids[i] == pid) {
-			index= i;
-			return executors[i];
-		}
+	size_t slot= find_slot(pid);
+	if (slots[slot] != SLOT_EMPTY) {
+		index= slots[slot];
+		assert(pids[index] == pid);
+		return executors[index];
 	}
 
 	/* No File_Executor is registered for the PID that just finished.  Should not
@@ -33,13 +38,21 @@ void Job_List::add(pid_t pid, size_t &index, File_Executor *executor)
 	TRACE("pid= %s", frmt("%jd", (intmax_t)pid));
 	assert(Signal_Blocker::is_blocked());
 	assert(!pids == !executors);
+	assert(!pids == !slots);
 
 	if (!pids) {
-		/* This is executed just once, before we have executed any job, and
-		 * therefore JOBS is the value passed via -j (or its default value 1), and
-		 * thus we can allocate arrays of that size once and for all. */
-		if ((uintmax_t)SIZE_MAX / sizeof(*pids) < (uintmax_t)options_jobs ||
-			(uintmax_t)SIZE_MAX / sizeof(*executors) < (uintmax_t)options_jobs)
+		/* This is executed just once, before we have executed any job.
+		 * OPTIONS_JOBS_MAX is the value passed via -j (or its default value 1),
+		 * and thus we can allocate arrays of that size once and for all. */
+		size_t count_slots= 2;
+		while (count_slots / 2 < (uintmax_t)options_jobs_max
+			&& count_slots <= SIZE_MAX / sizeof(*slots) / 2)
+			count_slots *= 2;
+		if ((uintmax_t)SIZE_MAX / sizeof(*pids)
+			< (uintmax_t)options_jobs_max ||
+			(uintmax_t)SIZE_MAX / sizeof(*executors)
+			< (uintmax_t)options_jobs_max ||
+			count_slots / 2 < (uintmax_t)options_jobs_max)
 		{
 			happens_only_on_certain_platforms();
 			/* This can only happen when long is at least as large as size_t,
@@ -49,17 +62,21 @@ void Job_List::add(pid_t pid, size_t &index, File_Executor *executor)
 			print_errno_bare(frmt(
 				"Value too large for option -j, maximum value is %ju",
 				(uintmax_t)SIZE_MAX / std::max(sizeof(*pids),
-				sizeof(*executors))));
+				2 * sizeof(*slots))));
 			error_exit();
 		}
 		cov_tag("Job_List::add");
-		pids= (pid_t *)malloc(options_jobs * sizeof(*pids));
+		pids= (pid_t *)malloc(options_jobs_max * sizeof(*pids));
 		executors= (File_Executor **)
-			malloc(options_jobs * sizeof(*executors));
-		if (!pids || !executors) {
+			malloc(options_jobs_max * sizeof(*executors));
+		slots= (size_t *)malloc(count_slots * sizeof(*slots));
+		if (!pids || !executors || !slots) {
 			print_errno("malloc");
 			error_exit();
 		}
+		for (size_t i= 0; i < count_slots; ++i)
+			slots[i]= SLOT_EMPTY;
+		mask= count_slots - 1;
 	}
 
 #ifndef NDEBUG
@@ -72,6 +89,9 @@ void Job_List::add(pid_t pid, size_t &index, File_Executor *executor)
 	index= size++;
 	pids[index]= pid;
 	executors[index]= executor;
+	size_t slot= find_slot(pid);
+	assert(slots[slot] == SLOT_EMPTY);
+	slots[slot]= index;
 }
 
 void Job_List::remove(size_t index)
@@ -81,13 +101,40 @@ void Job_List::remove(size_t index)
 	assert(Signal_Blocker::is_blocked());
 	assert(size);
 	assert(size >= index + 1);
-	memmove(pids + index,
-		pids + index + 1,
-		sizeof(*pids) * (size - index - 1));
-	memmove(executors + index,
-		executors + index + 1,
-		sizeof(*executors) * (size - index - 1));
+
+	/* Remove the entry from the hash table.  To keep all entries reachable by
+	 * linear probing, subsequent entries of the same cluster are moved back when
+	 * their own slot is not between the freed slot and their current slot. */
+	size_t slot_free= find_slot(pids[index]);
+	assert(slots[slot_free] == index);
+	slots[slot_free]= SLOT_EMPTY;
+	for (size_t slot= (slot_free + 1) & mask; slots[slot] != SLOT_EMPTY;
+	     slot= (slot + 1) & mask) {
+		size_t slot_own= get_slot(pids[slots[slot]]);
+		if (((slot - slot_own) & mask) < ((slot - slot_free) & mask))
+			continue;
+		slots[slot_free]= slots[slot];
+		slots[slot]= SLOT_EMPTY;
+		slot_free= slot;
+	}
+
+	/* Move the last entry into the freed place */
 	--size;
+	if (index != size) {
+		pids[index]= pids[size];
+		executors[index]= executors[size];
+		size_t slot_last= find_slot(pids[index]);
+		assert(slots[slot_last] == size);
+		slots[slot_last]= index;
+	}
+}
+
+size_t Job_List::find_slot(pid_t pid)
+{
+	size_t slot= get_slot(pid);
+	while (slots[slot] != SLOT_EMPTY && pids[slots[slot]] != pid)
+		slot= (slot + 1) & mask;
+	return slot;
 }
 
 void Job_List::print()
@@ -116,6 +163,10 @@ void Job_List::terminate_jobs(bool asynch)
 		Job::kill(pid);
 	}
 
+	/* Copies executed by Stu itself must have stopped writing to their targets
+	 * before these are removed */
+	Copier::terminate();
+
 	size_t count_terminated= 0;
 
 	for (size_t i= 0; i < size; ++i) {
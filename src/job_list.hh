@@ -29,7 +29,24 @@ private:
 	 * race conditions while accessing this.  For all file executors stored here, the
 	 * following variables are never changed as long as the File_Executor objects are
 	 * stored there, such that they can be accessed from async-signal safe functions:
-	 * FILENAMES, TIMESTAMPS_OLD. */
+	 * FILENAMES, TIMESTAMPS_OLD.  The order of the entries is arbitrary, as removing
+	 * an entry moves the last entry into its place. */
+
+	static size_t *slots;
+	static size_t mask;
+	/* Hash table mapping each PID to its index in PIDS and EXECUTORS, such that
+	 * find() does not have to scan all running jobs.  Open addressing with linear
+	 * probing; SLOT_EMPTY denotes an empty slot.  The length is a power of two and
+	 * at least twice the maximal number of jobs, and MASK is the length minus one.
+	 * Allocated together with the two arrays.  Not accessed from signal handlers. */
+
+	static constexpr size_t SLOT_EMPTY= SIZE_MAX;
+
+	static size_t get_slot(pid_t pid) {
+		return ((size_t)pid * 0x9E3779B1u) & mask;
+	}
+	static size_t find_slot(pid_t pid);
+	/* The slot containing PID, or an empty slot if PID is not contained */
 };
 
 #endif /* ! JOB_LIST_HH */
@@ -0,0 +1,215 @@
+#include "jobserver.hh"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "concurrency.hh"
+#include "options.hh"
+
+int Jobserver::fd_read= -1;
+int Jobserver::fd_write= -1;
+string Jobserver::tokens;
+bool Jobserver::is_waiting= false;
+
+void Jobserver::init()
+{
+	TRACE_FUNCTION();
+	const char *makeflags= getenv("MAKEFLAGS");
+	if (! option_j && makeflags && join(makeflags)) {
+		TRACE("Joined jobserver");
+	} else if (options_jobs_max > 1) {
+		create();
+	} else {
+		return;
+	}
+	if (atexit(release_all)) {
+		print_errno("atexit");
+		exit(ERR_FATAL);
+	}
+}
+
+bool Jobserver::acquire(size_t count_running)
+{
+	if (fd_read < 0 || count_running <= tokens.size())
+		return true;
+	char c;
+	ssize_t r= read(fd_read, &c, 1);
+	if (r == 1) {
+		tokens += c;
+		return true;
+	}
+	if (r < 0 && errno != EAGAIN && errno != EINTR)
+		print_errno("read");
+	is_waiting= true;
+	return false;
+}
+
+void Jobserver::release(size_t count_running)
+{
+	if (fd_write < 0)
+		return;
+	size_t count_needed= count_running ? count_running - 1 : 0;
+	while (tokens.size() > count_needed) {
+		char c= tokens.back();
+		ssize_t r= write(fd_write, &c, 1);
+		if (r < 0 && errno == EINTR)
+			continue;
+		if (r < 0)
+			print_errno("write");
+		tokens.pop_back();
+	}
+}
+
+int Jobserver::get_fd_waiting()
+{
+	if (! is_waiting)
+		return -1;
+	is_waiting= false;
+	return fd_read;
+}
+
+bool Jobserver::join(const char *makeflags)
+{
+	TRACE_FUNCTION();
+	TRACE("makeflags= %s", makeflags);
+	string auth;
+	long jobs= 0;
+	const char *p= makeflags;
+	while (*p) {
+		while (isspace(*p)) ++p;
+		const char *q= p;
+		while (*p && ! isspace(*p)) ++p;
+		string word(q, p - q);
+		if (word == "--")
+			break;
+		if (word.rfind("--jobserver-auth=", 0) == 0)
+			auth= word.substr(17);
+		else if (word.rfind("--jobserver-fds=", 0) == 0)
+			auth= word.substr(16);
+		else if (word.size() > 2 && word[0] == '-' && word[1] == 'j'
+			&& isdigit(word[2]))
+			jobs= atol(word.c_str() + 2);
+	}
+	if (auth.empty())
+		return false;
+
+	int fd_r, fd_w;
+	if (auth.rfind("fifo:", 0) == 0) {
+		string filename= auth.substr(5);
+		fd_r= open(filename.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+		if (fd_r < 0)
+			return false;
+		fd_w= open(filename.c_str(), O_WRONLY | O_CLOEXEC);
+		if (fd_w < 0) {
+			close(fd_r);
+			return false;
+		}
+	} else {
+		int n= -1;
+		if (sscanf(auth.c_str(), "%d,%d%n", &fd_r, &fd_w, &n) != 2
+			|| n != (int)auth.size() || fd_r < 0 || fd_w < 0)
+			return false;
+		/* The file descriptors are not open when the parent Make did not
+		 * consider the command to be recursive */
+		struct stat buf_r, buf_w;
+		if (fstat(fd_r, &buf_r) < 0 || fstat(fd_w, &buf_w) < 0
+			|| ! S_ISFIFO(buf_r.st_mode) || ! S_ISFIFO(buf_w.st_mode))
+			return false;
+		/* Reopen the pipe to get our own nonblocking file description.  Setting
+		 * O_NONBLOCK on the inherited one would also affect the other processes.
+		 * Without it, we don't join, because a blocking read() could wait forever
+		 * when another process takes the token first.  We then run one job at a
+		 * time, which needs no token. */
+		fd_r= open(frmt("/proc/self/fd/%d", fd_r).c_str(),
+			O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+		if (fd_r < 0)
+			return false;
+	}
+
+	fd_read= fd_r;
+	fd_write= fd_w;
+	options_jobs_max= jobs > 0 ? jobs : Concurrency::count_cpus();
+	options_jobs= options_jobs_max;
+	option_parallel= options_jobs_max > 1;
+	return true;
+}
+
+void Jobserver::create()
+{
+	TRACE_FUNCTION();
+	int fds[2];
+	if (pipe(fds) < 0) {
+		print_errno("pipe");
+		exit(ERR_FATAL);
+	}
+
+	/* Write as many tokens as the pipe can hold, up to K-1 */
+	if (fcntl(fds[1], F_SETFL, O_NONBLOCK) < 0) {
+		print_errno("fcntl");
+		exit(ERR_FATAL);
+	}
+	for (long i= 1; i < options_jobs_max; ++i) {
+		ssize_t r= write(fds[1], "+", 1);
+		if (r < 0 && errno == EINTR) {
+			--i;
+			continue;
+		}
+		if (r < 0 && errno == EAGAIN)
+			break;
+		if (r < 0) {
+			print_errno("write");
+			exit(ERR_FATAL);
+		}
+	}
+	if (fcntl(fds[1], F_SETFL, 0) < 0) {
+		print_errno("fcntl");
+		exit(ERR_FATAL);
+	}
+
+	/* As in join(), we need our own nonblocking file description.  Without it,
+	 * no jobserver is created, and only -j limits our jobs. */
+	fd_read= open(frmt("/proc/self/fd/%d", fds[0]).c_str(),
+		O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+	if (fd_read < 0) {
+		TRACE("Cannot reopen the jobserver:  not creating one");
+		close(fds[0]);
+		close(fds[1]);
+		return;
+	}
+	fd_write= fds[1];
+
+	/* Replace an existing jobserver and -j in $MAKEFLAGS, keeping everything else */
+	string makeflags= frmt("-j%ld --jobserver-auth=%d,%d",
+		options_jobs_max, fds[0], fds[1]);
+	const char *makeflags_old= getenv("MAKEFLAGS");
+	const char *p= makeflags_old ? makeflags_old : "";
+	while (*p) {
+		while (isspace(*p)) ++p;
+		const char *q= p;
+		while (*p && ! isspace(*p)) ++p;
+		string word(q, p - q);
+		if (word == "--") {
+			/* Variable assignments follow */
+			makeflags += ' ';
+			makeflags += q;
+			break;
+		}
+		if (word.empty()
+			|| word.rfind("--jobserver-", 0) == 0
+			|| (word.size() > 2 && word[0] == '-' && word[1] == 'j'
+				&& isdigit(word[2])))
+			continue;
+		makeflags += ' ';
+		makeflags += word;
+	}
+	TRACE("makeflags= %s", makeflags);
+	if (setenv("MAKEFLAGS", makeflags.c_str(), 1) < 0) {
+		print_errno("setenv");
+		exit(ERR_FATAL);
+	}
+}
+
+void Jobserver::release_all()
+{
+	release(0);
+}
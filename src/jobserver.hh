@@ -0,0 +1,69 @@
+#ifndef JOBSERVER_HH
+#define JOBSERVER_HH
+
+/*
+ * Support for the jobserver protocol of GNU Make, such that Stu and Make (or other
+ * programs implementing the protocol) running as jobs of each other share a single
+ * limit on the number of parallel jobs.  The jobserver is a pipe or a FIFO containing
+ * one byte (a token) for each job that may run in addition to the one job every
+ * participating process may always run.
+ *
+ * When $MAKEFLAGS contains a jobserver given by --jobserver-auth (or the older
+ * --jobserver-fds) and -j is not used, Stu joins that jobserver.  Otherwise, when jobs
+ * are run in parallel, Stu creates a pipe containing K-1 tokens and exports it to its
+ * jobs in $MAKEFLAGS.  Jobservers given in $MAKEFLAGS whose file descriptors are not
+ * open, e.g. because the parent Make did not recognize the command as recursive, are
+ * ignored.
+ *
+ * Stu holds one token for each running job except the first.  Tokens are read when a
+ * job is started, and written back when a job has finished.  While a job waits for a
+ * token, the main loop also waits for the jobserver to become readable, such that
+ * tokens written back by other processes are used without waiting for one of our own
+ * jobs to finish.
+ */
+
+#include <string>
+
+class Jobserver
+{
+public:
+	static void init();
+	/* Join or create the jobserver.  Called once after the options have been
+	 * parsed, before any job is started.  May change OPTIONS_JOBS and
+	 * OPTIONS_JOBS_MAX. */
+
+	static bool acquire(size_t count_running);
+	/* Whether one more job may be started, given the number of jobs already running;
+	 * read a token if needed.  Always true when no job is running or when no
+	 * jobserver is used. */
+
+	static void release(size_t count_running);
+	/* Write back the tokens that are not needed anymore for the given number of
+	 * running jobs */
+
+	static int get_fd_waiting();
+	/* The file descriptor that becomes readable when a token is available, if
+	 * acquire() has failed since the last call, and -1 otherwise */
+
+private:
+	static int fd_read, fd_write;
+	/* The file descriptors used by us; -1 when no jobserver is used.  FD_READ is
+	 * our own nonblocking file description of the pipe, opened through
+	 * /proc/self/fd, such that reading never blocks. */
+
+	static std::string tokens;
+	/* The tokens we hold.  The same bytes are written back. */
+
+	static bool is_waiting;
+	/* Whether acquire() has failed since the last call to get_fd_waiting() */
+
+	static bool join(const char *makeflags);
+	/* Return whether we have joined the jobserver given in MAKEFLAGS */
+
+	static void create();
+
+	static void release_all();
+	/* Called at exit */
+};
+
+#endif /* ! JOBSERVER_HH */
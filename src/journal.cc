@@ -0,0 +1,239 @@
+#include "journal.hh"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/file.h>
+
+#include "stat_cache.hh"
+#include "state_file.hh"
+
+bool Journal::is_synced= false;
+bool Journal::is_used= false;
+uint64_t Journal::dev= 0;
+uint64_t Journal::ino= 0;
+uint64_t Journal::offset= 0;
+size_t Journal::count_trusted= 0;
+
+void Journal::read()
+{
+	TRACE_FUNCTION();
+	int fd= open(FILENAME_JOURNAL, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		if (errno != ENOENT)
+			print_errno("open", FILENAME_JOURNAL);
+		return;
+	}
+	/* The helper holds an exclusive lock while it runs */
+	if (flock(fd, LOCK_SH | LOCK_NB) == 0 || errno != EWOULDBLOCK) {
+		TRACE("Helper not running");
+		close(fd);
+		return;
+	}
+	struct stat buf;
+	if (fstat(fd, &buf) < 0) {
+		print_errno("fstat", FILENAME_JOURNAL);
+		close(fd);
+		return;
+	}
+	dev= buf.st_dev;
+	ino= buf.st_ino;
+
+	string content;
+	State_File::read(FILENAME_RECORD, content);
+	const char *p= content.data();
+	const char *const end= content.data() + content.size();
+	uint64_t size_stat, dev_record, ino_record, offset_record;
+	bool is_valid= content.size() >= sizeof(HEADER)
+		&& ! memcmp(p, HEADER, sizeof(HEADER))
+		&& (p += sizeof(HEADER), State_File::parse_number(p, end, size_stat))
+		&& size_stat == sizeof(struct stat)
+		&& State_File::parse_number(p, end, dev_record)
+		&& State_File::parse_number(p, end, ino_record)
+		&& State_File::parse_number(p, end, offset_record)
+		&& dev_record == dev && ino_record == ino
+		&& offset_record <= (uint64_t)buf.st_size;
+	TRACE("is_valid= %s", frmt("%d", is_valid));
+
+	/* When the record cannot be used, the journal is only read from its end, to
+	 * find the cookie */
+	std::vector <string> names;
+	is_synced= sync(fd, is_valid ? offset_record : buf.st_size, names);
+	close(fd);
+	if (! is_synced || ! is_valid)
+		return;
+
+	std::unordered_set <string> set_names, dirs;
+	for (const string &name: names) {
+		if (name == ".") {
+			TRACE("All files changed");
+			return;
+		}
+		set_names.insert(name);
+		for (size_t i= name.find('/'); i != string::npos; i= name.find('/', i + 1))
+			dirs.insert(name.substr(0, i));
+		dirs.insert(".");
+	}
+
+	/* Files inherited from the server may have changed too */
+	if (! set_names.empty())
+		for (const string &filename: Stat_Cache::get_filenames())
+			if (is_changed(filename, set_names, dirs))
+				Stat_Cache::invalidate(filename);
+
+	while (p < end) {
+		string filename;
+		Stat_Cache::Entry entry {};
+		if (! State_File::parse_string(p, end, filename))
+			break;
+		bool is_complete= true;
+		for (Stat_Cache::Result &result: entry.results) {
+			uint64_t errnum;
+			if (! State_File::parse_number(p, end, errnum)
+				|| (errnum == 0 && (size_t)(end - p) < sizeof(result.buf))) {
+				is_complete= false;
+				break;
+			}
+			result.errnum= (int)(int64_t)errnum;
+			result.generation= Stat_Cache::generation;
+			if (errnum == 0) {
+				memcpy(&result.buf, p, sizeof(result.buf));
+				p += sizeof(result.buf);
+			}
+		}
+		if (! is_complete)
+			break;
+		if (is_changed(filename, set_names, dirs))
+			continue;
+		/* Entries that are already cached are kept */
+		if (Stat_Cache::entries.emplace(filename, entry).second)
+			++count_trusted;
+	}
+	is_used= true;
+	TRACE("count_trusted= %s", frmt("%zu", count_trusted));
+}
+
+void Journal::write()
+{
+	TRACE_FUNCTION();
+	if (! is_synced)
+		return;
+	/* The old record is still valid when every file was found in it */
+	if (is_used && Stat_Cache::count_misses == 0)
+		return;
+
+	string buffer(HEADER, sizeof(HEADER));
+	State_File::append_number(buffer, sizeof(struct stat));
+	State_File::append_number(buffer, dev);
+	State_File::append_number(buffer, ino);
+	State_File::append_number(buffer, offset);
+	for (const auto &i: Stat_Cache::entries) {
+		const Stat_Cache::Entry &entry= i.second;
+		if (! is_recorded(i.first)
+			|| (Stat_Cache::get_errnum(entry.results[0]) < 0
+				&& Stat_Cache::get_errnum(entry.results[1]) < 0))
+			continue;
+		State_File::append_string(buffer, i.first);
+		for (const Stat_Cache::Result &result: entry.results) {
+			int errnum= Stat_Cache::get_errnum(result);
+			State_File::append_number(buffer, (uint64_t)(int64_t)errnum);
+			if (errnum == 0)
+				buffer.append((const char *)&result.buf, sizeof(result.buf));
+		}
+	}
+
+	State_File::replace(FILENAME_RECORD, buffer);
+}
+
+void Journal::print_statistics()
+{
+	if (! is_used)
+		return;
+	printf("STATISTICS  files trusted from journal record = %zu\n", count_trusted);
+}
+
+bool Journal::sync(int fd, uint64_t offset_start, std::vector <string> &names)
+{
+	TRACE_FUNCTION();
+	string cookie= frmt("%s.%jd", FILENAME_COOKIE, (intmax_t)getpid());
+	int fd_cookie= open(cookie.c_str(),
+		O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+	if (fd_cookie < 0) {
+		print_errno("open", cookie);
+		return false;
+	}
+	close(fd_cookie);
+
+	bool found= false;
+	uint64_t offset_read= offset_start;
+	string line;
+	char buffer[1 << 16];
+	int milliseconds= 0;
+	while (! found) {
+		ssize_t r= pread(fd, buffer, sizeof(buffer), offset_read);
+		if (r < 0 && errno == EINTR)
+			continue;
+		if (r < 0) {
+			print_errno("read", FILENAME_JOURNAL);
+			break;
+		}
+		if (r == 0) {
+			if (milliseconds >= MILLISECONDS_SYNC) {
+				TRACE("Cookie not found");
+				break;
+			}
+			poll(nullptr, 0, MILLISECONDS_POLL);
+			milliseconds += MILLISECONDS_POLL;
+			continue;
+		}
+		for (ssize_t i= 0; i < r && ! found; ++i) {
+			if (buffer[i] != '\n') {
+				line += buffer[i];
+				continue;
+			}
+			while (line.size() >= 2 && line[0] == '.' && line[1] == '/')
+				line.erase(0, 2);
+			while (line.size() >= 2 && line.back() == '/')
+				line.pop_back();
+			if (line.empty())
+				line= ".";
+			if (line == cookie) {
+				found= true;
+				offset= offset_read + i + 1;
+			} else {
+				names.push_back(std::move(line));
+			}
+			line.clear();
+		}
+		offset_read += r;
+	}
+	unlink(cookie.c_str());
+	return found;
+}
+
+bool Journal::is_changed(const string &filename,
+	const std::unordered_set <string> &names,
+	const std::unordered_set <string> &dirs)
+{
+	if (names.empty())
+		return false;
+	if (dirs.count(filename))
+		return true;
+	for (size_t i= filename.find('/'); i != string::npos; i= filename.find('/', i + 1))
+		if (names.count(filename.substr(0, i)))
+			return true;
+	return names.count(filename);
+}
+
+bool Journal::is_recorded(const string &filename)
+{
+	if (filename.empty() || filename[0] == '/')
+		return false;
+	for (size_t i= 0; ; ) {
+		size_t j= filename.find('/', i);
+		if (filename.compare(i, j == string::npos ? j : j - i, "..") == 0)
+			return false;
+		if (j == string::npos)
+			return true;
+		i= j + 1;
+	}
+}
@@ -0,0 +1,88 @@
+#ifndef JOURNAL_HH
+#define JOURNAL_HH
+
+/*
+ * The change journal lets Stu skip stat() for the files that did not change since the
+ * last run.  When the file .stu/journal exists, it is expected to be written by a
+ * helper process such as sh/stu-journal, which watches the directory tree and appends
+ * the name of each file in which something happens to the journal, one per line, as
+ * watchman-wait does.  Names are relative to the current directory; a leading "./" is
+ * ignored.  A name stands for the file itself and for all files below it, such that
+ * the line "." stands for all files.  The helper writes the line "." when it starts,
+ * and holds an exclusive flock() lock on the journal for as long as it runs.
+ *
+ * At the end of each run, Stu writes the results of stat() and lstat() of all files
+ * below the current directory that are in the stat cache into the record .stu/stat,
+ * together with the position in the journal at which the run started.  At the start
+ * of the next run, the record is loaded into the stat cache, except for the files named
+ * in the journal after that position, for their parent directories, and for the files
+ * below them.  The record is only written and used when the helper is running.
+ *
+ * To make sure the helper has seen all changes made before the run started, Stu creates
+ * the file .stu/cookie.$PID and waits until its name appears in the journal.  When it
+ * does not appear within a second, the record is not used and not written.  The record
+ * is ignored when the journal has been replaced or truncated.  Changes made through
+ * symbolic links that point outside of the directory tree are not seen by the helper;
+ * such files must not be used as dependencies when the journal is used.
+ */
+
+#include <sys/stat.h>
+
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+class Journal
+{
+public:
+	static void read();
+	/* Synchronize with the journal, and load the record of the last run into the
+	 * stat cache.  Do nothing when there is no journal.  Called once before anything
+	 * is built. */
+
+	static void write();
+	/* Write the record, when the journal was synchronized with.  Called after each
+	 * build. */
+
+	static void print_statistics();
+	/* Output nothing when the record was not used */
+
+private:
+	static constexpr const char *FILENAME_JOURNAL= ".stu/journal";
+	static constexpr const char *FILENAME_RECORD= ".stu/stat";
+	static constexpr const char *FILENAME_COOKIE= ".stu/cookie";
+	static constexpr const char HEADER[8]= {'S', 'T', 'U', 'S', 'T', 'A', 'T', '\2'};
+	/* The last byte is the version of the format.  The header is followed by the
+	 * size of struct stat, the device and inode numbers of the journal, and the
+	 * position in it, and then by the entries, each consisting of the filename and,
+	 * for stat() and lstat(), the error number, followed by the raw struct stat when
+	 * the error number is zero. */
+
+	static constexpr int MILLISECONDS_SYNC= 1000;
+	static constexpr int MILLISECONDS_POLL= 10;
+
+	static bool is_synced;
+	/* The journal was synchronized with at the start of this run */
+	static bool is_used;
+	/* The record was loaded */
+	static uint64_t dev, ino, offset;
+	/* Of the journal, and the position in it at the start of this run */
+	static size_t count_trusted;
+	/* The number of files whose status was taken from the record */
+
+	static bool sync(int fd, uint64_t offset_start, std::vector <std::string> &names);
+	/* Create the cookie and read the journal from OFFSET_START until its name
+	 * appears.  Set OFFSET to the position after the cookie line.  NAMES are the
+	 * lines read before.  Return FALSE when the cookie did not appear. */
+
+	static bool is_changed(const std::string &filename,
+		const std::unordered_set <std::string> &names,
+		const std::unordered_set <std::string> &dirs);
+	/* Whether FILENAME is one of NAMES or below one of them, or one of DIRS */
+
+	static bool is_recorded(const std::string &filename);
+	/* Whether FILENAME is below the current directory, such that the helper sees
+	 * changes to it */
+};
+
+#endif /* ! JOURNAL_HH */
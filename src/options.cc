@@ -4,23 +4,30 @@
 
 #include "buffer.hh"
 #include "color.hh"
+#include "concurrency.hh"
 #include "format.hh"
 #include "job.hh"
 #include "package.hh"
 #include "place.hh"
+#include "scan.hh"
 #include "show.hh"
 #include "timestamp.hh"
 #include "trace.hh"
 #include "version.hh"
 
 const struct option LONG_OPTIONS[]= {
+	{ "batch-wait",       no_argument,       nullptr, 'b'},
 	{ "explain",          no_argument,       nullptr, 'E'},
 	{ "file",             required_argument, nullptr, 'f'},
+	{ "hash",             no_argument,       nullptr, 'H'},
 	{ "help",             no_argument,       nullptr, 'h'},
 	{ "ignore-version",   no_argument,       nullptr, 'U'},
 	{ "interactive",      no_argument,       nullptr, 'i'},
 	{ "jobs",             required_argument, nullptr, 'j'},
 	{ "keep-going",       no_argument,       nullptr, 'k'},
+	{ "lazy",             no_argument,       nullptr, 'R'},
+	{ "max-load",         required_argument, nullptr, 'l'},
+	{ "max-memory-pressure", required_argument, nullptr, 'L'},
 	{ "no-delete",        no_argument,       nullptr, 'K'},
 	{ "order",            required_argument, nullptr, 'm'},
 	{ "order-seed",       required_argument, nullptr, 'M'},
@@ -30,9 +37,11 @@ const struct option LONG_OPTIONS[]= {
 	{ "print-targets",    no_argument,       nullptr, 'I'},
 	{ "question",         no_argument,       nullptr, 'q'},
 	{ "quiet",            no_argument,       nullptr, 's'},
+	{ "server",           no_argument,       nullptr, 'D'},
 	{ "silent",           no_argument,       nullptr, 's'},
 	{ "target",           required_argument, nullptr, 'c'},
 	{ "version",          no_argument,       nullptr, 'V'},
+	{ "watch",            no_argument,       nullptr, 'w'},
 	{ nullptr, 0, nullptr, 0}
 };
 
@@ -44,26 +53,34 @@ const char HELP[]=
 	"Options:\n"
 	"  -0 FILENAME      Read \\0-separated file targets from the given file\n"
 	"  -a               Treat all trivial dependencies as non-trivial\n"
+	"  -b, --batch-wait Process all finished jobs before starting new ones\n"
 	"  -c FILENAME, --target=FILENAME\n"
 	"                   Pass a target filename without Stu syntax parsing\n"
 	"  -C EXPRESSION    Pass a target in full Stu syntax\n"
+	"  -D, --server     Run as a server that performs later invocations of Stu\n"
 	"  -E, --explain    Explain error messages\n"
 	"  -f FILENAME, --file=FILENAME\n"
 	"                   The input file to use instead of 'main.stu'\n"
 	"  -F RULES         Pass rules in Stu syntax\n"
 	"  -g               Treat all optional dependencies as non-optional\n"
 	"  -h, --help       Output help\n"
+	"  -H, --hash       Compare all files by the hash of their content\n"
 	"  -i, --interactive\n"
 	"                   Interactive mode (run jobs in foreground)\n"
 	"  -I, --print-targets\n"
 	"                   Print all buildable file targets as glob patterns\n"
-	"  -j K, --jobs=K   Run K jobs in parallel\n"
+	"  -j K, --jobs=K   Run K jobs in parallel; 'auto': one per available CPU\n"
 	"  -J               Disable Stu syntax in arguments\n"
 	"  -k, --keep-going Keep on running after errors\n"
 	"  -K, --no-delete  Don't delete target files on error or interruption\n"
+	"  -l LOAD, --max-load=LOAD\n"
+	"                   Don't start jobs while the load average exceeds LOAD\n"
+	"  -L PERCENT, --max-memory-pressure=PERCENT\n"
+	"                   Don't start jobs while the memory pressure exceeds PERCENT\n"
 	"  -m ORDER, --order=ORDER\n"
 	"                   Order to run the targets. 'dfs' (default): depth-first order,\n"
-	"                   'random': random order\n"
+	"                   'random': random order, 'critical': longest recorded chains\n"
+	"                   of jobs first\n"
 	"  -M STRING, --order-seed=STRING\n"
         "                   Pseudorandom run order, seeded by given string\n"
 	"  -n FILENAME      Read \\n-separated file targets from the given file\n"
@@ -73,11 +90,13 @@ const char HELP[]=
 	"  -P, --print-rules\n"
 	"                   Print the rules\n"
 	"  -q, --question   Question mode: check whether targets are up to date\n"
+	"  -R, --lazy       Parse dependencies and commands of rules only when used\n"
 	"  -s, --quiet, --silent\n"
 	"                   Silent mode: don't use stdout\n"
 	"  -U, --ignore-version\n"
 	"                   Ignore %version directives\n"
 	"  -V, --version    Output version\n"
+	"  -w, --watch      Build again whenever a file used in the build changes\n"
 	"  -x, --print-commands\n"
 	"                   Output each line in a command individually\n"
 	"  -y               Disable color in output\n"
@@ -93,6 +112,7 @@ bool option_setting(char c)
 	TRACE("c= %s", frmt("'%c'", c));
 	switch (c) {
 	default:   return false;
+	case 'b':  option_b= true;            break;
 	case 'E':  option_E= true;            break;
 	case 'U':  option_U= true;            break;
 	case 's':  option_s= true;            break;
@@ -111,19 +131,25 @@ bool option_various(char c)
 	switch (c) {
 	default:   return false;
 	case 'a':  option_a= true;         break;
+	case 'D':  option_D= true;         break;
 	case 'g':  option_g= true;         break;
 	case 'h':  fputs(HELP, stdout);    exit(0);
+	case 'H':  option_H= true;         break;
 	case 'i':  set_option_i();         break;
 	case 'I':  option_I= true;         break;
 	case 'j':  set_option_j(optarg);   break;
 	case 'J':  option_J= true;         break;
 	case 'k':  option_k= true;         break;
 	case 'K':  option_K= true;         break;
+	case 'l':  set_option_l(optarg);   break;
+	case 'L':  set_option_L(optarg);   break;
 	case 'm':  set_option_m(optarg);   break;
 	case 'M':  set_option_M(optarg);   break;
 	case 'P':  option_P= true;         break;
 	case 'q':  option_q= true;         break;
+	case 'R':  option_R= true;         break;
 	case 'V':  print_option_V();       exit(0);
+	case 'w':  option_w= true;         break;
 	}
 	return true;
 }
@@ -142,6 +168,15 @@ void set_option_i()
 void set_option_j(const char *value)
 {
 	TRACE_FUNCTION();
+	option_j= true;
+	if (!strcmp(value, "auto")) {
+		option_j_auto= true;
+		options_jobs= Concurrency::count_cpus();
+		options_jobs_max= options_jobs;
+		option_parallel= options_jobs > 1;
+		return;
+	}
+	option_j_auto= false;
 	errno= 0;
 	char *endptr;
 	options_jobs= strtol(value, &endptr, 10);
@@ -158,9 +193,39 @@ void set_option_j(const char *value)
 		place << fmt("expected a positive number of jobs, not %s", show(value));
 		exit(ERR_FATAL);
 	}
+	options_jobs_max= options_jobs;
 	option_parallel= options_jobs > 1;
 }
 
+void set_option_l(const char *value)
+{
+	TRACE_FUNCTION();
+	errno= 0;
+	char *endptr;
+	option_l= strtod(value, &endptr);
+	Place place(Place::Type::OPTION, 'l');
+	if (*endptr != '\0' || endptr == value || errno != 0 || ! (option_l > 0)
+		|| ! isfinite(option_l)) {
+		place << fmt("expected a positive load average, not %s", show(value));
+		exit(ERR_FATAL);
+	}
+}
+
+void set_option_L(const char *value)
+{
+	TRACE_FUNCTION();
+	errno= 0;
+	char *endptr;
+	option_L= strtod(value, &endptr);
+	Place place(Place::Type::OPTION, 'L');
+	if (*endptr != '\0' || endptr == value || errno != 0
+		|| ! (option_L > 0 && option_L <= 100)) {
+		place << fmt("expected a percentage larger than 0 and at most 100, not %s",
+			show(value));
+		exit(ERR_FATAL);
+	}
+}
+
 void set_option_m(const char *value)
 {
 	TRACE_FUNCTION();
@@ -175,11 +240,13 @@ void set_option_m(const char *value)
 		buffer_generator.seed(ts.tv_sec + ts.tv_nsec);
 	} else if (!strcmp(value, "dfs")) {
 		/* Default */ ;
+	} else if (!strcmp(value, "critical")) {
+		order= Order::CRITICAL;
 	} else {
 		print_error(fmt(
-			"invalid argument %s for option %s; valid values are %s and %s",
+			"invalid argument %s for option %s; valid values are %s, %s and %s",
 			show(value), show(Option_View('m')),
-			show("random"), show("dfs")));
+			show("random"), show("dfs"), show("critical")));
 		exit(ERR_FATAL);
 	}
 }
@@ -206,8 +273,14 @@ void print_option_V()
 #ifdef STU_COV
 		"This version is built for coverage analysis.\n"
 #endif
-		"USE_MTIM = %u\n",
-		(unsigned)USE_MTIM);
+		"USE_MTIM = %u\n"
+		"USE_POSIX_SPAWN = %u\n"
+		"USE_EPOLL = %u\n"
+		"USE_SIMD = %u (%s)\n",
+		(unsigned)USE_MTIM,
+		(unsigned)USE_POSIX_SPAWN,
+		(unsigned)USE_EPOLL,
+		(unsigned)USE_SIMD, Scan::get_impl_name());
 }
 
 void set_env_options()
@@ -228,6 +301,20 @@ void set_env_options()
 	}
 }
 
+void reset_options()
+{
+	TRACE_FUNCTION();
+	option_a= option_b= option_D= option_E= option_g= option_H= option_i=
+		option_I= option_J= option_k= option_K= option_U= option_P= option_q=
+		option_R= option_s= option_w= option_x= option_z= false;
+	option_j= option_j_auto= false;
+	option_l= option_L= 0;
+	order= Order::DFS;
+	option_parallel= false;
+	order_vec= false;
+	options_jobs= options_jobs_max= 1;
+}
+
 void check_status()
 {
 	TRACE_FUNCTION();
@@ -11,20 +11,24 @@
  * All boolean option variables are FALSE by default.
  */
 
-const char OPTIONS[]= "0:ac:C:dEf:F:ghiIj:JkKm:M:n:o:p:PqsUVxyYz";
+const char OPTIONS[]= "0:abc:C:dDEf:F:ghHiIj:JkKl:L:m:M:n:o:p:PqRsUVwxyYz";
 
 extern const struct option LONG_OPTIONS[];
 
 extern const char HELP[];
 
+#define ENV_STU_CACHE_DIR  "STU_CACHE_DIR"
 #define ENV_STU_CP         "STU_CP"
 #define ENV_STU_OPTIONS    "STU_OPTIONS"
 #define ENV_STU_SHELL      "STU_SHELL"
 #define ENV_STU_STATUS     "STU_STATUS"
 
 static bool option_a= false;
+static bool option_b= false;
+static bool option_D= false;
 static bool option_E= false;
 static bool option_g= false;
+static bool option_H= false;
 static bool option_i= false;
 static bool option_I= false;
 static bool option_J= false;
@@ -33,14 +37,29 @@ static bool option_K= false;
 static bool option_U= false;
 static bool option_P= false;
 static bool option_q= false;
+static bool option_R= false;
 static bool option_s= false;
+static bool option_w= false;
 static bool option_x= false;
 static bool option_z= false;
 
+static bool option_j= false;
+/* Option -j is used */
+
+static bool option_j_auto= false;
+/* Option -j is used with the value 'auto' */
+
+static double option_l= 0;
+static double option_L= 0;
+/* The values of -l and -L; zero when not used */
+
 enum class Order {
-	DFS   = 0,
-	RANDOM= 1,
+	DFS     = 0,
+	RANDOM  = 1,
 	/* -M mode is coded as Order::RANDOM */
+	CRITICAL= 2,
+	/* Like DFS, but dependencies with the longest recorded chain of jobs come
+	 * first; see history.hh */
 };
 static Order order= Order::DFS;
 
@@ -53,7 +72,10 @@ static bool order_vec= false;
 static long options_jobs= 1;
 /* Number of free slots for jobs.  This is a long because strtol() gives a
  * long.  Set before calling main() from the -j option, and then changed
- * internally by Executor.  Always nonnegative. */
+ * internally by Executor and Concurrency.  Always nonnegative. */
+
+static long options_jobs_max= 1;
+/* The maximal number of jobs running at once, as given by -j */
 
 static const char *program_name= nullptr;
 /* Does the same as program_invocation_name (which is a GNU extension,
@@ -65,10 +87,16 @@ bool option_various(char c);
 
 void set_option_i();
 void set_option_j(const char *value);
+void set_option_l(const char *value);
+void set_option_L(const char *value);
 void set_option_m(const char *value);
 void set_option_M(const char *value);
 void print_option_V();
 void set_env_options();
+
+void reset_options();
+/* Set all option variables back to their default values, as in a new process.  Used by
+ * the server (-D) for each forwarded invocation. */
 void check_status();
 
 #endif /* ! OPTIONS_HH */
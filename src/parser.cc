@@ -1,6 +1,7 @@
 #include "parser.hh"
 
 #include "explain.hh"
+#include "rule_cache.hh"
 #include "tokenizer.hh"
 #include "flags.hh"
 
@@ -12,6 +13,22 @@ shared_ptr <Rule> Parser::parse_rule(
 	Place place_output;
 	Target_Index output_target_index= TARGET_INDEX_NONE;
 	std::vector <shared_ptr <const Plain_Dep> > targets;
+	std::vector <Pool_Use> pool_uses;
+
+	while (shared_ptr <Pool_Token> pool_token= is <Pool_Token> ()) {
+		for (const Pool_Use &pool_use: pool_uses) {
+			if (pool_use.index != pool_token->pool_use.index)
+				continue;
+			const string &name= Pool::pools[pool_use.index].name;
+			pool_token->get_place() << fmt("pool %s must not be used twice",
+				show(name));
+			pool_use.place << fmt("pool %s was previously used here",
+				show(name));
+			throw ERR_LOGICAL;
+		}
+		pool_uses.push_back(pool_token->pool_use);
+		++iter;
+	}
 
 	while (iter != tokens.end()) {
 		bool r= parse_target(
@@ -19,6 +36,16 @@ shared_ptr <Rule> Parser::parse_rule(
 		if (!r) break;
 	}
 	if (targets.size() == 0) {
+		if (! pool_uses.empty()) {
+			if (iter == tokens.end())
+				place_end << "expected a target";
+			else
+				(*iter)->get_place_start() << fmt(
+					"expected a target, not %s", show(*iter));
+			pool_uses.back().place << fmt("after %s",
+				show(Operator_View("%use")));
+			throw ERR_LOGICAL;
+		}
 		assert(iter == iter_begin);
 		return nullptr;
 	}
@@ -51,6 +78,45 @@ shared_ptr <Rule> Parser::parse_rule(
 		}
 	}
 
+	if (option_R) {
+		/* Keep the tokens up to the end of the rule, i.e., up to the first
+		 * command or semicolon.  When the rule is not terminated before the
+		 * next %use or the end of the input, it is parsed now, to output the
+		 * error at once. */
+		const auto iter_body= iter;
+		while (iter != tokens.end() && ! is <Pool_Token> ()) {
+			bool is_end= is <Command> () || is_operator(';');
+			++iter;
+			if (! is_end)
+				continue;
+			auto body= std::make_shared <Rule_Body> ();
+			body->arena= arena;
+			body->tokens.assign(iter_body, iter);
+			body->place_end= place_end;
+			body->place_output= place_output;
+			body->targets= targets;
+			auto rule= std::make_shared <Rule> (
+				move(targets), std::vector <shared_ptr <const Dep> > (),
+				body->targets[0]->place, nullptr, Placed_Name(), false,
+				output_target_index, false);
+			rule->pool_uses= move(pool_uses);
+			rule->body= body;
+			return rule;
+		}
+		iter= iter_body;
+	}
+
+	return parse_rule_body(move(targets), place_output, output_target_index,
+		move(pool_uses));
+}
+
+shared_ptr <Rule> Parser::parse_rule_body(
+	std::vector <shared_ptr <const Plain_Dep> > &&targets,
+	const Place &place_output,
+	Target_Index output_target_index,
+	std::vector <Pool_Use> &&pool_uses)
+{
+	TRACE_FUNCTION();
 	if (iter == tokens.end()) {
 		place_end << fmt("expected a command, %s, %s, or %s",
 			show(Operator_View(':')), show(Operator_View(';')),
@@ -125,8 +191,10 @@ shared_ptr <Rule> Parser::parse_rule(
 			/* "No redirected output" is checked later */
 			is_content= true;
 		} else {
-			return parse_remainder_copy_rule(
+			shared_ptr <Rule> rule= parse_remainder_copy_rule(
 				place_equal, place_output, targets);
+			rule->pool_uses= move(pool_uses);
+			return rule;
 		}
 	} else if (is_operator(';')) {
 		place_nocommand_semicolon= (*iter)->get_place();
@@ -192,9 +260,11 @@ shared_ptr <Rule> Parser::parse_rule(
 		throw ERR_LOGICAL;
 	}
 
-	return std::make_shared <Rule> (
+	shared_ptr <Rule> rule= std::make_shared <Rule> (
 		move(targets), deps, command, is_content, output_target_index,
 		filename_input);
+	rule->pool_uses= move(pool_uses);
+	return rule;
 }
 
 shared_ptr <Rule> Parser::parse_remainder_copy_rule(
@@ -1047,12 +1117,13 @@ void Parser::append_copy(      Name &to,
 void Parser::get_rule_list(
 	std::vector <shared_ptr <Rule> > &rules,
 	std::vector <shared_ptr <Token> > &tokens,
+	shared_ptr <Arena> arena,
 	const Place &place_end,
 	shared_ptr <const Plain_Dep> &target_first)
 {
 	TRACE_FUNCTION();
 	auto iter= tokens.begin();
-	Parser parser(tokens, iter, place_end);
+	Parser parser(tokens, iter, place_end, arena);
 	parser.parse_rule_list(rules, target_first);
 
 	if (iter != tokens.end()) {
@@ -1063,6 +1134,30 @@ void Parser::get_rule_list(
 	}
 }
 
+shared_ptr <const Rule> Parser::get_rule_body(shared_ptr <const Rule> rule)
+{
+	TRACE_FUNCTION();
+	if (! rule->body)
+		return rule;
+	Rule_Body &body= *rule->body;
+	if (! body.rule) {
+		TRACE("Parse body");
+		auto iter= body.tokens.begin();
+		Parser parser(body.tokens, iter, body.place_end);
+		std::vector <shared_ptr <const Plain_Dep> > targets= body.targets;
+		std::vector <Pool_Use> pool_uses= rule->pool_uses;
+		shared_ptr <Rule> rule_body= parser.parse_rule_body(move(targets),
+			body.place_output, rule->output_target_index, move(pool_uses));
+		/* The body ends with the first command or semicolon */
+		assert(iter == body.tokens.end());
+		rule_body->canonicalize();
+		body.rule= rule_body;
+		body.tokens.clear();
+		body.arena= nullptr;
+	}
+	return body.rule;
+}
+
 void Parser::get_expression_list(
 	std::vector <shared_ptr <const Dep> > &deps,
 	std::vector <shared_ptr <Token> > &tokens,
@@ -1201,13 +1296,14 @@ bool Parser::next_concatenates() const
 	if ((*iter)->environment & E_WHITESPACE)
 		return false;
 
-	if (is <Name_Token> ())
+	if (peek <Name_Token> ())
 		return true;
 
-	if (! is <Operator> ())
+	const Operator *op_token= peek <Operator> ();
+	if (! op_token)
 		return false;
 
-	char op= is <Operator> ()->op;
+	char op= op_token->op;
 	return op == '(' || op == '[';
 }
 
@@ -1229,20 +1325,39 @@ void Parser::get_file(
 	if (!strcmp(filename_passed, "-"))
 		filename_passed= "";
 
+	/* Standard input is not cached */
+	if (filename_passed[0]) {
+		if (Rule_Cache::load(filename_passed, rule_set, target_first, place_first)) {
+			if (file_fd >= 0)
+				close(file_fd);
+			return;
+		}
+		Rule_Cache::begin();
+	}
+	size_t count_pools= Pool::pools.size();
+
 	/* Tokenize */
+	shared_ptr <Arena> arena= std::make_shared <Arena> ();
 	std::vector <shared_ptr <Token> > tokens;
 	Place place_end;
 	Tokenizer::parse_tokens_file(
-		tokens, Tokenizer::SOURCE, place_end, filename_passed,
+		tokens, *arena, Tokenizer::SOURCE, place_end, filename_passed,
 		place_diagnostic, file_fd);
 
 	/* Build rules */
 	std::vector <shared_ptr <Rule> > rules;
-	Parser::get_rule_list(rules, tokens, place_end, target_first);
+	shared_ptr <const Plain_Dep> target_first_file;
+	Parser::get_rule_list(rules, tokens, arena, place_end, target_first_file);
+	tokens.clear();
 
 	/* Add to set */
 	rule_set.add(rules);
 
+	if (filename_passed[0])
+		Rule_Cache::store(filename_passed, rules, target_first_file, place_end,
+			count_pools);
+	if (target_first == nullptr)
+		target_first= target_first_file;
 	if (rules.empty() && place_first.empty()) {
 		place_first= place_end;
 	}
@@ -1259,7 +1374,7 @@ void Parser::get_string(
 		tokens, Tokenizer::OPTION_F, place_end, s, Place(Place::Type::OPTION, 'F'));
 
 	std::vector <shared_ptr <Rule> > rules;
-	Parser::get_rule_list(rules, tokens, place_end, target_first);
+	Parser::get_rule_list(rules, tokens, nullptr, place_end, target_first);
 
 	rule_set.add(rules);
 }
@@ -39,6 +39,7 @@
  * dependency.
  */
 
+#include "arena.hh"
 #include "dep.hh"
 #include "place.hh"
 #include "rule.hh"
@@ -63,8 +64,15 @@ public:
 	static void get_rule_list(
 		std::vector <shared_ptr <Rule> > &rules,
 		std::vector <shared_ptr <Token> > &tokens,
+		shared_ptr <Arena> arena,
 		const Place &place_end,
 		shared_ptr <const Plain_Dep> &target_first);
+	/* ARENA is the arena of TOKENS, or null.  Rules read with -R keep it. */
+
+	static shared_ptr <const Rule> get_rule_body(shared_ptr <const Rule> rule);
+	/* Return the complete rule for RULE.  For a rule read with -R, the dependencies
+	 * and the command are parsed when this is first called, and errors in them are
+	 * output and thrown.  Other rules are returned as they are. */
 
 	static void get_expression_list(
 		std::vector <shared_ptr <const Dep> > &deps,
@@ -122,13 +130,16 @@ private:
 	std::vector <shared_ptr <Token> > &tokens;
 	std::vector <shared_ptr <Token> > ::iterator &iter;
 	const Place place_end;
+	const shared_ptr <Arena> arena;
 
 	Parser(std::vector <shared_ptr <Token> > &tokens_,
 	       std::vector <shared_ptr <Token> > ::iterator &iter_,
-	       const Place &place_end_)
+	       const Place &place_end_,
+	       shared_ptr <Arena> arena_= nullptr)
 		:  tokens(tokens_),
 		   iter(iter_),
-		   place_end(place_end_)
+		   place_end(place_end_),
+		   arena(arena_)
 	{ }
 
 	void parse_rule_list(
@@ -144,7 +155,15 @@ private:
 	/* RET is filled.  RET is empty when called. */
 
 	shared_ptr <Rule> parse_rule(shared_ptr <const Plain_Dep> &target_first);
-	/* Return null when nothing was parsed */
+	/* Return null when nothing was parsed.  With -R, only the targets are parsed,
+	 * and the rest of the rule is kept in the body of the returned rule. */
+
+	shared_ptr <Rule> parse_rule_body(
+		std::vector <shared_ptr <const Plain_Dep> > &&targets,
+		const Place &place_output,
+		Target_Index output_target_index,
+		std::vector <Pool_Use> &&pool_uses);
+	/* Parse the rest of a rule after its targets */
 
 	shared_ptr <Rule> parse_remainder_copy_rule(
 		const Place &place_equal,
@@ -194,14 +213,25 @@ private:
 			return std::dynamic_pointer_cast <T> (*iter);
 	}
 
+	template <typename T> const T *peek() const
+	/* Like is(), but without changing the reference count */
+	{
+		if (iter == tokens.end())
+			return nullptr;
+		else
+			return dynamic_cast <const T *> (iter->get());
+	}
+
 	/* Whether the next token is the given operator */
 	bool is_operator(char op) const {
-		return is <Operator> () && is <Operator> ()->op == op;
+		const Operator *op_token= peek <Operator> ();
+		return op_token && op_token->op == op;
 	}
 
 	/* Whether the next token is the given flag token */
 	bool is_flag(char flag_char) const {
-		return is <Flag_Token> () && is <Flag_Token> ()->flag_char == flag_char;
+		const Flag_Token *flag_token= peek <Flag_Token> ();
+		return flag_token && flag_token->flag_char == flag_char;
 	}
 
 	bool next_concatenates() const;
@@ -1,6 +1,8 @@
 #include "place.hh"
 
 const Place Place::place_empty;
+std::deque <string> Place::filenames;
+std::unordered_map <std::string_view, uint32_t> Place::indexes_filename;
 
 const Place &Place::operator<<(string message) const
 {
@@ -50,12 +52,11 @@ void Place::print(
 		break;
 
 	case Type::OPTION:
-		assert(text.size() == 1);
 		fprintf(stderr,
 			"%sOption %s-%c%s%s: %s\n",
 			color_on,
 			Color::highlight_on[CH_ERR],
-			text[0],
+			get_option(),
 			Color::highlight_off[CH_ERR],
 			color_off,
 			message.c_str());
@@ -92,7 +93,7 @@ string Place::as_argv0() const
 		should_not_happen();
 		return "";
 	case Type::OPTION:
-		return fmt("Option -%s", text);
+		return frmt("Option -%c", get_option());
 	case Type::ENV_OPTIONS: /* uncovered_due_to_bug_in_gcov */
 		should_not_happen();
 		return "$" ENV_STU_OPTIONS;
@@ -102,7 +103,20 @@ string Place::as_argv0() const
 const char *Place::get_filename_str() const
 {
 	assert(type == Type::INPUT_FILE);
-	return text.empty() ? "<stdin>" : text.c_str();
+	const string &filename= get_filename();
+	return filename.empty() ? "<stdin>" : filename.c_str();
+}
+
+uint32_t Place::intern(std::string_view filename)
+{
+	auto i= indexes_filename.find(filename);
+	if (i != indexes_filename.end())
+		return i->second;
+	assert(filenames.size() < UINT32_MAX);
+	const uint32_t file= filenames.size();
+	filenames.emplace_back(filename);
+	indexes_filename.emplace(filenames.back(), file);
+	return file;
 }
 
 void print_warning(const Place &place, string message)
@@ -4,8 +4,16 @@
 /*
  * Denotes a position in Stu source code.  This is either in a file or in
  * arguments/options to Stu.  A Place object can also be empty, which is used as the
- * "uninitialized" value.
+ * "uninitialized" value.  Places are copied into every token, name and dependency, and
+ * therefore a place does not contain the name of its file, but only an index into a
+ * table of filenames, which are never removed.
  */
+
+#include <stdint.h>
+
+#include <deque>
+#include <string_view>
+#include <unordered_map>
 class Place
 {
 public:
@@ -21,10 +29,12 @@ public:
 		LONG_FLAG = 1 << 0,
 	} bits;
 
-	string text;
-	/* INPUT_FILE:  Name of the file.  Empty string for standard input.
-	 * OPTION:      Name of the option (a single character)
-	 * Others:      Unused */
+	uint32_t file;
+	/* INPUT_FILE:  Index of the name of the file in FILENAMES.
+	 * OPTION:  Name of the option, as an unsigned char; see get_option().
+	 * Others:  Zero.
+	 * Always initialized, such that places can be copied and rebuilt from FILE
+	 * whatever their type. */
 
 	size_t line;
 	/* INPUT_FILE:  Line number, one-based.
@@ -37,26 +47,44 @@ public:
 	 * one-based, but they are saved here as zero-based numbers as these are easier to
 	 * generate.  Others: Unused. */
 
-	Place(): type(Type::EMPTY), bits((Bits)0) {}
+	Place(): type(Type::EMPTY), bits((Bits)0), file(0), line(0), column(0) {}
 	Place(Type type_, Bits bits_, std::string_view filename_,
 		size_t line_, size_t column_)
-		: type(type_), bits(bits_), text(filename_),
+		: type(type_), bits(bits_), file(intern(filename_)),
+		  line(line_), column(column_) {}
+
+	Place(Type type_, Bits bits_, uint32_t file_, size_t line_, size_t column_)
+	/* FILE_ is the value of FILE of another place */
+		: type(type_), bits(bits_), file(file_),
 		  line(line_), column(column_) {}
 
-	Place(Type type_): type(type_), bits((Bits)0) {
+	Place(Type type_): type(type_), bits((Bits)0), file(0), line(0), column(0) {
 		assert(type == Type::ARGUMENT || type == Type::ENV_OPTIONS);
 	}
 
-	Place(Type type_, char option)
+	Place(Type type_, char option_)
 	/* In an option (OPTION) */
-		: type(type_), bits((Bits)0), text(string(&option, 1))
+		: type(type_), bits((Bits)0), file((unsigned char)option_),
+		  line(0), column(0)
 	{
 		assert(type == Type::OPTION);
 	}
 
 	Type get_type() const { return type; }
+
+	char get_option() const {
+		assert(type == Type::OPTION);
+		return (char)file;
+	}
+
 	const char *get_filename_str() const;
 
+	const string &get_filename() const {
+		assert(type == Type::INPUT_FILE);
+		return get_filename(file);
+	}
+	/* Empty string for standard input */
+
 	const Place &operator<<(string message) const;
 	/* Print the backtrace to STDERR as part of an error message.  The backtrace is
 	 * printed as a single line, which can be parsed by tools, e.g. the compile mode
@@ -76,6 +104,20 @@ public:
 	static const Place place_empty;
 	/* A static empty place object, used in various places when a reference to an
 	 * empty place object is needed.  Otherwise, Place() is an empty place. */
+
+	static uint32_t intern(std::string_view filename);
+	/* The index of FILENAME in FILENAMES, adding it when it is not there yet */
+
+	static const string &get_filename(uint32_t file) {
+		assert(file < filenames.size());
+		return filenames[file];
+	}
+
+private:
+	static std::deque <string> filenames;
+	static std::unordered_map <std::string_view, uint32_t> indexes_filename;
+	/* All filenames that appear in places, each stored once.  The keys of
+	 * INDEXES_FILENAME point into FILENAMES, whose elements are never moved. */
 };
 
 void print_warning(const Place &place, string message);
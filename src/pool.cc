@@ -0,0 +1,38 @@
+#include "pool.hh"
+
+std::vector <Pool> Pool::pools;
+
+size_t Pool::find(const string &name)
+{
+	size_t i= 0;
+	while (i < pools.size() && pools[i].name != name) ++i;
+	return i;
+}
+
+bool Pool::is_available(const std::vector <Pool_Use> &pool_uses)
+{
+	for (const Pool_Use &pool_use: pool_uses) {
+		const Pool &pool= pools.at(pool_use.index);
+		if (pool.used + pool_use.weight > pool.capacity)
+			return false;
+	}
+	return true;
+}
+
+void Pool::acquire(const std::vector <Pool_Use> &pool_uses)
+{
+	for (const Pool_Use &pool_use: pool_uses) {
+		Pool &pool= pools.at(pool_use.index);
+		pool.used += pool_use.weight;
+		assert(pool.used <= pool.capacity);
+	}
+}
+
+void Pool::release(const std::vector <Pool_Use> &pool_uses)
+{
+	for (const Pool_Use &pool_use: pool_uses) {
+		Pool &pool= pools.at(pool_use.index);
+		pool.used -= pool_use.weight;
+		assert(pool.used >= 0);
+	}
+}
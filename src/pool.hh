@@ -0,0 +1,59 @@
+#ifndef POOL_HH
+#define POOL_HH
+
+/*
+ * Named resource pools.  A pool is declared with a capacity using the %pool directive,
+ * and rules are charged a weight in one or more pools using the %use directive before
+ * their targets.  The job of a rule is only started when all its pools have enough
+ * capacity left, in addition to the limit given by -j.  Since the weight of a rule is
+ * never larger than the capacity of a pool, a job can always be started when no other
+ * job is running.
+ */
+
+#include <vector>
+
+#include "place.hh"
+
+class Pool_Use
+/* The use of a pool by a rule, as declared by %use */
+{
+public:
+	size_t index;
+	/* Index in Pool::pools */
+
+	long weight;
+	/* Positive, and at most the capacity of the pool */
+
+	Place place;
+	/* Of the %use directive */
+};
+
+class Pool
+{
+public:
+	const string name;
+	const long capacity;
+	const Place place;
+	/* Of the %pool directive */
+
+	long used= 0;
+	/* Sum of the weights of all running jobs using this pool */
+
+	Pool(string name_, long capacity_, const Place &place_)
+		: name(name_), capacity(capacity_), place(place_) { }
+
+	static std::vector <Pool> pools;
+	/* All declared pools, in order of declaration */
+
+	static size_t find(const string &name);
+	/* The index of the pool with the given name, or the number of pools if it does
+	 * not exist */
+
+	static bool is_available(const std::vector <Pool_Use> &pool_uses);
+	/* Whether all given pools have enough capacity left */
+
+	static void acquire(const std::vector <Pool_Use> &pool_uses);
+	static void release(const std::vector <Pool_Use> &pool_uses);
+};
+
+#endif /* ! POOL_HH */
@@ -1,5 +1,7 @@
 #include "rule.hh"
 
+#include "parser.hh"
+
 Rule::Rule(
 	std::vector <shared_ptr <const Plain_Dep> > &&targets_,
 	std::vector <shared_ptr <const Dep> > &&deps_,
@@ -104,12 +106,14 @@ shared_ptr <const Rule> Rule::instantiate(
 	shared_ptr <Placed_Name> placed_name_input=
 		rule->placed_name_input.instantiate(mapping);
 
-	return std::make_shared <Rule> (
+	shared_ptr <Rule> ret= std::make_shared <Rule> (
 		move(placed_targets),
 		move(deps), rule->place, rule->command,
 		*placed_name_input,
 		rule->is_content, rule->output_target_index,
 		rule->is_copy);
+	ret->pool_uses= rule->pool_uses;
+	return ret;
 }
 
 void Rule::render(Parts &parts, Rendering rendering) const
@@ -252,7 +256,7 @@ shared_ptr <const Rule> Rule_Set::get(
 	auto i= rules_unparam.find(hash_dep);
 	if (i != rules_unparam.end()) {
 		target_index= i->second.first;
-		shared_ptr <const Rule> rule= i->second.second;
+		shared_ptr <const Rule> rule= Parser::get_rule_body(i->second.second);
 		assert(rule != nullptr);
 		assert(rule->targets.front()->placed_target.placed_name.get_n() == 0);
 #ifndef NDEBUG
@@ -310,12 +314,13 @@ shared_ptr <const Rule> Rule_Set::get(
 	}
 
 	/* Instantiate the rule */
-	shared_ptr <const Rule> rule_best= best_rule_finder.best().rule;
+	shared_ptr <const Rule> rule_best=
+		Parser::get_rule_body(best_rule_finder.best().rule);
 	mapping_parameter= best_rule_finder.best().mapping;
 	shared_ptr <const Rule> ret(Rule::instantiate(rule_best, mapping_parameter));
 	param_rule= rule_best;
-	target_plain_dep= best_rule_finder.best().target;
 	target_index= best_rule_finder.best().target_index;
+	target_plain_dep= rule_best->targets[target_index];
 	TRACE("target_plain_dep= %s", show_trace(target_plain_dep));
 	return ret;
 }
@@ -326,11 +331,11 @@ void Rule_Set::print_for_option_P() const
 	for (auto i: rules_unparam)  {
 		if (seen.find(i.second.second) != seen.end()) continue;
 		seen.insert(i.second.second);
-		string text= show(i.second.second, S_OPTION_P);
+		string text= show(Parser::get_rule_body(i.second.second), S_OPTION_P);
 		puts(text.c_str());
 	}
 	for (auto i: rules_param)  {
-		string text= show(i, S_OPTION_P);
+		string text= show(Parser::get_rule_body(i), S_OPTION_P);
 		puts(text.c_str());
 	}
 }
@@ -339,7 +344,7 @@ void Rule_Set::print_for_option_I() const
 {
 	std::set <string> filenames;
 	for (auto i: rules_unparam)  {
-		const Rule &rule= * i.second.second;
+		const Rule &rule= * Parser::get_rule_body(i.second.second);
 		if (rule.must_exist())
 			continue;
 		for (auto target: rule.targets) {
@@ -349,7 +354,8 @@ void Rule_Set::print_for_option_I() const
 				show(target->placed_target.placed_name, S_OPTION_I, R_GLOB));
 		}
 	}
-	for (auto rule: rules_param)  {
+	for (auto rule_param: rules_param)  {
+		shared_ptr <const Rule> rule= Parser::get_rule_body(rule_param);
 		if (rule->must_exist())
 			continue;
 		for (auto target: rule->targets) {
@@ -6,6 +6,7 @@
 #include <unordered_map>
 #include <unordered_set>
 
+#include "arena.hh"
 #include "dep.hh"
 #include "place.hh"
 #include "preset.hh"
@@ -14,6 +15,29 @@
 typedef unsigned Target_Index;
 inline constexpr Target_Index TARGET_INDEX_NONE= std::numeric_limits <Target_Index> ::max();
 
+class Rule;
+
+class Rule_Body
+/* The part of a rule after its targets, when it is read with -R.  It is parsed when the
+ * rule is first used. */
+{
+public:
+	shared_ptr <Arena> arena;
+	/* The arena of TOKENS, or null.  Declared first, such that it is destroyed
+	 * after TOKENS. */
+
+	std::vector <shared_ptr <Token> > tokens;
+	/* Up to and including the command or semicolon ending the rule */
+
+	Place place_end, place_output;
+
+	std::vector <shared_ptr <const Plain_Dep> > targets;
+	/* As parsed, i.e., not canonicalized */
+
+	shared_ptr <const Rule> rule;
+	/* The complete rule, once it was parsed; then TOKENS is empty */
+};
+
 class Rule
 /* The class Rule allows parameters; there is no "unparametrized rule" class. */
 {
@@ -57,6 +81,15 @@ public:
 	/* Whether the rule is a copy rule, i.e., declared with '=' followed by a
 	 * filename. */
 
+	std::vector <Pool_Use> pool_uses;
+	/* The pools used by the job of this rule, as declared with %use before the
+	 * targets.  Each pool appears at most once. */
+
+	shared_ptr <Rule_Body> body;
+	/* Non-null for rules read with -R; then only the targets, the place, the output
+	 * target index and the pools are set.  Complete rules are returned by
+	 * Parser::get_rule_body(). */
+
 	Rule(std::vector <shared_ptr <const Plain_Dep> > &&placed_targets,
 	     std::vector <shared_ptr <const Dep> > &&deps_,
 	     const Place &place_,
@@ -0,0 +1,709 @@
+#include "rule_cache.hh"
+
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/mman.h>
+
+#include "history.hh"
+#include "options.hh"
+#include "state_file.hh"
+#include "trace.hh"
+#include "version.hh"
+#include "watch.hh"
+
+bool Rule_Cache::is_recording= false;
+bool Rule_Cache::is_cacheable= false;
+std::vector <string> Rule_Cache::sources;
+std::vector <Fingerprint> Rule_Cache::fingerprints;
+std::vector <Rule_Cache::Event> Rule_Cache::events;
+std::vector <uint32_t> Rule_Cache::files;
+std::unordered_map <uint32_t, size_t> Rule_Cache::indexes_file;
+size_t Rule_Cache::count_hits= 0;
+size_t Rule_Cache::count_misses= 0;
+
+enum {
+	/* The types of dependencies in the cache file */
+	R_PLAIN, R_DYNAMIC, R_CONCAT, R_COMPOUND
+};
+
+bool Rule_Cache::load(const char *filename, Rule_Set &rule_set,
+	shared_ptr <const Plain_Dep> &target_first, Place &place_first)
+{
+	TRACE_FUNCTION();
+	TRACE("filename= %s", filename);
+	string filename_cache= get_filename(filename);
+	int fd= open(filename_cache.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		if (errno != ENOENT)
+			print_errno("open", filename_cache);
+		++count_misses;
+		return false;
+	}
+	struct stat buf;
+	if (fstat(fd, &buf) < 0) {
+		print_errno("fstat", filename_cache);
+		close(fd);
+		++count_misses;
+		return false;
+	}
+	/* mmap() may fail on files of zero length */
+	if (buf.st_size == 0) {
+		close(fd);
+		++count_misses;
+		return false;
+	}
+	size_t size= buf.st_size;
+	char *in= (char *)mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (in == MAP_FAILED) {
+		print_errno("mmap", filename_cache);
+		++count_misses;
+		return false;
+	}
+
+	const char *p= in;
+	std::vector <string> filenames;
+	std::vector <struct stat> bufs;
+	std::vector <Event> events_cache;
+	std::vector <Pool> pools;
+	std::vector <shared_ptr <Rule> > rules;
+	shared_ptr <const Plain_Dep> target_first_cache;
+	Place place_end;
+	bool is_valid= parse(p, in + size, filenames, bufs, events_cache, pools, rules,
+		target_first_cache, place_end);
+	files.clear();
+	if (munmap(in, size) < 0)
+		print_errno("munmap", filename_cache);
+	TRACE("is_valid= %s", frmt("%d", is_valid));
+	if (! is_valid) {
+		++count_misses;
+		return false;
+	}
+	++count_hits;
+
+	for (size_t i= 0; i < filenames.size(); ++i)
+		Watch::add_source(filenames[i], &bufs[i]);
+	for (const Event &event: events_cache) {
+		if (! event.is_set)
+			continue;
+		if (event.has_value)
+			setenv(event.name.c_str(), event.value.c_str(), 1);
+		else
+			unsetenv(event.name.c_str());
+	}
+	for (const Pool &pool: pools)
+		Pool::pools.push_back(pool);
+	rule_set.add(rules);
+	if (target_first == nullptr)
+		target_first= target_first_cache;
+	if (rules.empty() && place_first.empty())
+		place_first= place_end;
+	return true;
+}
+
+void Rule_Cache::begin()
+{
+	is_recording= true;
+	is_cacheable= true;
+	sources.clear();
+	fingerprints.clear();
+	events.clear();
+}
+
+void Rule_Cache::store(const char *filename,
+	const std::vector <shared_ptr <Rule> > &rules,
+	shared_ptr <const Plain_Dep> target_first, const Place &place_end,
+	size_t count_pools)
+{
+	TRACE_FUNCTION();
+	TRACE("filename= %s", filename);
+	assert(is_recording);
+	is_recording= false;
+	if (! is_cacheable)
+		return;
+
+	time_t now= time(nullptr);
+	string buffer(HEADER, sizeof(HEADER));
+	State_File::append_string(buffer, STU_VERSION);
+	State_File::append_number(buffer, sources.size());
+	for (size_t i= 0; i < sources.size(); ++i) {
+		if (fingerprints[i].sec >= now - 1) {
+			TRACE("Modified recently:  %s", sources[i]);
+			return;
+		}
+		State_File::append_string(buffer, sources[i]);
+		State_File::append_fingerprint(buffer, fingerprints[i]);
+	}
+	State_File::append_number(buffer, events.size());
+	for (const Event &event: events) {
+		State_File::append_number(buffer, event.is_set);
+		State_File::append_string(buffer, event.name);
+		State_File::append_number(buffer, event.has_value);
+		State_File::append_string(buffer, event.value);
+	}
+
+	/* The filenames of places are written before the rest */
+	string buffer_rules;
+	files.clear();
+	indexes_file.clear();
+	State_File::append_number(buffer_rules, count_pools);
+	State_File::append_number(buffer_rules, Pool::pools.size());
+	for (const Pool &pool: Pool::pools) {
+		State_File::append_string(buffer_rules, pool.name);
+		State_File::append_number(buffer_rules, pool.capacity);
+		append_place(buffer_rules, pool.place);
+	}
+	State_File::append_number(buffer_rules, rules.size());
+	for (const auto &rule: rules)
+		if (! append_rule(buffer_rules, rule))
+			return;
+	State_File::append_number(buffer_rules, target_first != nullptr);
+	if (target_first && ! append_dep(buffer_rules, target_first))
+		return;
+	append_place(buffer_rules, place_end);
+	State_File::append_number(buffer, files.size());
+	for (uint32_t file: files)
+		State_File::append_string(buffer, Place::get_filename(file));
+	buffer += buffer_rules;
+	files.clear();
+	indexes_file.clear();
+
+	if (! State_File::make_dir())
+		return;
+	State_File::replace(get_filename(filename).c_str(), buffer);
+}
+
+void Rule_Cache::add_source(const string &filename, const struct stat *buf)
+{
+	if (! is_recording)
+		return;
+	if (! S_ISREG(buf->st_mode))
+		is_cacheable= false;
+	sources.push_back(filename);
+	fingerprints.emplace_back(buf);
+}
+
+void Rule_Cache::add_variable(const string &name, const char *value)
+{
+	if (! is_recording)
+		return;
+	events.push_back(Event{false, name, value != nullptr, value ? value : ""});
+}
+
+void Rule_Cache::add_set(const string &name, const char *value)
+{
+	if (! is_recording)
+		return;
+	events.push_back(Event{true, name, value != nullptr, value ? value : ""});
+}
+
+void Rule_Cache::disable()
+{
+	is_cacheable= false;
+}
+
+void Rule_Cache::print_statistics()
+{
+	if (count_hits + count_misses == 0)
+		return;
+	printf("STATISTICS  rule cache = %zu hits, %zu misses\n",
+	       count_hits, count_misses);
+}
+
+string Rule_Cache::get_filename(const char *filename)
+{
+	string text= filename;
+	text += '\0';
+	/* The options that change the result of parsing */
+	text += option_a ? 'a' : '-';
+	text += option_g ? 'g' : '-';
+	text += option_U ? 'U' : '-';
+	return frmt("%s.%016jx", FILENAME_PREFIX, (uintmax_t)Build_Log::hash(text));
+}
+
+bool Rule_Cache::parse(const char *&p, const char *end,
+	std::vector <string> &filenames,
+	std::vector <struct stat> &bufs,
+	std::vector <Event> &events_cache,
+	std::vector <Pool> &pools,
+	std::vector <shared_ptr <Rule> > &rules,
+	shared_ptr <const Plain_Dep> &target_first,
+	Place &place_end)
+{
+	string version;
+	uint64_t count;
+	if ((size_t)(end - p) < sizeof(HEADER) || memcmp(p, HEADER, sizeof(HEADER)))
+		return false;
+	p += sizeof(HEADER);
+	if (! State_File::parse_string(p, end, version) || version != STU_VERSION)
+		return false;
+
+	if (! State_File::parse_number(p, end, count))
+		return false;
+	for (uint64_t i= 0; i < count; ++i) {
+		string filename;
+		Fingerprint fingerprint;
+		struct stat buf;
+		if (! State_File::parse_string(p, end, filename)
+			|| ! State_File::parse_fingerprint(p, end, fingerprint))
+			return false;
+		if (stat(filename.c_str(), &buf) < 0) {
+			if (errno != ENOENT && errno != ENOTDIR)
+				print_errno("stat", filename);
+			return false;
+		}
+		if (Fingerprint(&buf) != fingerprint) {
+			TRACE("Changed:  %s", filename);
+			return false;
+		}
+		filenames.push_back(filename);
+		bufs.push_back(buf);
+	}
+
+	if (! State_File::parse_number(p, end, count))
+		return false;
+	for (uint64_t i= 0; i < count; ++i) {
+		uint64_t is_set, has_value;
+		Event event;
+		if (! State_File::parse_number(p, end, is_set)
+			|| ! State_File::parse_string(p, end, event.name)
+			|| ! State_File::parse_number(p, end, has_value)
+			|| ! State_File::parse_string(p, end, event.value))
+			return false;
+		event.is_set= is_set;
+		event.has_value= has_value;
+		events_cache.push_back(event);
+	}
+	if (! check_events(events_cache))
+		return false;
+
+	if (! State_File::parse_number(p, end, count) || count > (uint64_t)(end - p))
+		return false;
+	files.resize(count);
+	for (uint32_t &file: files) {
+		string filename;
+		if (! State_File::parse_string(p, end, filename))
+			return false;
+		file= Place::intern(filename);
+	}
+
+	/* The pools declared before must be the same, such that the indexes of pools
+	 * in the rules are the same */
+	uint64_t count_pools;
+	if (! State_File::parse_number(p, end, count_pools)
+		|| ! State_File::parse_number(p, end, count)
+		|| count_pools != Pool::pools.size() || count_pools > count)
+		return false;
+	for (uint64_t i= 0; i < count; ++i) {
+		string name;
+		uint64_t capacity;
+		Place place;
+		if (! State_File::parse_string(p, end, name)
+			|| ! State_File::parse_number(p, end, capacity)
+			|| ! parse_place(p, end, place))
+			return false;
+		if (i < count_pools) {
+			if (Pool::pools[i].name != name
+				|| Pool::pools[i].capacity != (long)capacity)
+				return false;
+		} else {
+			pools.emplace_back(name, (long)capacity, place);
+		}
+	}
+
+	if (! State_File::parse_number(p, end, count))
+		return false;
+	for (uint64_t i= 0; i < count; ++i) {
+		shared_ptr <Rule> rule;
+		if (! parse_rule(p, end, Pool::pools.size() + pools.size(), rule))
+			return false;
+		rules.push_back(rule);
+	}
+	uint64_t has_target_first;
+	if (! State_File::parse_number(p, end, has_target_first)
+		|| (has_target_first && ! parse_plain_dep(p, end, target_first))
+		|| ! parse_place(p, end, place_end))
+		return false;
+	return p == end;
+}
+
+bool Rule_Cache::check_events(const std::vector <Event> &events_cache)
+{
+	/* The variables set by earlier events */
+	std::map <string, const Event *> events_set;
+	for (const Event &event: events_cache) {
+		if (event.is_set) {
+			events_set[event.name]= &event;
+			continue;
+		}
+		auto i= events_set.find(event.name);
+		bool has_value;
+		string value;
+		if (i != events_set.end()) {
+			has_value= i->second->has_value;
+			value= i->second->value;
+		} else {
+			const char *v= getenv(event.name.c_str());
+			has_value= v != nullptr;
+			value= v ? v : "";
+		}
+		if (has_value != event.has_value || value != event.value) {
+			TRACE("Variable changed:  %s", event.name);
+			return false;
+		}
+	}
+	return true;
+}
+
+void Rule_Cache::append_place(string &buffer, const Place &place)
+{
+	State_File::append_number(buffer, place.type);
+	State_File::append_number(buffer, place.bits);
+	if (place.type == Place::Type::EMPTY)
+		return;
+	if (place.type == Place::Type::INPUT_FILE) {
+		auto i= indexes_file.find(place.file);
+		if (i == indexes_file.end()) {
+			i= indexes_file.emplace(place.file, files.size()).first;
+			files.push_back(place.file);
+		}
+		State_File::append_number(buffer, i->second);
+	} else if (place.type == Place::Type::OPTION) {
+		State_File::append_number(buffer, place.file);
+	} else {
+		State_File::append_number(buffer, 0);
+	}
+	State_File::append_number(buffer, place.line);
+	State_File::append_number(buffer, place.column);
+}
+
+void Rule_Cache::append_placed_name(string &buffer, const Placed_Name &placed_name)
+{
+	State_File::append_number(buffer, placed_name.get_n());
+	for (const string &text: placed_name.get_texts())
+		State_File::append_string(buffer, text);
+	for (const string &parameter: placed_name.get_parameters())
+		State_File::append_string(buffer, parameter);
+	append_place(buffer, placed_name.place);
+	State_File::append_number(buffer, placed_name.places.size());
+	for (const Place &place: placed_name.places)
+		append_place(buffer, place);
+}
+
+void Rule_Cache::append_flags(string &buffer, const Placed_Flags &flags)
+{
+	State_File::append_number(buffer, flags.get_flags());
+	const std::vector <Placed_Flag> placed_flags= flags.get();
+	State_File::append_number(buffer, placed_flags.size());
+	for (const Placed_Flag &placed_flag: placed_flags) {
+		State_File::append_number(buffer, placed_flag.index);
+		append_place(buffer, placed_flag.place);
+	}
+}
+
+bool Rule_Cache::append_dep(string &buffer, shared_ptr <const Dep> dep)
+{
+	/* These are not set by the parser */
+	if (dep->top || dep->index >= 0)
+		return false;
+	if (auto plain_dep= to <Plain_Dep> (dep)) {
+		State_File::append_number(buffer, R_PLAIN);
+		append_flags(buffer, plain_dep->flags);
+		State_File::append_number(buffer, plain_dep->placed_target.flags);
+		append_placed_name(buffer, plain_dep->placed_target.placed_name);
+		append_place(buffer, plain_dep->placed_target.place);
+		append_place(buffer, plain_dep->place);
+		State_File::append_string(buffer, plain_dep->variable_name);
+	} else if (auto dynamic_dep= to <Dynamic_Dep> (dep)) {
+		State_File::append_number(buffer, R_DYNAMIC);
+		append_flags(buffer, dynamic_dep->flags);
+		return append_dep(buffer, dynamic_dep->dep);
+	} else if (auto concat_dep= to <Concat_Dep> (dep)) {
+		State_File::append_number(buffer, R_CONCAT);
+		append_flags(buffer, concat_dep->flags);
+		State_File::append_number(buffer, concat_dep->deps.size());
+		for (const auto &d: concat_dep->deps)
+			if (! append_dep(buffer, d))
+				return false;
+	} else if (auto compound_dep= to <Compound_Dep> (dep)) {
+		State_File::append_number(buffer, R_COMPOUND);
+		append_flags(buffer, compound_dep->flags);
+		append_place(buffer, compound_dep->place);
+		State_File::append_number(buffer, compound_dep->deps.size());
+		for (const auto &d: compound_dep->deps)
+			if (! append_dep(buffer, d))
+				return false;
+	} else {
+		return false;
+	}
+	return true;
+}
+
+bool Rule_Cache::append_rule(string &buffer, shared_ptr <const Rule> rule)
+{
+	if (rule->body)
+		return false;
+	State_File::append_number(buffer, rule->targets.size());
+	for (const auto &target: rule->targets)
+		if (! append_dep(buffer, target))
+			return false;
+	State_File::append_number(buffer, rule->deps.size());
+	for (const auto &dep: rule->deps)
+		if (! append_dep(buffer, dep))
+			return false;
+	append_place(buffer, rule->place);
+	State_File::append_number(buffer, rule->command != nullptr);
+	if (rule->command) {
+		State_File::append_string(buffer, rule->command->command);
+		append_place(buffer, rule->command->place);
+		append_place(buffer, rule->command->place_start);
+		State_File::append_number(buffer, rule->command->environment);
+	}
+	append_placed_name(buffer, rule->placed_name_input);
+	State_File::append_number(buffer, rule->output_target_index);
+	State_File::append_number(buffer, rule->is_content);
+	State_File::append_number(buffer, rule->is_copy);
+	State_File::append_number(buffer, rule->pool_uses.size());
+	for (const Pool_Use &pool_use: rule->pool_uses) {
+		State_File::append_number(buffer, pool_use.index);
+		State_File::append_number(buffer, pool_use.weight);
+		append_place(buffer, pool_use.place);
+	}
+	return true;
+}
+
+bool Rule_Cache::parse_place(const char *&p, const char *end, Place &place)
+{
+	uint64_t type, bits, index, line, column;
+	if (! State_File::parse_number(p, end, type)
+		|| ! State_File::parse_number(p, end, bits)
+		|| type > Place::Type::ENV_OPTIONS)
+		return false;
+	if (type == Place::Type::EMPTY) {
+		place= Place();
+		return true;
+	}
+	if (! State_File::parse_number(p, end, index)
+		|| ! State_File::parse_number(p, end, line)
+		|| ! State_File::parse_number(p, end, column))
+		return false;
+	if (type == Place::Type::INPUT_FILE) {
+		if (index >= files.size())
+			return false;
+		place= Place(Place::Type::INPUT_FILE, (Place::Bits)bits, files[index],
+			line, column);
+	} else if (type == Place::Type::OPTION) {
+		if (index > UCHAR_MAX)
+			return false;
+		place= Place(Place::Type::OPTION, (char)index);
+		place.bits= (Place::Bits)bits;
+	} else {
+		place= Place((Place::Type)type);
+		place.bits= (Place::Bits)bits;
+	}
+	return true;
+}
+
+bool Rule_Cache::parse_placed_name(const char *&p, const char *end,
+	Placed_Name &placed_name)
+{
+	uint64_t n, count_places;
+	if (! State_File::parse_number(p, end, n) || n > (uint64_t)(end - p))
+		return false;
+	std::vector <string> texts(n + 1), parameters(n);
+	for (string &text: texts)
+		if (! State_File::parse_string(p, end, text))
+			return false;
+	for (string &parameter: parameters)
+		if (! State_File::parse_string(p, end, parameter))
+			return false;
+	placed_name.append_text(texts[0]);
+	for (size_t i= 0; i < n; ++i) {
+		placed_name.Name::append_parameter(parameters[i]);
+		placed_name.append_text(texts[i + 1]);
+	}
+	if (! parse_place(p, end, placed_name.place)
+		|| ! State_File::parse_number(p, end, count_places)
+		|| count_places > (uint64_t)(end - p))
+		return false;
+	placed_name.places.resize(count_places);
+	for (Place &place: placed_name.places)
+		if (! parse_place(p, end, place))
+			return false;
+	return true;
+}
+
+bool Rule_Cache::parse_flags(const char *&p, const char *end, Placed_Flags &flags)
+{
+	uint64_t bits, count;
+	if (! State_File::parse_number(p, end, bits)
+		|| ! State_File::parse_number(p, end, count)
+		|| (bits & ~F_ALL))
+		return false;
+	flags.add_unplaced_flags(bits & F_UNPLACED);
+	for (uint64_t i= 0; i < count; ++i) {
+		uint64_t index;
+		Place place;
+		if (! State_File::parse_number(p, end, index)
+			|| index >= C_ALL || ! ((1 << index) & F_PLACED)
+			|| ! parse_place(p, end, place))
+			return false;
+		flags.add_placed_index(index, place);
+	}
+	return flags.get_flags() == bits;
+}
+
+bool Rule_Cache::parse_dep(const char *&p, const char *end, shared_ptr <const Dep> &dep)
+{
+	uint64_t type, count;
+	Placed_Flags flags;
+	const char *p_type= p;
+	if (! State_File::parse_number(p, end, type))
+		return false;
+	switch (type) {
+	default:
+		return false;
+
+	case R_PLAIN: {
+		shared_ptr <const Plain_Dep> plain_dep;
+		p= p_type;
+		if (! parse_plain_dep(p, end, plain_dep))
+			return false;
+		dep= plain_dep;
+		return true;
+	}
+
+	case R_DYNAMIC: {
+		shared_ptr <const Dep> inner;
+		if (! parse_flags(p, end, flags)
+			|| ! (flags.get_flags() & F_TARGET_DYNAMIC)
+			|| (flags.get_flags() & F_VARIABLE)
+			|| ! parse_dep(p, end, inner))
+			return false;
+		dep= std::make_shared <Dynamic_Dep> (flags, inner);
+		return true;
+	}
+
+	case R_CONCAT: {
+		if (! parse_flags(p, end, flags)
+			|| ! State_File::parse_number(p, end, count))
+			return false;
+		auto concat_dep= std::make_shared <Concat_Dep> (flags);
+		for (uint64_t i= 0; i < count; ++i) {
+			shared_ptr <const Dep> d;
+			if (! parse_dep(p, end, d))
+				return false;
+			concat_dep->push_back(d);
+		}
+		dep= concat_dep;
+		return true;
+	}
+
+	case R_COMPOUND: {
+		Place place;
+		if (! parse_flags(p, end, flags)
+			|| ! parse_place(p, end, place)
+			|| ! State_File::parse_number(p, end, count))
+			return false;
+		auto compound_dep= std::make_shared <Compound_Dep> (flags, place);
+		for (uint64_t i= 0; i < count; ++i) {
+			shared_ptr <const Dep> d;
+			if (! parse_dep(p, end, d))
+				return false;
+			compound_dep->push_back(d);
+		}
+		dep= compound_dep;
+		return true;
+	}
+	}
+}
+
+bool Rule_Cache::parse_plain_dep(const char *&p, const char *end,
+	shared_ptr <const Plain_Dep> &plain_dep)
+{
+	uint64_t type, flags_target;
+	Placed_Flags flags;
+	Placed_Name placed_name;
+	Place place_target, place;
+	string variable_name;
+	if (! State_File::parse_number(p, end, type) || type != R_PLAIN
+		|| ! parse_flags(p, end, flags)
+		|| ! State_File::parse_number(p, end, flags_target)
+		|| (flags_target & ~F_TARGET_PHONY)
+		|| (flags.get_flags() & F_TARGET_PHONY) != flags_target
+		|| ! parse_placed_name(p, end, placed_name)
+		|| ! parse_place(p, end, place_target)
+		|| ! parse_place(p, end, place)
+		|| ! State_File::parse_string(p, end, variable_name))
+		return false;
+	plain_dep= std::make_shared <Plain_Dep> (flags,
+		Placed_Target(flags_target, placed_name, place_target),
+		place, variable_name);
+	return true;
+}
+
+bool Rule_Cache::parse_rule(const char *&p, const char *end, size_t count_pools,
+	shared_ptr <Rule> &rule)
+{
+	uint64_t count, has_command, output_target_index, is_content, is_copy;
+	std::vector <shared_ptr <const Plain_Dep> > targets;
+	std::vector <shared_ptr <const Dep> > deps;
+	Place place;
+	shared_ptr <const Command> command;
+	Placed_Name placed_name_input;
+
+	if (! State_File::parse_number(p, end, count) || count == 0)
+		return false;
+	for (uint64_t i= 0; i < count; ++i) {
+		shared_ptr <const Plain_Dep> target;
+		if (! parse_plain_dep(p, end, target))
+			return false;
+		targets.push_back(target);
+	}
+	if (! State_File::parse_number(p, end, count))
+		return false;
+	for (uint64_t i= 0; i < count; ++i) {
+		shared_ptr <const Dep> dep;
+		if (! parse_dep(p, end, dep))
+			return false;
+		deps.push_back(dep);
+	}
+	if (! parse_place(p, end, place)
+		|| ! State_File::parse_number(p, end, has_command))
+		return false;
+	if (has_command) {
+		string text;
+		Place place_command, place_start;
+		uint64_t environment;
+		if (! State_File::parse_string(p, end, text)
+			|| ! parse_place(p, end, place_command)
+			|| ! parse_place(p, end, place_start)
+			|| ! State_File::parse_number(p, end, environment))
+			return false;
+		command= std::make_shared <Command>
+			(text, place_command, place_start, environment);
+	}
+	if (! parse_placed_name(p, end, placed_name_input)
+		|| ! State_File::parse_number(p, end, output_target_index)
+		|| ! State_File::parse_number(p, end, is_content)
+		|| ! State_File::parse_number(p, end, is_copy)
+		|| (output_target_index != TARGET_INDEX_NONE
+			&& output_target_index >= targets.size()))
+		return false;
+	rule= std::make_shared <Rule> (std::move(targets), std::move(deps), place,
+		command, placed_name_input, is_content, output_target_index, is_copy);
+
+	if (! State_File::parse_number(p, end, count))
+		return false;
+	for (uint64_t i= 0; i < count; ++i) {
+		uint64_t index, weight;
+		Place place_use;
+		if (! State_File::parse_number(p, end, index)
+			|| ! State_File::parse_number(p, end, weight)
+			|| index >= count_pools
+			|| ! parse_place(p, end, place_use))
+			return false;
+		rule->pool_uses.push_back(Pool_Use{index, (long)weight, place_use});
+	}
+	return true;
+}
@@ -0,0 +1,133 @@
+#ifndef RULE_CACHE_HH
+#define RULE_CACHE_HH
+
+/*
+ * The rule cache keeps the rules read from each Stu source file given with -f, or from
+ * the default file main.stu, in the file .stu/rules.$HASH, where $HASH depends on the
+ * filename and on the options that influence parsing.  When the file is read the next
+ * time, and none of the files read for it (i.e., the file itself and all files included
+ * with %include) have changed, the rules are taken from the cache file instead of
+ * being parsed again.  A file counts as changed when its fingerprint, i.e., its
+ * modification time, size, device and inode number, has changed.
+ *
+ * Parsing a file may also depend on environment variables (via $(NAME) and ~), change
+ * them (via %set and %unset), and declare pools.  The variables read are stored in the
+ * cache file and compared to their current values; the changes are applied when the
+ * cache file is used.  The cache file is only used when the pools declared before are
+ * the same as when it was written.  Standard input and the -F option are never cached.
+ *
+ * The cache file is mapped into memory and the rules are added to the rule set as if
+ * they were parsed, such that duplicate rules in multiple files are still found.  A
+ * cache file is not written when one of the files was modified less than a second ago,
+ * as a later modification within the same timestamp would not be noticed, when a file
+ * is not a regular file, or when parsing printed a warning.  The cache file begins with
+ * HEADER and the version of Stu; cache files written by another version are ignored.
+ */
+
+#include <sys/stat.h>
+
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "build_log.hh"
+#include "pool.hh"
+#include "rule.hh"
+
+class Rule_Cache
+{
+public:
+	static bool load(const char *filename, Rule_Set &rule_set,
+		shared_ptr <const Plain_Dep> &target_first, Place &place_first);
+	/* Add the rules of FILENAME from the cache to RULE_SET, with the same semantics
+	 * as Parser::get_file().  Return FALSE when there is no valid cache file, in
+	 * which case nothing was changed, and the file must be parsed. */
+
+	static void begin();
+	/* Start recording what parsing a file depends on */
+
+	static void store(const char *filename,
+		const std::vector <shared_ptr <Rule> > &rules,
+		shared_ptr <const Plain_Dep> target_first, const Place &place_end,
+		size_t count_pools);
+	/* Write the cache file for FILENAME after it was parsed successfully.
+	 * TARGET_FIRST is the first target of the file, or null.  COUNT_POOLS is the
+	 * number of pools that were declared before the file was parsed. */
+
+	/* The following functions are called by the tokenizer while a file is parsed */
+	static void add_source(const std::string &filename, const struct stat *buf);
+	static void add_variable(const std::string &name, const char *value);
+	/* VALUE is null when the variable is not set */
+	static void add_set(const std::string &name, const char *value);
+	/* VALUE is null for %unset */
+	static void disable();
+	/* The result of parsing must not be cached */
+
+	static void print_statistics();
+
+private:
+	static constexpr const char *FILENAME_PREFIX= ".stu/rules";
+	static constexpr const char HEADER[8]= {'S', 'T', 'U', 'R', 'U', 'L', 'E', '\1'};
+	/* The last byte is the version of the format */
+
+	class Event
+	/* The reading or setting of an environment variable */
+	{
+	public:
+		bool is_set;
+		std::string name;
+		bool has_value;
+		std::string value;
+	};
+
+	static bool is_recording, is_cacheable;
+	static std::vector <std::string> sources;
+	static std::vector <Fingerprint> fingerprints;
+	static std::vector <Event> events;
+	/* Recorded while parsing */
+
+	static std::vector <uint32_t> files;
+	static std::unordered_map <uint32_t, size_t> indexes_file;
+	/* The filenames of places, which are stored only once in the cache file.  FILES
+	 * maps indexes in the cache file to Place::file, and INDEXES_FILE is the inverse
+	 * while writing. */
+
+	static size_t count_hits, count_misses;
+
+	static std::string get_filename(const char *filename);
+
+	static bool parse(const char *&p, const char *end,
+		std::vector <std::string> &filenames,
+		std::vector <struct stat> &bufs,
+		std::vector <Event> &events_cache,
+		std::vector <Pool> &pools,
+		std::vector <shared_ptr <Rule> > &rules,
+		shared_ptr <const Plain_Dep> &target_first,
+		Place &place_end);
+	/* Parse the content of a cache file, and check that it is valid.  Return FALSE
+	 * when it is not.  Nothing is changed globally.  POOLS are the pools declared by
+	 * the file. */
+
+	static bool check_events(const std::vector <Event> &events_cache);
+	/* Whether the variables have the same values as when the file was parsed */
+
+	static void append_place(std::string &buffer, const Place &place);
+	static void append_placed_name(std::string &buffer, const Placed_Name &placed_name);
+	static void append_flags(std::string &buffer, const Placed_Flags &flags);
+	static bool append_dep(std::string &buffer, shared_ptr <const Dep> dep);
+	static bool append_rule(std::string &buffer, shared_ptr <const Rule> rule);
+	/* Return FALSE when the object cannot be stored */
+
+	static bool parse_place(const char *&p, const char *end, Place &place);
+	static bool parse_placed_name(const char *&p, const char *end,
+		Placed_Name &placed_name);
+	static bool parse_flags(const char *&p, const char *end, Placed_Flags &flags);
+	static bool parse_dep(const char *&p, const char *end, shared_ptr <const Dep> &dep);
+	static bool parse_plain_dep(const char *&p, const char *end,
+		shared_ptr <const Plain_Dep> &plain_dep);
+	static bool parse_rule(const char *&p, const char *end, size_t count_pools,
+		shared_ptr <Rule> &rule);
+};
+
+#endif /* ! RULE_CACHE_HH */
@@ -0,0 +1,141 @@
+#include "scan.hh"
+
+#include "hints.hh"
+
+constexpr Scan::Table::Table()
+{
+	for (int kind= 0; kind < K_COUNT; ++kind) {
+		const Def &def= defs[kind];
+		bool member[256] {};
+		for (size_t i= 0; i < def.count; ++i)
+			member[(unsigned char)def.chars[i]]= true;
+		if (def.controls) {
+			for (int c= 0; c <= 0x20; ++c)
+				member[c]= true;
+			member[0x7F]= true;
+		}
+		for (int c= 0; c < 256; ++c) {
+			bool s= member[c] != def.invert;
+			stop[kind][c]= s;
+			if (s) {
+				if (c < 0x80)
+					nibble_lo[kind][c & 0xF] |= 1 << (c >> 4);
+				else
+					nibble_hi[kind][c & 0xF] |= 1 << ((c >> 4) - 8);
+			}
+		}
+	}
+}
+
+const Scan::Table Scan::table;
+
+const char *(*Scan::impl)(Kind, const char *, const char *)= &Scan::skip_init;
+
+const char *Scan::get_impl_name()
+{
+	if (impl == &skip_init)
+		skip_init(K_NAME, nullptr, nullptr);
+#if USE_SIMD
+	if (impl == &skip_avx2)
+		return "avx2";
+	if (impl == &skip_sse2)
+		return "sse2";
+#endif
+	return "table";
+}
+
+const char *Scan::skip_init(Kind kind, const char *p, const char *p_end)
+{
+#if USE_SIMD
+	__builtin_cpu_init();
+	impl= __builtin_cpu_supports("avx2") ? &skip_avx2 : &skip_sse2;
+#else
+	impl= &skip_table;
+#endif
+	return impl(kind, p, p_end);
+}
+
+const char *Scan::skip_table(Kind kind, const char *p, const char *p_end)
+{
+	const bool *const stop= table.stop[kind];
+	while (p < p_end && ! stop[(unsigned char)*p])
+		++p;
+	return p;
+}
+
+#if USE_SIMD
+
+const char *Scan::skip_sse2(Kind kind, const char *p, const char *p_end)
+{
+	switch (kind) {
+	case K_NAME:     return skip_sse2_kind <K_NAME>    (p, p_end);
+	case K_BLANK:    return skip_sse2_kind <K_BLANK>   (p, p_end);
+	case K_COMMAND:  return skip_sse2_kind <K_COMMAND> (p, p_end);
+	case K_QUOTE:    return skip_sse2_kind <K_QUOTE>   (p, p_end);
+	case K_COUNT:
+	default:         unreachable();
+	}
+}
+
+template <Scan::Kind kind>
+const char *Scan::skip_sse2_kind(const char *p, const char *p_end)
+/* SSE2 has no byte shuffle, and therefore each character of the class is compared
+ * separately.  The loops over the characters are unrolled, because DEF is constant. */
+{
+	constexpr Def def= defs[kind];
+	while (p_end - p >= 16) {
+		const __m128i v= _mm_loadu_si128((const __m128i *)p);
+		__m128i m= _mm_setzero_si128();
+#pragma GCC unroll 32
+		for (size_t i= 0; i < def.count; ++i)
+			m= _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8(def.chars[i])));
+		if (def.controls) {
+			/* The comparison is signed:  characters from 0x80 are negative */
+			const __m128i ctl= _mm_andnot_si128(
+				_mm_cmplt_epi8(v, _mm_setzero_si128()),
+				_mm_cmplt_epi8(v, _mm_set1_epi8(0x21)));
+			m= _mm_or_si128(m, _mm_or_si128(ctl,
+				_mm_cmpeq_epi8(v, _mm_set1_epi8(0x7F))));
+		}
+		unsigned bits= (unsigned)_mm_movemask_epi8(m);
+		if (def.invert)
+			bits ^= 0xFFFF;
+		if (bits)
+			return p + __builtin_ctz(bits);
+		p += 16;
+	}
+	return skip_table(kind, p, p_end);
+}
+
+__attribute__((target("avx2")))
+const char *Scan::skip_avx2(Kind kind, const char *p, const char *p_end)
+/* Each byte is looked up in a bitmap of 256 bits:  the lower four bits select a byte of
+ * NIBBLE_LO or NIBBLE_HI, the highest bit selects between the two, and the upper four
+ * bits select a bit in the byte. */
+{
+	const __m256i lo= _mm256_broadcastsi128_si256(
+		_mm_loadu_si128((const __m128i *)table.nibble_lo[kind]));
+	const __m256i hi= _mm256_broadcastsi128_si256(
+		_mm_loadu_si128((const __m128i *)table.nibble_hi[kind]));
+	const __m256i bit= _mm256_setr_epi8(
+		1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128,
+		1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128);
+	const __m256i mask_nibble= _mm256_set1_epi8(0x0F);
+	while (p_end - p >= 32) {
+		const __m256i v= _mm256_loadu_si256((const __m256i *)p);
+		const __m256i v_lo= _mm256_and_si256(v, mask_nibble);
+		const __m256i v_hi= _mm256_and_si256(_mm256_srli_epi16(v, 4), mask_nibble);
+		const __m256i row= _mm256_blendv_epi8(
+			_mm256_shuffle_epi8(lo, v_lo),
+			_mm256_shuffle_epi8(hi, v_lo), v);
+		const __m256i b= _mm256_shuffle_epi8(bit, v_hi);
+		const unsigned bits= (unsigned)_mm256_movemask_epi8(
+			_mm256_cmpeq_epi8(_mm256_and_si256(row, b), b));
+		if (bits)
+			return p + __builtin_ctz(bits);
+		p += 32;
+	}
+	return skip_sse2(kind, p, p_end);
+}
+
+#endif /* USE_SIMD */
@@ -0,0 +1,100 @@
+#ifndef SCAN_HH
+#define SCAN_HH
+
+/*
+ * Scanning of the input of the tokenizer for the end of runs of characters of one class,
+ * e.g., for the end of a name, or for the next character with a special meaning in a
+ * command.  On x86, 16 bytes are classified at once using SSE2, or 32 bytes using AVX2
+ * when the CPU supports it, as determined at runtime.  Otherwise, and for the bytes at the
+ * end of the input, a lookup table is used.  When USE_SIMD is 0, only the lookup table is
+ * used, which is the case on other architectures.
+ */
+
+#include <stddef.h>
+
+#ifndef USE_SIMD
+#   if defined(__SSE2__) && defined(__GNUC__)
+#      define USE_SIMD 1
+#   else
+#      define USE_SIMD 0
+#   endif
+#endif
+
+#if USE_SIMD
+#   include <immintrin.h>
+#endif
+
+class Scan
+{
+public:
+	enum Kind {
+		K_NAME,     /* Characters that may appear unquoted in names */
+		K_BLANK,    /* Whitespace except newlines */
+		K_COMMAND,  /* Characters without special meaning in commands */
+		K_QUOTE,    /* Characters without special meaning in double quotes */
+		K_COUNT
+	};
+
+	static const char *skip(Kind kind, const char *p, const char *p_end) {
+		return impl(kind, p, p_end);
+	}
+	/* The first character at or after P that is not of the class KIND, or P_END */
+
+	static bool is(Kind kind, char c) {
+		return ! table.stop[kind][(unsigned char)c];
+	}
+
+	static const char *get_impl_name();
+	/* The name of the implementation used, e.g., "avx2" */
+
+private:
+	class Def
+	/* A class of characters, given by the characters that end a run */
+	{
+	public:
+		const char *chars;
+		size_t count;
+		bool controls;
+		/* Whether the characters 0x00 to 0x20 and 0x7F end a run, too */
+		bool invert;
+		/* CHARS and CONTROLS are the characters of the class instead */
+	};
+
+	static constexpr Def defs[K_COUNT]= {
+		{ "[]\"\':={}#<>@$;()%*\\!?|&,", 24, true,  false },
+		{ " \t\v\f\r",                    5, false, true  },
+		{ "{}\'\"\x60\\#()$\n",           11, false, false },
+		{ "\"$\\\n",                      5, false, false },
+		/* 0x60 is the backquote.  The last count includes the terminating '\0'. */
+	};
+
+	class Table
+	{
+	public:
+		bool stop[K_COUNT][256] {};
+
+		unsigned char nibble_lo[K_COUNT][16] {}, nibble_hi[K_COUNT][16] {};
+		/* For the AVX2 implementation:  bit B of NIBBLE_LO[L] is set when the
+		 * character 16 * B + L ends a run, and of NIBBLE_HI[L] when the character
+		 * 16 * (B + 8) + L does. */
+
+		constexpr Table();
+	};
+
+	static const Table table;
+
+	static const char *(*impl)(Kind, const char *, const char *);
+	/* Initially skip_init(), which replaces itself by the best implementation */
+
+	static const char *skip_init(Kind kind, const char *p, const char *p_end);
+	static const char *skip_table(Kind kind, const char *p, const char *p_end);
+
+#if USE_SIMD
+	static const char *skip_sse2(Kind kind, const char *p, const char *p_end);
+	template <Kind kind>
+	static const char *skip_sse2_kind(const char *p, const char *p_end);
+	static const char *skip_avx2(Kind kind, const char *p, const char *p_end);
+#endif
+};
+
+#endif /* ! SCAN_HH */
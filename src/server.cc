@@ -0,0 +1,632 @@
+#include "server.hh"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include "history.hh"
+#include "invocation.hh"
+#include "stat_cache.hh"
+#include "state_file.hh"
+
+volatile sig_atomic_t Server::pid_child= 0;
+int Server::fd_listen= -1;
+int Server::fd_report= -1;
+std::vector <Server::Request> Server::requests;
+std::vector <Server::Connection> Server::connections;
+int Server::fd_inotify= -1;
+std::unordered_map <string, int> Server::wds;
+Watch::Filenames_By_Wd Server::filenames_by_wd;
+string Server::filename_source;
+const int Server::signals_client[5]= { SIGTERM, SIGINT, SIGQUIT, SIGHUP, SIGUSR1 };
+const int Server::signals_server[4]= { SIGTERM, SIGINT, SIGQUIT, SIGHUP };
+
+void Server::forward(char **argv)
+{
+	TRACE_FUNCTION();
+
+	/* A jobserver given by file descriptors cannot be passed to the server */
+	const char *makeflags= getenv("MAKEFLAGS");
+	if (makeflags) {
+		const char *auth= strstr(makeflags, "--jobserver-auth=");
+		if (strstr(makeflags, "--jobserver-fds=")
+			|| (auth && isdigit((unsigned char)auth[17])))
+			return;
+	}
+	for (int i= 0; i < 3; ++i)
+		if (fcntl(i, F_GETFD) < 0)
+			return;
+
+	int fd= socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return;
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family= AF_UNIX;
+	strcpy(addr.sun_path, FILENAME_SOCKET);
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		close(fd);
+		return;
+	}
+	TRACE("Connected");
+
+	Header header= {0, 0, 0, 0, 0};
+	header.mask= umask(0);
+	umask(header.mask);
+	string strings;
+	for (char **a= argv; *a; ++a, ++header.argc)
+		strings.append(*a, strlen(*a) + 1);
+	for (char **e= environ; *e; ++e, ++header.envc)
+		strings.append(*e, strlen(*e) + 1);
+	header.size= strings.size();
+
+	const int fds[3]= {0, 1, 2};
+	struct iovec iov= {&header, sizeof(header)};
+	union {
+		char buffer[CMSG_SPACE(sizeof(fds))];
+		struct cmsghdr align;
+	} control;
+	memset(&control, 0, sizeof(control));
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov= &iov;
+	msg.msg_iovlen= 1;
+	msg.msg_control= control.buffer;
+	msg.msg_controllen= sizeof(control.buffer);
+	struct cmsghdr *cmsg= CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level= SOL_SOCKET;
+	cmsg->cmsg_type= SCM_RIGHTS;
+	cmsg->cmsg_len= CMSG_LEN(sizeof(fds));
+	memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+	ssize_t r;
+	while ((r= sendmsg(fd, &msg, MSG_NOSIGNAL)) < 0 && errno == EINTR) { }
+
+	int32_t pid;
+	if (r != sizeof(header) || ! send_all(fd, strings.data(), strings.size())
+		|| ! recv_all(fd, &pid, sizeof(pid)) || pid <= 0) {
+		close(fd);
+		return;
+	}
+	pid_child= pid;
+
+	struct sigaction act;
+	act.sa_handler= handler_client;
+	act.sa_flags= 0;
+	if (sigemptyset(&act.sa_mask)) {
+		print_errno("sigemptyset");
+		exit(ERR_FATAL);
+	}
+	for (int sig: signals_client) {
+		if (sigaction(sig, &act, nullptr)) {
+			print_errno("sigaction");
+			exit(ERR_FATAL);
+		}
+	}
+
+	int32_t status;
+	bool done= recv_all(fd, &status, sizeof(status)) && status >= 0;
+	close(fd);
+
+	act.sa_handler= SIG_DFL;
+	for (int sig: signals_client) {
+		if (sigaction(sig, &act, nullptr)) {
+			print_errno("sigaction");
+			exit(ERR_FATAL);
+		}
+	}
+	if (! done)
+		/* Declined by the child, or the server has gone away */
+		return;
+
+	TRACE("status= %s", frmt("%d", (int)status));
+	if (WIFSIGNALED(status))
+		raise(WTERMSIG(status));
+	exit(WIFEXITED(status) ? WEXITSTATUS(status) : ERR_FATAL);
+}
+
+void Server::run(const Invocation &invocation)
+{
+	TRACE_FUNCTION();
+	open_socket();
+
+	struct sigaction act;
+	act.sa_handler= handler_server;
+	act.sa_flags= 0;
+	if (sigemptyset(&act.sa_mask)) {
+		print_errno("sigemptyset");
+		error_exit();
+	}
+	for (int sig: signals_server) {
+		if (sigaction(sig, &act, nullptr)) {
+			print_errno("sigaction");
+			error_exit();
+		}
+	}
+
+#if USE_INOTIFY
+	fd_inotify= inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+#endif
+
+	print_out("Waiting for requests");
+	fflush(stdout);
+
+	std::vector <struct pollfd> pollfds;
+	std::vector <Request> requests_running;
+	while (fd_listen >= 0 || ! requests.empty()) {
+		pollfds.clear();
+		if (fd_listen >= 0)
+			pollfds.push_back({fd_listen, POLLIN, 0});
+		for (const Request &request: requests) {
+			pollfds.push_back({request.fd_report, POLLIN, 0});
+			pollfds.push_back({request.terminated ? -1 : request.fd, POLLIN, 0});
+		}
+		for (const Connection &connection: connections)
+			pollfds.push_back({connection.fd, POLLIN, 0});
+		if (poll(pollfds.data(), pollfds.size(), -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			print_errno("poll");
+			error_exit();
+		}
+
+		size_t offset= fd_listen >= 0;
+		size_t offset_connections= offset + 2 * requests.size();
+		requests_running.clear();
+		for (size_t i= 0; i < requests.size(); ++i) {
+			Request &request= requests[i];
+			if (pollfds[offset + 2 * i + 1].revents) {
+				/* The client never sends anything after the request, so
+				 * this means it has gone away */
+				TRACE("Client has gone away");
+				kill(request.pid, SIGTERM);
+				request.terminated= true;
+			}
+			if (pollfds[offset + 2 * i].revents) {
+				char buffer[1 << 14];
+				ssize_t size= read(request.fd_report, buffer, sizeof(buffer));
+				if (size > 0) {
+					request.report.append(buffer, size);
+				} else if (size == 0 || errno != EINTR) {
+					finish(request);
+					continue;
+				}
+			}
+			requests_running.push_back(std::move(request));
+		}
+		requests.swap(requests_running);
+
+		/* Backwards, such that erasing does not move the connections still to
+		 * be checked.  A connection is erased before its child is started, as
+		 * the child closes the others. */
+		for (size_t i= connections.size(); i-- > 0; ) {
+			if (! pollfds[offset_connections + i].revents)
+				continue;
+			int r= receive(connections[i]);
+			if (r == 0)
+				continue;
+			Connection connection= std::move(connections[i]);
+			connections.erase(connections.begin() + i);
+			if (r < 0)
+				close_connection(connection);
+			else
+				start(connection, invocation);
+		}
+
+		if (fd_listen >= 0 && pollfds[0].revents) {
+			int fd= accept4(fd_listen, nullptr, nullptr,
+				SOCK_CLOEXEC | SOCK_NONBLOCK);
+			if (fd >= 0)
+				connections.push_back(
+					Connection{fd, Header(), {-1, -1, -1}, 0, ""});
+		}
+	}
+
+	Watch::exec_again(filename_source);
+}
+
+void Server::decline()
+{
+	TRACE_FUNCTION();
+	char c= 'D';
+	ssize_t r= write(fd_report, &c, 1);
+	(void) r;
+	__gcov_dump();
+	_Exit(0);
+}
+
+void Server::open_socket()
+{
+	TRACE_FUNCTION();
+	if (! State_File::make_dir())
+		exit(ERR_FATAL);
+
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family= AF_UNIX;
+	strcpy(addr.sun_path, FILENAME_SOCKET);
+	fd_listen= socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd_listen < 0) {
+		print_errno("socket");
+		exit(ERR_FATAL);
+	}
+	if (bind(fd_listen, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		if (errno != EADDRINUSE) {
+			print_errno("bind", FILENAME_SOCKET);
+			exit(ERR_FATAL);
+		}
+		/* A socket on which nobody listens is left over from a server that was
+		 * killed */
+		int fd= socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		if (fd >= 0 && connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0) {
+			print_error(fmt("a server is already running on %s",
+				show(FILENAME_SOCKET)));
+			exit(ERR_FATAL);
+		}
+		if (fd >= 0)
+			close(fd);
+		if (unlink(FILENAME_SOCKET) < 0
+			|| bind(fd_listen, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+			print_errno("bind", FILENAME_SOCKET);
+			exit(ERR_FATAL);
+		}
+	}
+	/* Requests are performed with the permissions of the server */
+	if (chmod(FILENAME_SOCKET, 0600) < 0) {
+		print_errno("chmod", FILENAME_SOCKET);
+		unlink(FILENAME_SOCKET);
+		exit(ERR_FATAL);
+	}
+	if (listen(fd_listen, SOMAXCONN) < 0) {
+		print_errno("listen", FILENAME_SOCKET);
+		unlink(FILENAME_SOCKET);
+		exit(ERR_FATAL);
+	}
+}
+
+int Server::receive(Connection &connection)
+{
+	TRACE_FUNCTION();
+	ssize_t r;
+	if (connection.size_received == 0) {
+		/* The file descriptors come with the first byte */
+		struct iovec iov= {&connection.header, sizeof(connection.header)};
+		union {
+			char buffer[CMSG_SPACE(sizeof(connection.fds))];
+			struct cmsghdr align;
+		} control;
+		struct msghdr msg;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov= &iov;
+		msg.msg_iovlen= 1;
+		msg.msg_control= control.buffer;
+		msg.msg_controllen= sizeof(control.buffer);
+		r= recvmsg(connection.fd, &msg, MSG_CMSG_CLOEXEC);
+		struct cmsghdr *cmsg= r > 0 ? CMSG_FIRSTHDR(&msg) : nullptr;
+		if (cmsg && cmsg->cmsg_level == SOL_SOCKET
+			&& cmsg->cmsg_type == SCM_RIGHTS
+			&& cmsg->cmsg_len == CMSG_LEN(sizeof(connection.fds)))
+			memcpy(connection.fds, CMSG_DATA(cmsg), sizeof(connection.fds));
+	} else if (connection.size_received < sizeof(connection.header)) {
+		r= recv(connection.fd,
+			(char *)&connection.header + connection.size_received,
+			sizeof(connection.header) - connection.size_received, 0);
+	} else {
+		size_t pos= connection.size_received - sizeof(connection.header);
+		r= recv(connection.fd, &connection.strings[pos],
+			connection.strings.size() - pos, 0);
+	}
+	if (r < 0)
+		return errno == EINTR || errno == EAGAIN ? 0 : -1;
+	if (r == 0)
+		return -1;
+
+	bool had_header= connection.size_received >= sizeof(connection.header);
+	connection.size_received += r;
+	if (connection.size_received < sizeof(connection.header))
+		return 0;
+	if (! had_header) {
+		if (connection.fds[0] < 0 || connection.header.size == 0
+			|| connection.header.size > SIZE_REQUEST_MAX)
+			return -1;
+		connection.strings.resize(connection.header.size);
+	}
+	return connection.size_received
+		== sizeof(connection.header) + connection.strings.size();
+}
+
+void Server::start(Connection &connection, const Invocation &invocation)
+{
+	TRACE_FUNCTION();
+	const int fd= connection.fd;
+	const Header &header= connection.header;
+	const int *const fds= connection.fds;
+	string &strings= connection.strings;
+	std::vector <char *> argv, envp;
+	bool valid= strings.back() == '\0';
+	if (valid) {
+		for (size_t pos= 0; pos < strings.size(); pos += strlen(&strings[pos]) + 1)
+			(argv.size() < header.argc ? argv : envp).push_back(&strings[pos]);
+		valid= argv.size() == header.argc && envp.size() == header.envc
+			&& header.argc > 0;
+		argv.push_back(nullptr);
+		envp.push_back(nullptr);
+	}
+
+	/* Requests completed after the sources have changed are declined too */
+	if (fd_listen < 0)
+		valid= false;
+
+	if (valid && Watch::sources_changed(filename_source)) {
+		/* Decline this and all further requests, and execute Stu again when
+		 * the running requests are done */
+		TRACE("Source changed");
+		unlink(FILENAME_SOCKET);
+		close(fd_listen);
+		fd_listen= -1;
+		valid= false;
+	}
+
+	int fds_pipe[2]= {-1, -1};
+	if (valid && (pipe(fds_pipe) < 0
+			|| fcntl(fds_pipe[0], F_SETFD, FD_CLOEXEC) < 0
+			|| fcntl(fds_pipe[1], F_SETFD, FD_CLOEXEC) < 0)) {
+		print_errno("pipe");
+		valid= false;
+	}
+
+	pid_t pid= -1;
+	if (valid) {
+		update();
+		fflush(stdout);
+		pid= fork();
+		if (pid < 0) {
+			print_errno("fork");
+		} else if (pid == 0) {
+			close(fd);
+			close(fds_pipe[0]);
+			fd_report= fds_pipe[1];
+			serve(argv.data(), envp.data(), fds, header.mask, invocation);
+		}
+		close(fds_pipe[1]);
+	}
+	for (int i= 0; i < 3; ++i)
+		if (fds[i] >= 0)
+			close(fds[i]);
+
+	int32_t pid_sent= pid;
+	send_all(fd, &pid_sent, sizeof(pid_sent));
+	if (pid > 0) {
+		TRACE("pid= %s", frmt("%jd", (intmax_t)pid));
+		requests.push_back(Request{pid, fd, fds_pipe[0], "", false});
+	} else {
+		if (fds_pipe[0] >= 0)
+			close(fds_pipe[0]);
+		close(fd);
+	}
+}
+
+void Server::close_connection(Connection &connection)
+{
+	TRACE_FUNCTION();
+	close(connection.fd);
+	for (int fd: connection.fds)
+		if (fd >= 0)
+			close(fd);
+}
+
+void Server::finish(Request &request)
+{
+	TRACE_FUNCTION();
+	close(request.fd_report);
+	int status;
+	while (waitpid(request.pid, &status, 0) < 0) {
+		if (errno != EINTR) {
+			print_errno("waitpid");
+			error_exit();
+		}
+	}
+	bool declined= ! request.report.empty() && request.report[0] == 'D';
+	int32_t status_sent= declined ? -1 : status;
+	send_all(request.fd, &status_sent, sizeof(status_sent));
+	close(request.fd);
+
+	if (request.report.empty() || request.report[0] != 'A')
+		return;
+	std::vector <string> filenames;
+	for (size_t pos= 1; pos < request.report.size(); ) {
+		size_t end= request.report.find('\0', pos);
+		if (end == string::npos)
+			break;
+		filenames.push_back(request.report.substr(pos, end - pos));
+		pos= end + 1;
+	}
+	keep(filenames);
+}
+
+void Server::serve(char **argv, char **envp, const int *fds, mode_t mask,
+	const Invocation &invocation)
+{
+	TRACE_FUNCTION();
+	struct sigaction act;
+	act.sa_handler= SIG_DFL;
+	act.sa_flags= 0;
+	if (sigemptyset(&act.sa_mask)) {
+		print_errno("sigemptyset");
+		exit(ERR_FATAL);
+	}
+	for (int sig: signals_server) {
+		if (sigaction(sig, &act, nullptr)) {
+			print_errno("sigaction");
+			exit(ERR_FATAL);
+		}
+	}
+
+	close(fd_listen);
+	if (fd_inotify >= 0)
+		close(fd_inotify);
+	for (const Request &request: requests) {
+		close(request.fd);
+		close(request.fd_report);
+	}
+	for (Connection &connection: connections)
+		close_connection(connection);
+	for (int i= 0; i < 3; ++i) {
+		if (dup2(fds[i], i) < 0) {
+			print_errno("dup2");
+			exit(ERR_FATAL);
+		}
+	}
+	for (int i= 0; i < 3; ++i)
+		if (fds[i] > 2)
+			close(fds[i]);
+
+	/* Start like a new invocation of Stu with the given arguments and
+	 * environment */
+	environ= envp;
+	umask(mask);
+	program_name= argv[0];
+	setlocale(LC_CTYPE, "");
+	clearerr(stdout);
+	init_buffering();
+	reset_options();
+	Color::set();
+	set_env_options();
+	check_status();
+	Timestamp::startup= Timestamp::now();
+	Stat_Cache::reset_statistics();
+#ifdef __GLIBC__
+	optind= 0; /* Reinitializes GNU getopt() completely */
+#else
+	optind= 1;
+#endif
+	if (atexit(report)) {
+		print_errno("atexit");
+		exit(ERR_FATAL);
+	}
+
+	int argc= 0;
+	while (argv[argc])
+		++argc;
+	exit(Invocation::run(argc, argv, &invocation));
+}
+
+void Server::report()
+{
+	string buffer(1, 'A');
+	for (const string &filename: Stat_Cache::get_filenames())
+		buffer.append(filename.c_str(), filename.size() + 1);
+	for (size_t pos= 0; pos < buffer.size(); ) {
+		ssize_t r= write(fd_report, buffer.data() + pos, buffer.size() - pos);
+		if (r < 0 && errno == EINTR)
+			continue;
+		if (r <= 0)
+			/* Not an error:  the server only misses the files */
+			return;
+		pos += r;
+	}
+}
+
+void Server::update()
+{
+	TRACE_FUNCTION();
+#if USE_INOTIFY
+	if (fd_inotify < 0)
+		return;
+	std::vector <string> filenames_check;
+	bool check_all= false;
+	if (! Watch::wait_events(fd_inotify, 0, filenames_by_wd,
+			filenames_check, check_all))
+		return;
+	if (check_all) {
+		/* Start anew */
+		TRACE("Check all");
+		close(fd_inotify);
+		fd_inotify= inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+		wds.clear();
+		filenames_by_wd.clear();
+		Stat_Cache::invalidate_all();
+		return;
+	}
+	for (const string &filename: filenames_check)
+		Stat_Cache::invalidate(filename);
+#endif /* USE_INOTIFY */
+}
+
+void Server::keep(const std::vector <string> &filenames)
+{
+	TRACE_FUNCTION();
+#if USE_INOTIFY
+	if (fd_inotify < 0)
+		return;
+	for (const string &filename: filenames) {
+		string dir, name;
+		Watch::split(filename, dir, name);
+		auto i= wds.find(dir);
+		if (i == wds.end()) {
+			int wd= inotify_add_watch(fd_inotify, dir.c_str(), Watch::MASK_EVENTS);
+			i= wds.emplace(dir, wd).first;
+		}
+		if (i->second < 0)
+			continue;
+		/* The directory is watched before the file is stat'ed, such that no
+		 * change is lost.  Symbolic links are not kept, because the file
+		 * they point to may be in another directory. */
+		struct stat buf;
+		filenames_by_wd[i->second][name]= filename;
+		if (Stat_Cache::stat(filename.c_str(), &buf, true) == 0
+			&& S_ISLNK(buf.st_mode)) {
+			Stat_Cache::invalidate(filename);
+			continue;
+		}
+		Stat_Cache::stat(filename.c_str(), &buf, false);
+	}
+#else
+	(void) filenames;
+#endif /* ! USE_INOTIFY */
+}
+
+bool Server::send_all(int fd, const void *data, size_t size)
+{
+	for (size_t pos= 0; pos < size; ) {
+		ssize_t r= send(fd, (const char *)data + pos, size - pos, MSG_NOSIGNAL);
+		if (r < 0 && errno == EINTR)
+			continue;
+		if (r <= 0)
+			return false;
+		pos += r;
+	}
+	return true;
+}
+
+bool Server::recv_all(int fd, void *data, size_t size)
+{
+	for (size_t pos= 0; pos < size; ) {
+		ssize_t r= recv(fd, (char *)data + pos, size - pos, 0);
+		if (r < 0 && errno == EINTR)
+			continue;
+		if (r <= 0)
+			return false;
+		pos += r;
+	}
+	return true;
+}
+
+void Server::handler_client(int sig)
+{
+	int errno_save= errno;
+	kill(pid_child, sig);
+	errno= errno_save;
+}
+
+void Server::handler_server(int sig)
+{
+	int errno_save= errno;
+	if (fd_listen >= 0)
+		unlink(FILENAME_SOCKET);
+	signal(sig, SIG_DFL);
+	raise(sig);
+	errno= errno_save;
+}
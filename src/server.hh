@@ -0,0 +1,184 @@
+#ifndef SERVER_HH
+#define SERVER_HH
+
+/*
+ * Server mode (option -D):  A Stu process that has read the rules stays in the foreground
+ * and performs the builds of later invocations of Stu in the same directory, such that
+ * the rules are not read again for each invocation.  The server listens on the Unix
+ * domain socket .stu/server.  Each invocation of Stu first tries to connect to it.  When
+ * this succeeds, the invocation (the client) passes its arguments, its environment and
+ * its standard input, output and error output to the server, and only waits for the
+ * result.  When no server is running, or when the server declines the request, the
+ * invocation performs the build itself, as usual.
+ *
+ * For each request, the server forks a child process, which handles the request like a
+ * normal invocation of Stu, except that it uses the rules read by the server.  Requests
+ * are handled concurrently.  The server checks the Stu source files before each request:
+ * when one has changed, the request is declined, and the server executes itself again
+ * once the running requests are done, without accepting new ones in the meantime.  The
+ * child declines the request when its options -f and -F are not the same as those of
+ * the server.
+ *
+ * The children inherit the stat cache of the server.  When a child exits, it passes the
+ * names of the files in its stat cache to the server.  On Linux, the server watches the
+ * directories of those files using inotify, and calls stat() on the files itself.  Before
+ * each request, the files in which something happened are invalidated in the stat cache,
+ * such that children only call stat() on files that may have changed.  Symbolic links,
+ * and files in directories that cannot be watched, are not kept.  When a parent directory
+ * of a watched directory is renamed, this is not noticed.  Without inotify, only the
+ * rules are kept.
+ *
+ * The termination signals and SIGUSR1 received by the client are passed on to the child.
+ * When the child is killed by a signal, the client kills itself with the same signal.
+ * When the client goes away, the child is terminated with SIGTERM.  Interactive mode
+ * (-i) is not available for requests, because the server has no controlling terminal.
+ * Jobservers given by file descriptors in $MAKEFLAGS cannot be passed to the server;
+ * invocations using one do not use the server.
+ *
+ * Protocol:  The client sends a Header, together with its file descriptors 0, 1 and 2
+ * as ancillary data, and then the arguments and the environment as \0-terminated
+ * strings.  The header contains the umask of the client, which the child sets.  The
+ * server reads requests without blocking, such that a client that stalls while sending
+ * its request does not delay the others.  The server answers with the process ID of the child as an int32_t, and when
+ * the child has exited, with its wait status as an int32_t.  Both are -1 when the
+ * request is declined.  Through a pipe, the child passes to the server the character
+ * 'D' when it declines the request, or otherwise, when it exits, the character 'A'
+ * followed by the \0-terminated filenames from its stat cache.
+ */
+
+#include <signal.h>
+#include <sys/types.h>
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "watch.hh"
+
+class Invocation;
+
+class Server
+{
+public:
+	static void forward(char **argv);
+	/* Called at the start of each invocation of Stu.  When a server is running in
+	 * the current directory and accepts the request, let it perform the build, and
+	 * exit with its exit status.  Otherwise, return. */
+
+	[[noreturn]]
+	static void run(const Invocation &invocation);
+	/* Run the server, using the rules read by INVOCATION */
+
+	[[noreturn]]
+	static void decline();
+	/* Called by the child when the request cannot be handled using the rules of the
+	 * server */
+
+	static constexpr const char *FILENAME_SOCKET= ".stu/server";
+
+private:
+	static constexpr size_t SIZE_REQUEST_MAX= 1 << 26;
+	/* Larger requests are rejected */
+
+	struct Header {
+		uint32_t argc, envc;
+		uint64_t size;
+		/* Of the strings that follow */
+		uint32_t mask;
+		/* The umask of the client */
+		uint32_t unused;
+	};
+
+	struct Connection {
+		int fd;
+		/* Nonblocking */
+		Header header;
+		int fds[3];
+		/* The file descriptors of the client; -1 when not yet received */
+		size_t size_received;
+		/* Of the header and the strings */
+		std::string strings;
+	};
+
+	struct Request {
+		pid_t pid;
+		int fd;
+		/* The connection to the client */
+		int fd_report;
+		/* The read end of the pipe from the child; -1 when closed */
+		std::string report;
+		bool terminated;
+		/* Whether the client has gone away and the child was sent SIGTERM */
+	};
+
+	static const int signals_client[5];
+	/* The signals passed on to the child by the client */
+
+	static const int signals_server[4];
+	/* The signals on which the server removes its socket */
+
+	static volatile sig_atomic_t pid_child;
+	/* In the client:  the process ID of the child in the server */
+
+	static int fd_listen;
+	/* In the server; -1 after the server has stopped accepting requests */
+
+	static int fd_report;
+	/* In the child:  the write end of the pipe to the server */
+
+	static std::vector <Request> requests;
+	/* In the server:  the running requests */
+
+	static std::vector <Connection> connections;
+	/* In the server:  the accepted connections whose request is not yet complete */
+
+	static int fd_inotify;
+	static std::unordered_map <std::string, int> wds;
+	/* Watch descriptors by directory; -1 when the directory could not be watched */
+	static Watch::Filenames_By_Wd filenames_by_wd;
+	/* In the server:  the files kept in the stat cache */
+
+	static std::string filename_source;
+	/* The changed Stu source file, once the server has stopped accepting requests */
+
+	static void open_socket();
+	/* Create the socket and listen on it */
+
+	static int receive(Connection &connection);
+	/* Read what is available of the request.  Return 1 when the request is
+	 * complete, 0 when more is to come, and -1 on error, in which case the
+	 * connection is to be closed. */
+
+	static void start(Connection &connection, const Invocation &invocation);
+	/* Start the child for the complete request, and close the file descriptors of
+	 * the client */
+
+	static void close_connection(Connection &connection);
+
+	static void finish(Request &request);
+	/* The child has exited */
+
+	[[noreturn]]
+	static void serve(char **argv, char **envp, const int *fds, mode_t mask,
+		const Invocation &invocation);
+	/* In the child process */
+
+	static void report();
+	/* Called at exit in the child */
+
+	static void update();
+	/* Invalidate the files that may have changed in the stat cache */
+
+	static void keep(const std::vector <std::string> &filenames);
+	/* Watch the given files, and keep them in the stat cache */
+
+	static bool send_all(int fd, const void *data, size_t size);
+	static bool recv_all(int fd, void *data, size_t size);
+	/* Return false on error or end of file */
+
+	static void handler_client(int sig);
+	static void handler_server(int sig);
+	/* [ASYNC-SIGNAL-SAFE] */
+};
+
+#endif /* ! SERVER_HH */
@@ -5,6 +5,7 @@ bool Signal_Blocker::blocked= false;
 #endif
 
 sigset_t set_termination, set_productive, set_termination_productive;
+sigset_t set_child;
 volatile sig_atomic_t in_child= 0;
 
 Signal_Blocker::Signal_Blocker()
@@ -96,6 +97,10 @@ void init_signals()
 		print_errno("sigemptyset");
 		exit(ERR_FATAL);
 	}
+	if (0 != sigprocmask(SIG_BLOCK, nullptr, &set_child)) {
+		print_errno("sigprocmask");
+		exit(ERR_FATAL);
+	}
 
 	/*
 	 * Termination signals
@@ -130,6 +135,10 @@ void init_signals()
 			print_errno("sigaddset");
 			exit(ERR_FATAL);
 		}
+		if (0 != sigdelset(&set_child, signals_termination[i])) {
+			print_errno("sigdelset");
+			exit(ERR_FATAL);
+		}
 	}
 
 	/*
@@ -174,6 +183,10 @@ void init_signals()
 		print_errno("sigaddset");
 		exit(ERR_FATAL);
 	}
+	if (0 != sigdelset(&set_child, SIGCHLD) || 0 != sigdelset(&set_child, SIGUSR1)) {
+		print_errno("sigdelset");
+		exit(ERR_FATAL);
+	}
 	if (0 != sigprocmask(SIG_BLOCK, &set_productive, nullptr)) {
 		print_errno("sigprocmask");
 		exit(ERR_FATAL);
@@ -55,6 +55,11 @@
 
 extern sigset_t set_termination, set_productive, set_termination_productive;
 
+extern sigset_t set_child;
+/* The signal mask for child processes:  the mask with which Stu was started, without the
+ * termination and productive signals.  Used with posix_spawn(), which sets the mask of
+ * the child instead of unblocking signals in it. */
+
 extern volatile sig_atomic_t in_child;
 /* Set to 1 in the child process, before execve() is called; 0 in the parent process.
  * Used to avoid doing too much in the terminating signal handler.  Note: There is a race
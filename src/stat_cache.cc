@@ -0,0 +1,297 @@
+#include "stat_cache.hh"
+
+#include <fcntl.h>
+
+#include "worker.hh"
+
+std::unordered_map <string, Stat_Cache::Entry> Stat_Cache::entries;
+std::map <string, Stat_Cache::Fd_Dir> Stat_Cache::fds_dir;
+size_t Stat_Cache::generation= 0;
+size_t Stat_Cache::count_hits= 0;
+size_t Stat_Cache::count_misses= 0;
+size_t Stat_Cache::count_prefetched= 0;
+pthread_mutex_t Stat_Cache::mutex;
+pthread_cond_t Stat_Cache::cond_queue;
+pthread_cond_t Stat_Cache::cond_done;
+size_t Stat_Cache::count_threads= 0;
+size_t Stat_Cache::count_idle= 0;
+size_t Stat_Cache::id_next= 0;
+std::deque <string> *Stat_Cache::queue= nullptr;
+std::unordered_map <string, Stat_Cache::Prefetch> *Stat_Cache::prefetches= nullptr;
+
+int Stat_Cache::stat(const char *filename, struct stat *buf, bool no_follow)
+{
+	TRACE_FUNCTION();
+	auto i= entries.find(filename);
+	if (i == entries.end()) {
+		Entry entry;
+		entry.results[0].errnum= -1;
+		entry.results[1].errnum= -1;
+		i= entries.emplace(filename, entry).first;
+	}
+	Result &result= i->second.results[no_follow];
+
+	if (get_errnum(result) < 0) {
+		++count_misses;
+		if (! no_follow && take_prefetch(filename, result)) {
+			++count_prefetched;
+			TRACE("Prefetched");
+		} else {
+			int r= stat_relative(filename, &result.buf, no_follow);
+			result.errnum= r ? errno : 0;
+		}
+		result.generation= generation;
+		assert(result.errnum >= 0);
+	} else {
+		++count_hits;
+		TRACE("Cached");
+	}
+
+	if (result.errnum) {
+		errno= result.errnum;
+		return -1;
+	}
+	*buf= result.buf;
+	return 0;
+}
+
+void Stat_Cache::prefetch(const std::vector <string> &filenames)
+{
+	if (filenames.size() < SIZE_BATCH_MIN)
+		return;
+
+	if (! queue) {
+		Worker::init(&mutex, &cond_queue, &cond_done);
+		queue= new std::deque <string>;
+		prefetches= new std::unordered_map <string, Prefetch>;
+	}
+
+	pthread_mutex_lock(&mutex);
+	for (const string &filename: filenames) {
+		auto i= entries.find(filename);
+		if (i != entries.end() && get_errnum(i->second.results[0]) >= 0)
+			continue;
+		auto j= prefetches->emplace(filename, Prefetch{Prefetch_State::QUEUED,
+			id_next, generation, Result()});
+		if (! j.second) {
+			/* Queue again a prefetch from an earlier generation that may
+			 * fail, such that its result is valid */
+			Prefetch &prefetch= j.first->second;
+			if (prefetch.generation == generation
+				|| (prefetch.state == Prefetch_State::DONE
+					&& prefetch.result.errnum == 0))
+				continue;
+			prefetch= Prefetch{Prefetch_State::QUEUED, id_next, generation,
+				Result()};
+		}
+		++id_next;
+		queue->push_back(filename);
+	}
+	size_t count_start= 0;
+	if (queue->size() > count_idle)
+		count_start= std::min(queue->size() - count_idle,
+			COUNT_THREADS_MAX - count_threads);
+	pthread_cond_broadcast(&cond_queue);
+	pthread_mutex_unlock(&mutex);
+
+	while (count_start--)
+		start_thread();
+}
+
+void Stat_Cache::invalidate(const string &filename)
+{
+	TRACE_FUNCTION();
+	TRACE("filename= '%s'", filename);
+	entries.erase(filename);
+	auto i= fds_dir.find(filename);
+	if (i != fds_dir.end()) {
+		if (i->second.fd >= 0)
+			close(i->second.fd);
+		fds_dir.erase(i);
+	}
+	const string prefix= filename + '/';
+	for (i= fds_dir.lower_bound(prefix);
+		i != fds_dir.end() && ! i->first.compare(0, prefix.size(), prefix); ) {
+		if (i->second.fd >= 0)
+			close(i->second.fd);
+		i= fds_dir.erase(i);
+	}
+	if (prefetches) {
+		pthread_mutex_lock(&mutex);
+		prefetches->erase(filename);
+		pthread_mutex_unlock(&mutex);
+	}
+}
+
+void Stat_Cache::invalidate_missing()
+{
+	/* Failures and prefetches from earlier generations are ignored when they are
+	 * used, and directories are opened again when stat() fails */
+	++generation;
+}
+
+void Stat_Cache::invalidate_all()
+{
+	TRACE_FUNCTION();
+	entries.clear();
+	close_fds_dir();
+	if (prefetches) {
+		pthread_mutex_lock(&mutex);
+		prefetches->clear();
+		pthread_mutex_unlock(&mutex);
+	}
+}
+
+std::vector <string> Stat_Cache::get_filenames()
+{
+	std::vector <string> ret;
+	ret.reserve(entries.size());
+	for (const auto &i: entries)
+		if (get_errnum(i.second.results[0]) >= 0
+			|| get_errnum(i.second.results[1]) >= 0)
+			ret.push_back(i.first);
+	return ret;
+}
+
+void Stat_Cache::print_statistics()
+{
+	printf("STATISTICS  stat cache = %zu hits, %zu misses\n",
+	       count_hits, count_misses);
+	printf("STATISTICS  stat calls prefetched = %zu\n", count_prefetched);
+}
+
+void Stat_Cache::reset_statistics()
+{
+	count_hits= 0;
+	count_misses= 0;
+	count_prefetched= 0;
+}
+
+int Stat_Cache::stat_relative(const char *filename, struct stat *buf, bool no_follow)
+{
+	int flags= no_follow ? AT_SYMLINK_NOFOLLOW : 0;
+	const char *slash= strrchr(filename, '/');
+	if (! slash || slash == filename || slash[1] == '\0')
+		return fstatat(AT_FDCWD, filename, buf, flags);
+	const string dir(filename, slash - filename);
+	const Fd_Dir *fd_dir= &get_fd_dir(dir, false);
+	if (fd_dir->fd < 0 && fd_dir->generation != generation)
+		fd_dir= &get_fd_dir(dir, true);
+	if (fd_dir->fd < 0)
+		/* Let fstatat() report the error */
+		return fstatat(AT_FDCWD, filename, buf, flags);
+	int r= fstatat(fd_dir->fd, slash + 1, buf, flags);
+	if (r == 0 || fd_dir->generation == generation)
+		return r;
+	/* The directory may have been replaced by a job */
+	fd_dir= &get_fd_dir(dir, true);
+	if (fd_dir->fd < 0)
+		return fstatat(AT_FDCWD, filename, buf, flags);
+	return fstatat(fd_dir->fd, slash + 1, buf, flags);
+}
+
+const Stat_Cache::Fd_Dir &Stat_Cache::get_fd_dir(const string &dir, bool reopen)
+{
+	auto i= fds_dir.find(dir);
+	if (i != fds_dir.end()) {
+		if (! reopen || i->second.generation == generation)
+			return i->second;
+		if (i->second.fd >= 0)
+			close(i->second.fd);
+		fds_dir.erase(i);
+	}
+	if (fds_dir.size() >= COUNT_FDS_DIR_MAX)
+		close_fds_dir();
+#ifdef O_PATH
+	int fd= open(dir.c_str(), O_PATH | O_DIRECTORY | O_CLOEXEC);
+#else
+	int fd= open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+#endif
+	return fds_dir[dir]= Fd_Dir{fd, generation};
+}
+
+void Stat_Cache::close_fds_dir()
+{
+	for (const auto &i: fds_dir)
+		if (i.second.fd >= 0)
+			close(i.second.fd);
+	fds_dir.clear();
+}
+
+bool Stat_Cache::take_prefetch(const char *filename, Result &result)
+{
+	if (! prefetches)
+		return false;
+	pthread_mutex_lock(&mutex);
+	auto i= prefetches->find(filename);
+	while (i != prefetches->end() && i->second.state == Prefetch_State::RUNNING) {
+		pthread_cond_wait(&cond_done, &mutex);
+		i= prefetches->find(filename);
+	}
+	bool found= i != prefetches->end() && i->second.state == Prefetch_State::DONE
+		&& (i->second.result.errnum == 0 || i->second.generation == generation);
+	if (found)
+		result= i->second.result;
+	/* A queued prefetch is skipped by the worker threads when it is not found */
+	if (i != prefetches->end())
+		prefetches->erase(i);
+	pthread_mutex_unlock(&mutex);
+	return found;
+}
+
+void Stat_Cache::start_thread()
+{
+	TRACE_FUNCTION();
+	if (Worker::start(run))
+		/* Not an error:  files that are not prefetched are stat'ed by the main
+		 * thread */
+		return;
+	pthread_mutex_lock(&mutex);
+	++count_threads;
+	pthread_mutex_unlock(&mutex);
+}
+
+void *Stat_Cache::run(void *)
+{
+	std::vector <std::pair <string, size_t> > chunk;
+	std::vector <Result> results;
+	pthread_mutex_lock(&mutex);
+	while (true) {
+		while (queue->empty()) {
+			++count_idle;
+			pthread_cond_wait(&cond_queue, &mutex);
+			--count_idle;
+		}
+		/* Take several files at once to lock the mutex less often */
+		chunk.clear();
+		while (! queue->empty() && chunk.size() < SIZE_CHUNK) {
+			string filename= std::move(queue->front());
+			queue->pop_front();
+			auto i= prefetches->find(filename);
+			if (i == prefetches->end()
+				|| i->second.state != Prefetch_State::QUEUED)
+				continue;
+			i->second.state= Prefetch_State::RUNNING;
+			chunk.emplace_back(std::move(filename), i->second.id);
+		}
+		pthread_mutex_unlock(&mutex);
+
+		results.resize(chunk.size());
+		for (size_t k= 0; k < chunk.size(); ++k) {
+			int r= fstatat(AT_FDCWD, chunk[k].first.c_str(),
+				&results[k].buf, 0);
+			results[k].errnum= r ? errno : 0;
+		}
+
+		pthread_mutex_lock(&mutex);
+		for (size_t k= 0; k < chunk.size(); ++k) {
+			auto i= prefetches->find(chunk[k].first);
+			if (i != prefetches->end() && i->second.id == chunk[k].second) {
+				i->second.state= Prefetch_State::DONE;
+				i->second.result= results[k];
+			}
+		}
+		if (! chunk.empty())
+			pthread_cond_broadcast(&cond_done);
+	}
+}
@@ -0,0 +1,163 @@
+#ifndef STAT_CACHE_HH
+#define STAT_CACHE_HH
+
+/*
+ * Cache of the results of stat() and lstat() on files, valid for one invocation of Stu.
+ * Each file is stat'ed at most once (for each of stat() and lstat()), regardless of how
+ * many executors check it, unless it is invalidated.  Failures, in particular ENOENT,
+ * are cached too.
+ *
+ * Entries are invalidated when Stu changes the file itself, and when a job that has the
+ * file as a target finishes.  Since commands may create files they do not declare as
+ * targets, all cached failures are forgotten whenever a job finishes.  For this, each
+ * failure is stored with the generation in which it was seen, and the generation is
+ * incremented when a job finishes, such that this takes constant time.  Files without a
+ * command are always stat'ed anew when checked after their dependencies, because they
+ * are expected to be changed by the commands of other rules.
+ *
+ * Files that are likely to be checked soon, i.e., the targets and dependencies of a
+ * newly created executor, are prefetched when there are many of them:  they are passed
+ * as one batch to a small pool of worker threads, which call stat() on them while the
+ * main thread goes on expanding the dependency graph.  When the main thread needs a file
+ * whose prefetch has not been started yet, it calls stat() itself; when the prefetch is
+ * running, it waits for it.  Prefetched results are subject to the same invalidation as
+ * cached ones; a failure is valid only when the prefetch was queued in the current
+ * generation.  Worker threads block all signals.  Only stat() is prefetched, not
+ * lstat().
+ *
+ * In the main thread, files in a directory are stat'ed relative to a file descriptor of
+ * the directory, such that the kernel does not resolve the whole path for every file.
+ * These file descriptors are opened with O_PATH, and cached by the directory part of the
+ * (canonicalized) filename.  Since jobs may replace directories, the file descriptors of
+ * a file and of the directories below it are closed when the file is invalidated, e.g.
+ * when it is a target of a finished job.  Directories replaced by jobs that do not
+ * declare them are caught when stat() fails:  the directory is then opened again when
+ * its file descriptor is from an earlier generation, and stat() is retried.
+ */
+
+#include <sys/stat.h>
+
+#include <deque>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <pthread.h>
+
+class Stat_Cache
+{
+public:
+	static int stat(const char *filename, struct stat *buf, bool no_follow);
+	/* Same semantics as fstatat() with AT_FDCWD:  Returns 0/-1, and sets ERRNO on
+	 * failure */
+
+	static void prefetch(const std::vector <std::string> &filenames);
+	/* Start stat() on the given files in the background, if there are enough of
+	 * them.  Files that are already cached or being prefetched are skipped. */
+
+	static void invalidate(const std::string &filename);
+	/* The file may have changed, or have been replaced by a directory */
+
+	static void invalidate_missing();
+	/* Files may have been created, and directories may have been replaced.  Takes
+	 * constant time. */
+
+	static void invalidate_all();
+	/* Any file may have changed */
+
+	static std::vector <std::string> get_filenames();
+	/* All files for which a result is cached */
+
+	static void print_statistics();
+
+	static void reset_statistics();
+	/* Used in the children of the server */
+
+	friend class Journal;
+
+private:
+	struct Result {
+		int errnum;
+		/* 0 when the call succeeded; -1 when unknown */
+		size_t generation;
+		/* Set when ERRNUM is >0 */
+		struct stat buf;
+		/* Set when ERRNUM is 0 */
+	};
+
+	struct Entry {
+		Result results[2];
+		/* Indexed by NO_FOLLOW */
+	};
+
+	enum class Prefetch_State { QUEUED, RUNNING, DONE };
+
+	struct Prefetch {
+		Prefetch_State state;
+		size_t id;
+		/* Distinguishes prefetches of the same file after invalidation */
+		size_t generation;
+		/* When the prefetch was queued */
+		Result result;
+		/* Set in state DONE */
+	};
+
+	struct Fd_Dir {
+		int fd;
+		/* -1 when the directory cannot be opened */
+		size_t generation;
+		/* When the directory was opened */
+	};
+
+	static constexpr size_t COUNT_THREADS_MAX= 4;
+	static constexpr size_t SIZE_BATCH_MIN= 16;
+	/* Smaller batches are not prefetched, because passing them to another thread
+	 * costs more than calling stat() when the file status is in the kernel's cache */
+	static constexpr size_t SIZE_CHUNK= 32;
+	/* The number of files taken by a worker thread at once */
+
+	static constexpr size_t COUNT_FDS_DIR_MAX= 256;
+
+	static std::unordered_map <std::string, Entry> entries;
+	static std::map <std::string, Fd_Dir> fds_dir;
+	/* Ordered, such that the directories below a directory are found quickly */
+	static size_t generation;
+	/* Incremented by invalidate_missing() */
+	static size_t count_hits, count_misses, count_prefetched;
+	/* Only accessed from the main thread */
+
+	static pthread_mutex_t mutex;
+	static pthread_cond_t cond_queue, cond_done;
+	/* Signaled when the queue is not empty, and when a prefetch is done */
+	static size_t count_threads, count_idle, id_next;
+	static std::deque <std::string> *queue;
+	static std::unordered_map <std::string, Prefetch> *prefetches;
+	/* Protected by MUTEX.  Allocated at the first prefetch and never freed, such that
+	 * worker threads can still access them while the process exits. */
+
+	static int stat_relative(const char *filename, struct stat *buf, bool no_follow);
+	/* Like fstatat(AT_FDCWD, ...), but relative to the directory of the file */
+
+	static int get_errnum(const Result &result) {
+		return result.errnum > 0 && result.generation != generation
+			? -1 : result.errnum;
+	}
+	/* The error number of RESULT, or -1 when a failure is from an earlier
+	 * generation */
+
+	static const Fd_Dir &get_fd_dir(const std::string &dir, bool reopen);
+	/* FD is -1 when the directory cannot be opened.  With REOPEN, a cached file
+	 * descriptor from an earlier generation is replaced. */
+
+	static void close_fds_dir();
+
+	static bool take_prefetch(const char *filename, Result &result);
+	/* Whether RESULT was set from a prefetch, waiting for it if running */
+
+	static void start_thread();
+	static void *run(void *);
+	/* The main function of worker threads */
+};
+
+#endif /* ! STAT_CACHE_HH */
@@ -0,0 +1,143 @@
+#include "state_file.hh"
+
+#include <fcntl.h>
+
+#include "error.hh"
+#include "format.hh"
+#include "history.hh"
+
+bool State_File::make_dir()
+{
+	if (mkdir(DIRNAME_STATE, 0777) < 0 && errno != EEXIST) {
+		print_errno("mkdir", DIRNAME_STATE);
+		return false;
+	}
+	return true;
+}
+
+bool State_File::read(const char *filename, string &content)
+{
+	int fd= open(filename, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		if (errno != ENOENT)
+			print_errno("open", filename);
+		return false;
+	}
+	char buffer[1 << 16];
+	ssize_t r;
+	while ((r= ::read(fd, buffer, sizeof(buffer))) != 0) {
+		if (r < 0 && errno == EINTR)
+			continue;
+		if (r < 0) {
+			print_errno("read", filename);
+			close(fd);
+			return false;
+		}
+		content.append(buffer, r);
+	}
+	close(fd);
+	return true;
+}
+
+bool State_File::write(const char *filename, const string &buffer, int flags)
+{
+	int fd= open(filename, O_WRONLY | O_CREAT | O_CLOEXEC | flags, 0666);
+	if (fd < 0) {
+		print_errno("open", filename);
+		return false;
+	}
+	ssize_t r;
+	do r= ::write(fd, buffer.data(), buffer.size());
+	while (r < 0 && errno == EINTR);
+	if (r >= 0 && (size_t)r != buffer.size())
+		/* Not set by write() */
+		errno= ENOSPC;
+	if (r < 0 || (size_t)r != buffer.size()) {
+		print_errno("write", filename);
+		close(fd);
+		if (! (flags & O_APPEND))
+			unlink(filename);
+		return false;
+	}
+	if (close(fd) < 0) {
+		print_errno("close", filename);
+		if (! (flags & O_APPEND))
+			unlink(filename);
+		return false;
+	}
+	return true;
+}
+
+bool State_File::replace(const char *filename, const string &buffer)
+{
+	string filename_tmp= frmt("%s.%jd", filename, (intmax_t)getpid());
+	if (! write(filename_tmp.c_str(), buffer, O_TRUNC))
+		return false;
+	if (rename(filename_tmp.c_str(), filename) < 0) {
+		print_errno("rename", filename_tmp);
+		unlink(filename_tmp.c_str());
+		return false;
+	}
+	return true;
+}
+
+void State_File::append_number(string &buffer, uint64_t number)
+{
+	while (number >= 0x80) {
+		buffer += (char)(number | 0x80);
+		number >>= 7;
+	}
+	buffer += (char)number;
+}
+
+void State_File::append_string(string &buffer, const string &text)
+{
+	append_number(buffer, text.size());
+	buffer += text;
+}
+
+void State_File::append_fingerprint(string &buffer, const Fingerprint &fingerprint)
+{
+	append_number(buffer, fingerprint.sec);
+	append_number(buffer, fingerprint.nsec);
+	append_number(buffer, fingerprint.size);
+	append_number(buffer, fingerprint.dev);
+	append_number(buffer, fingerprint.ino);
+}
+
+bool State_File::parse_number(const char *&p, const char *end, uint64_t &number)
+{
+	number= 0;
+	for (unsigned shift= 0; p < end && shift < 64; shift += 7) {
+		unsigned char c= *p++;
+		number |= (uint64_t)(c & 0x7f) << shift;
+		if (! (c & 0x80))
+			return true;
+	}
+	return false;
+}
+
+bool State_File::parse_string(const char *&p, const char *end, string &text)
+{
+	uint64_t size;
+	if (! parse_number(p, end, size) || size > (uint64_t)(end - p))
+		return false;
+	text.assign(p, size);
+	p += size;
+	return true;
+}
+
+bool State_File::parse_fingerprint(const char *&p, const char *end,
+	Fingerprint &fingerprint)
+{
+	uint64_t sec, nsec;
+	if (! parse_number(p, end, sec)
+		|| ! parse_number(p, end, nsec)
+		|| ! parse_number(p, end, fingerprint.size)
+		|| ! parse_number(p, end, fingerprint.dev)
+		|| ! parse_number(p, end, fingerprint.ino))
+		return false;
+	fingerprint.sec= sec;
+	fingerprint.nsec= nsec;
+	return true;
+}
@@ -0,0 +1,49 @@
+#ifndef STATE_FILE_HH
+#define STATE_FILE_HH
+
+/*
+ * The reading and writing of the files that Stu keeps in the directory .stu, i.e., the
+ * build log, the journal record, the rule cache and the history.  The binary files among
+ * them use the same encoding:  numbers are stored with seven bits per byte, beginning
+ * with the lowest bits, and with the highest bit set in all bytes except the last;
+ * strings are stored as their length followed by their characters.
+ *
+ * Files that are replaced as a whole are written into a temporary file that is then
+ * renamed, such that concurrent invocations of Stu never see a partially written file.
+ */
+
+#include <string>
+
+#include "build_log.hh"
+
+class State_File
+{
+public:
+	static bool make_dir();
+	/* Create the directory .stu when it does not exist.  Return FALSE on error,
+	 * which has been output. */
+
+	static bool read(const char *filename, std::string &content);
+	/* Read the whole file into CONTENT.  Return FALSE when the file does not exist,
+	 * or on error, which has been output. */
+
+	static bool write(const char *filename, const std::string &buffer, int flags);
+	/* Write BUFFER into FILENAME using a single write(), with the given additional
+	 * flags for open().  Return FALSE on error, which has been output. */
+
+	static bool replace(const char *filename, const std::string &buffer);
+	/* Replace FILENAME by a file containing BUFFER, through a temporary file.
+	 * Return FALSE on error, which has been output. */
+
+	static void append_number(std::string &buffer, uint64_t number);
+	static void append_string(std::string &buffer, const std::string &text);
+	static void append_fingerprint(std::string &buffer, const Fingerprint &fingerprint);
+
+	static bool parse_number(const char *&p, const char *end, uint64_t &number);
+	static bool parse_string(const char *&p, const char *end, std::string &text);
+	static bool parse_fingerprint(const char *&p, const char *end,
+		Fingerprint &fingerprint);
+	/* Return FALSE when the data is incomplete */
+};
+
+#endif /* ! STATE_FILE_HH */
@@ -8,11 +8,17 @@
 using std::string;
 using std::shared_ptr;
 
+#include "arena.cc"
+#include "artifact_cache.cc"
 #include "buffer.cc"
 #include "buffering.cc"
+#include "build_log.cc"
 #include "canonicalize.cc"
 #include "color.cc"
 #include "concat_executor.cc"
+#include "concurrency.cc"
+#include "content_hash.cc"
+#include "copier.cc"
 #include "cycle.cc"
 #include "dep.cc"
 #include "done.cc"
@@ -25,24 +31,33 @@ using std::shared_ptr;
 #include "format.cc"
 #include "hash_dep.cc"
 #include "hints.cc"
+#include "history.cc"
 #include "invocation.cc"
 #include "job.cc"
+#include "journal.cc"
 #include "job_list.cc"
+#include "jobserver.cc"
 #include "name.cc"
 #include "options.cc"
 #include "parser.cc"
 #include "place.cc"
 #include "placed_flags.cc"
+#include "pool.cc"
 #include "preset.cc"
 #include "proceed.cc"
 #include "root_executor.cc"
 #include "rule.cc"
+#include "rule_cache.cc"
+#include "scan.cc"
+#include "server.cc"
 #include "show.cc"
 #include "show_dep.cc"
 #include "show_flags.cc"
 #include "show_option.cc"
 #include "signal.cc"
+#include "stat_cache.cc"
 #include "state.cc"
+#include "state_file.cc"
 #include "target.cc"
 #include "timestamp.cc"
 #include "token.cc"
@@ -50,6 +65,8 @@ using std::shared_ptr;
 #include "trace.cc"
 #include "trace_executor.cc"
 #include "transitive_executor.cc"
+#include "watch.cc"
+#include "worker.cc"
 
 int main(int argc, char **argv)
 {
@@ -60,23 +77,6 @@ int main(int argc, char **argv)
 	Color::set();
 	set_env_options();
 	check_status();
-	int error= 0;
-
-	try {
-		Invocation invocation(argc, argv, error);
-		invocation.main_loop();
-	} catch (int e) {
-		assert(e >= 1 && e <= 3);
-		error= e;
-	}
-
-	if (option_z)
-		Job::print_statistics();
-	if (fclose(stdout)) {
-		print_errno("fclose", "<stdout>");
-		exit(ERR_FATAL);
-	}
-	/* No need to flush stderr, because it is line buffered, and if we used it, it
-	 * means there was an error anyway, so we're not losing any information. */
-	exit(error);
+	Server::forward(argv);
+	exit(Invocation::run(argc, argv, nullptr));
 }
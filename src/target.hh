@@ -76,6 +76,11 @@ public:
 		  placed_name(that.placed_name),
 		  place(that.place) { }
 
+	Placed_Target(Placed_Target &&that)
+		: flags(that.flags),
+		  placed_name(std::move(that.placed_name)),
+		  place(std::move(that.place)) { }
+
 	bool equals_same_length(const Placed_Target &that) const
 	/* Compare, assuming same length */
 	{
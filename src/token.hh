@@ -4,14 +4,16 @@
 /*
  * Data structures for representing tokens.
  *
- * There are four types of tokens:
+ * There are five types of tokens:
  *   - operators (all are represented by single characters)
  *   - flags (e.g. "-o")
  *   - names (including all their quoting mechanisms)
  *   - commands (delimited by { })
+ *   - pool uses (the %use directive)
  */
 
 #include "place.hh"
+#include "pool.hh"
 #include "show.hh"
 
 typedef unsigned Environment;
@@ -98,6 +100,11 @@ public:
 		  Placed_Name(placed_name_)
 	{}
 
+	Name_Token(Placed_Name &&placed_name_, Environment environment_)
+		: Token(environment_),
+		  Placed_Name(std::move(placed_name_))
+	{}
+
 	const Place &get_place() const override { return Placed_Name::place; }
 	const Place &get_place_start() const override { return Placed_Name::place; }
 
@@ -136,4 +143,20 @@ public:
 	const std::vector <string> &get_lines() const;
 };
 
+class Pool_Token
+/* Generated by the %use directive, and applies to the following rule */
+	: public Token
+{
+public:
+	const Pool_Use pool_use;
+
+	Pool_Token(const Pool_Use &pool_use_, Environment environment_)
+		: Token(environment_), pool_use(pool_use_) { }
+
+	const Place &get_place() const override { return pool_use.place; }
+	const Place &get_place_start() const override { return pool_use.place; }
+	void render(Parts &parts, Rendering= 0) const override {
+		parts.append_operator("%use"); }
+};
+
 #endif /* ! TOKEN_HH */
@@ -3,10 +3,14 @@
 #include <pwd.h>
 #include <sys/mman.h>
 
+#include "rule_cache.hh"
+#include "scan.hh"
 #include "show_option.hh"
+#include "watch.hh"
 
 void Tokenizer::parse_tokens_file(
 	std::vector <shared_ptr <Token> > &tokens,
+	Arena &arena,
 	Context context,
 	Place &place_end,
 	string filename,
@@ -19,12 +23,13 @@ void Tokenizer::parse_tokens_file(
 	std::vector <string> filenames;
 	std::set <string> includes;
 	parse_tokens_file(
-		tokens, context, place_end, filename, backtraces, filenames, includes,
+		tokens, arena, context, place_end, filename, backtraces, filenames, includes,
 		place_diagnostic, fd, allow_enoent, try_default);
 }
 
 void Tokenizer::parse_tokens_file(
 	std::vector <shared_ptr <Token> > &tokens,
+	Arena &arena,
 	Context context,
 	Place &place_end,
 	string filename,
@@ -106,6 +111,11 @@ void Tokenizer::parse_tokens_file(
 				goto error_close;
 		}
 
+		if (context == SOURCE && ! filename.empty()) {
+			Watch::add_source(filename, &buf);
+			Rule_Cache::add_source(filename, &buf);
+		}
+
 		/* Handle a file of zero length separately because mmap() may fail on it,
 		 * i.e., return an error and refuse to create a memory map of length
 		 * zero. */
@@ -148,7 +158,7 @@ void Tokenizer::parse_tokens_file(
 
 		{
 			Tokenizer tokenizer(
-				tokens, backtraces, filenames, includes,
+				tokens, &arena, backtraces, filenames, includes,
 				Place(Place::Type::INPUT_FILE, (Place::Bits)0,
 					filename, 1, 0),
 				in, in_size);
@@ -241,7 +251,7 @@ void Tokenizer::parse_tokens_string(
 	std::set <string> includes;
 
 	Tokenizer tokenizer(
-		tokens, backtraces, filenames, includes,
+		tokens, nullptr, backtraces, filenames, includes,
 		place_string,
 		string_.c_str(), string_.size());
 	tokenizer.parse_tokens(context, place_string);
@@ -429,7 +439,7 @@ shared_ptr <Command> Tokenizer::parse_command()
 					++p;
 					const Place place_command(
 						place_base.type, (Place::Bits)0,
-						place_base.text,
+						place_base.file,
 						line_command, column_command);
 					return std::make_shared <Command> (
 						command, place_command, place_open,
@@ -504,7 +514,9 @@ shared_ptr <Command> Tokenizer::parse_command()
 		case '#':
 			++p;
 			if (last == '{' || last == '(' || last == '`') {
-				while (p < p_end && *p != '\n')  ++p;
+				p= (const char *) memchr(p, '\n', p_end - p);
+				if (! p)
+					p= p_end;
 			}
 			break;
 
@@ -535,12 +547,18 @@ shared_ptr <Command> Tokenizer::parse_command()
 			}
 			break;
 
+		case '\n':
+			++line;
+			p_line= ++p;
+			break;
+
 		default:
-			if (*p == '\n') {
-				++line;
-				p_line= p + 1;
-			}
-			++p;
+			/* Whitespace at the beginning is looked at character by
+			 * character, to determine the place of the command */
+			if (begin)
+				++p;
+			else
+				p= Scan::skip(Scan::K_COMMAND, p + 1, p_end);
 		}
 	}
 
@@ -598,7 +616,7 @@ void Tokenizer::parse_flag_or_name()
 		throw ERR_LOGICAL;
 	}
 	assert(! placed_name->empty());
-	tokens.push_back(std::make_shared <Name_Token> (*placed_name, environment));
+	push_token <Name_Token> (std::move(*placed_name), environment);
 }
 
 void Tokenizer::parse_flag()
@@ -638,9 +656,8 @@ void Tokenizer::parse_flag()
 		}
 		p= q;
 		char flag_char= flag_chars[index];
-		shared_ptr <Flag_Token> token= std::make_shared <Flag_Token> (
+		push_token <Flag_Token> (
 			environment, place_dash, place_name, flag_char, name);
-		tokens.push_back(token);
 		return;
 	}
 
@@ -653,7 +670,6 @@ void Tokenizer::parse_flag()
 		explain_flags();
 		throw ERR_LOGICAL;
 	}
-	shared_ptr <Flag_Token> token;
 	do {
 		flag_char= *p;
 		Place place_name= current_place();
@@ -663,9 +679,8 @@ void Tokenizer::parse_flag()
 			explain_flags();
 			throw ERR_LOGICAL;
 		}
-		token= std::make_shared <Flag_Token> (
+		push_token <Flag_Token> (
 			environment, place_dash, place_name, flag_char);
-		tokens.push_back(token);
 		++p;
 	} while (p < p_end && isalnum(*p));
 	if (p < p_end &&
@@ -674,7 +689,7 @@ void Tokenizer::parse_flag()
 		current_place() <<
 			fmt("expected whitespace before character %s",
 				show(current_mbchar()));
-		token->get_place() << fmt("after flag %s",
+		tokens.back()->get_place() << fmt("after flag %s",
 			show(Unplaced_Flag_View(flag_char)));
 		throw ERR_LOGICAL;
 	}
@@ -710,14 +725,17 @@ shared_ptr <Placed_Name> Tokenizer::parse_name(
 			parse_dollar(*ret);
 		} else if (!has_escape && *p == '\\') {
 			has_escape= parse_escape();
-		} else if (has_escape || is_name_char(*p)) {
-			/* An ordinary character */
-			assert(p != p_begin
-			       || (*p != '-' && *p != '+' && *p != '~')
-			       || allow_special
-			       || has_escape);
+		} else if (has_escape) {
 			has_escape= false;
 			ret->last_text() += *p++;
+		} else if (is_name_char(*p)) {
+			/* A run of ordinary characters */
+			assert(p != p_begin
+			       || (*p != '-' && *p != '+' && *p != '~')
+			       || allow_special);
+			const char *p_run= p;
+			p= Scan::skip(Scan::K_NAME, p + 1, p_end);
+			ret->last_text().append(p_run, p - p_run);
 		}
 		else {
 			/* As soon as the name cannot be parsed
@@ -766,6 +784,7 @@ void Tokenizer::parse_dollar(Placed_Name &placed_name)
 		assert(name.size() > 0);
 		const char *value= getenv(name.c_str());
 		TRACE("name= %s", value ? show(value) : "<null>");
+		Rule_Cache::add_variable(name, value);
 		if (!value) {
 			place_dollar << fmt("expected environment variable %s to be set",
 				show(Environment_Variable_View(name)));
@@ -796,7 +815,9 @@ void Tokenizer::parse_home(Placed_Name &placed_name)
 			return;
 		}
 		const char *home= getenv(ENV_HOME);
+		Rule_Cache::add_variable(ENV_HOME, home);
 		if (!home || !home[0]) {
+			Rule_Cache::disable();
 			print_warning(place_tilde, fmt("variable %s is not set",
 				show(Operator_View(fmt("$%s", ENV_HOME)))));
 			struct passwd *info= getpwuid(getuid());
@@ -817,6 +838,7 @@ void Tokenizer::parse_home(Placed_Name &placed_name)
 		}
 		string username= string(begin, p - begin);
 		assert(username.size() > 0);
+		Rule_Cache::disable();
 		struct passwd *info= getpwnam(username.c_str());
 		if (! info || ! info->pw_dir) {
 			place_tilde << fmt("cannot determine home directory of user %s",
@@ -931,16 +953,15 @@ void Tokenizer::parse_environment_variable(string &name)
 }
 
 bool Tokenizer::is_name_char(char c)
-/* The characters in the string constant are those characters that have special meaning
- * (as defined in the manpage), and those reserved for future extension (also defined in
- * the manpage).  All non-ASCII characters are allowed, and thus we don't have to
- * distinguish UTF-8 from 8-bit encodings: all characters with the most significant bit
- * set will make this return TRUE.  See the file CHARACTERS for more information.  This
- * returns TRUE for the mid-name characters '-', '+' and '~'. */
+/* The characters excluded by Scan::K_NAME are those characters that have special meaning
+ * (as defined in the manpage), those reserved for future extension (also defined in the
+ * manpage), and the ASCII control characters and space.  All non-ASCII characters are
+ * allowed, and thus we don't have to distinguish UTF-8 from 8-bit encodings: all
+ * characters with the most significant bit set will make this return TRUE.  See the file
+ * CHARACTERS for more information.  This returns TRUE for the mid-name characters '-',
+ * '+' and '~'. */
 {
-	return (c > 0x20 && c < 0x7F /* ASCII printable character except space */
-		&& nullptr == strchr("[]\"\':={}#<>@$;()%*\\!?|&,", c))
-		|| ((unsigned char) c) >= 0x80;
+	return Scan::is(Scan::K_NAME, c);
 }
 
 bool Tokenizer::is_operator_char(char c)
@@ -1049,6 +1070,7 @@ void Tokenizer::parse_version(
 
 Tokenizer::Tokenizer(
 	std::vector <shared_ptr <Token> > &tokens_,
+	Arena *arena_,
 	std::vector <Backtrace> &backtraces_,
 	std::vector <string> &filenames_,
 	std::set <string> &includes_,
@@ -1056,6 +1078,7 @@ Tokenizer::Tokenizer(
 	const char *p_,
 	size_t length)
 	: tokens(tokens_),
+	  arena(arena_),
 	  backtraces(backtraces_),
 	  filenames(filenames_),
 	  includes(includes_),
@@ -1079,7 +1102,7 @@ void Tokenizer::parse_tokens(
 		/* Operators except '$' */
 		if (is_operator_char(*p)) {
 			Place place= current_place();
-			tokens.push_back(std::make_shared <Operator> (*p, place, environment));
+			push_token <Operator> (*p, place, environment);
 			++p;
 		}
 
@@ -1087,11 +1110,9 @@ void Tokenizer::parse_tokens(
 		else if (*p == '$' && p + 1 < p_end && p[1] == '[') {
 			Place place_dollar= current_place();
 			Place place_lbracket(place_base.type, (Place::Bits)0,
-				place_base.text, line, p + 1 - p_line);
-			tokens.push_back(std::make_shared <Operator>
-				('$', place_dollar, environment));
-			tokens.push_back(std::make_shared <Operator>
-				('[', place_lbracket, environment));
+				place_base.file, line, p + 1 - p_line);
+			push_token <Operator> ('$', place_dollar, environment);
+			push_token <Operator> ('[', place_lbracket, environment);
 			p += 2;
 		}
 
@@ -1104,7 +1125,9 @@ void Tokenizer::parse_tokens(
 		/* Comment */
 		else if (*p == '#') {
 			/* Skip the comment without generating any token */
-			do  ++p;  while (p < p_end && *p != '\n');
+			p= (const char *) memchr(p, '\n', p_end - p);
+			if (! p)
+				p= p_end;
 		}
 
 		/* Whitespace */
@@ -1162,6 +1185,8 @@ bool Tokenizer::skip_space(bool &skipped_actual_space)
 		} else {
 			ret= true;
 			skipped_actual_space= true;
+			p= Scan::skip(Scan::K_BLANK, p + 1, p_end);
+			continue;
 		}
 		++p;
 	}
@@ -1232,12 +1257,14 @@ void Tokenizer::parse_double_quote(Placed_Name &ret)
 			place_begin_quote << fmt("in quote started by %s",
 				show(Operator_View('"')));
 			throw ERR_LOGICAL;
-		} else {
-			if (*p == '\n') {
-				++line;
-				p_line= p + 1;
-			}
+		} else if (*p == '\n') {
+			++line;
+			p_line= p + 1;
 			ret.last_text() += *p++;
+		} else {
+			const char *p_run= p;
+			p= Scan::skip(Scan::K_QUOTE, p + 1, p_end);
+			ret.last_text().append(p_run, p - p_run);
 		}
 	}
 	/* Reached end of file without closing the quote */
@@ -1339,6 +1366,8 @@ void Tokenizer::parse_directive(
 		parse_version_directive(place_percent);
 	} else if (name == "set" || name == "unset") {
 		parse_set_directive(context, place_percent, name);
+	} else if (name == "pool" || name == "use") {
+		parse_pool_directive(context, place_percent, name);
 	} else {
 		/* Invalid directive */
 		place_percent << fmt("invalid directive %s",
@@ -1387,7 +1416,7 @@ void Tokenizer::parse_include_directive(
 	Backtrace backtrace_stack(placed_name->place,
 		fmt("%s is included from here", show(filename_include)));
 	backtraces.push_back(backtrace_stack);
-	filenames.push_back(place_base.text);
+	filenames.push_back(place_base.get_filename());
 
 	if (includes.count(filename_include)) {
 		/* Do nothing -- file was already parsed, or is being parsed.  It is an
@@ -1416,7 +1445,7 @@ void Tokenizer::parse_include_directive(
 		/* Ignore the end place; it is only used for the top-level file */
 		Place place_end_sub;
 		parse_tokens_file(
-			tokens, Tokenizer::SOURCE, place_end_sub,
+			tokens, *arena, Tokenizer::SOURCE, place_end_sub,
 			filename_include, backtraces, filenames, includes,
 			place_diagnostic, -1);
 	}
@@ -1433,7 +1462,7 @@ void Tokenizer::parse_version_directive(const Place &place_percent)
 	while (p < p_end && is_name_char(*p)) ++p;
 	string version_required(p_version, p - p_version);
 	Place place_version(place_base.type, (Place::Bits)0,
-		place_base.text, line, p_version - p_line);
+		place_base.file, line, p_version - p_line);
 	parse_version(version_required, place_version, place_percent);
 }
 
@@ -1509,9 +1538,111 @@ void Tokenizer::parse_set_directive(
 	if (set) {
 		string value_string= value->unparametrized();
 		setenv(name_string.c_str(), value_string.c_str(), 1);
+		Rule_Cache::add_set(name_string, value_string.c_str());
 	} else {
 		unsetenv(name_string.c_str());
+		Rule_Cache::add_set(name_string, nullptr);
+	}
+}
+
+void Tokenizer::parse_pool_directive(
+	Context context,
+	const Place &place_percent,
+	string directive)
+{
+	TRACE_FUNCTION();
+	TRACE("directive= '%s'", directive);
+	assert(directive == "pool" || directive == "use");
+	if (context == DYNAMIC) {
+		place_percent << fmt("%s cannot appear in dynamic dependencies",
+			show(Operator_View("%" + directive)));
+		throw ERR_LOGICAL;
+	}
+	if (context == OPTION_C) {
+		place_percent << fmt("%s cannot be used",
+			show(Operator_View("%" + directive)));
+		throw ERR_LOGICAL;
+	}
+
+	bool skipped_space;
+	skip_space(skipped_space);
+	Place place_name= current_place();
+	shared_ptr <Placed_Name> name= parse_name(true);
+	if (!name) {
+		current_place() <<
+			(p == p_end
+				? "expected a pool name"
+				: fmt("expected a pool name, not %s",
+					show(current_mbchar())));
+		place_percent << fmt("after %s",
+			show(Operator_View("%" + directive)));
+		throw ERR_LOGICAL;
+	}
+	if (name->is_parametrized()) {
+		place_name << fmt("pool name %s cannot be parametrized",
+			show(*name));
+		place_percent << fmt("after %s",
+			show(Operator_View("%" + directive)));
+		throw ERR_LOGICAL;
+	}
+	string name_string= name->unparametrized();
+	size_t index= Pool::find(name_string);
+
+	skip_space(skipped_space);
+	if (directive == "pool") {
+		long capacity= parse_pool_number(place_percent, directive, "a capacity");
+		if (index < Pool::pools.size()) {
+			place_name << fmt("pool %s must not be declared twice",
+				show(*name));
+			Pool::pools[index].place << fmt("pool %s was previously declared here",
+				show(*name));
+			throw ERR_LOGICAL;
+		}
+		Pool::pools.emplace_back(name_string, capacity, place_percent);
+	} else {
+		if (index == Pool::pools.size()) {
+			place_name << fmt("pool %s is not declared", show(*name));
+			place_percent << fmt("in %s", show(Operator_View("%use")));
+			throw ERR_LOGICAL;
+		}
+		Place place_weight= current_place();
+		long weight= parse_pool_number(place_percent, directive, "a weight");
+		if (weight > Pool::pools[index].capacity) {
+			place_weight << fmt("weight %s must not be larger than the capacity %s",
+				show(frmt("%ld", weight)),
+				show(frmt("%ld", Pool::pools[index].capacity)));
+			Pool::pools[index].place << fmt("of pool %s", show(*name));
+			throw ERR_LOGICAL;
+		}
+		tokens.push_back(std::make_shared <Pool_Token>
+			(Pool_Use{index, weight, place_percent}, environment));
+	}
+}
+
+long Tokenizer::parse_pool_number(
+	const Place &place_percent,
+	string directive,
+	const char *what)
+{
+	Place place_number= current_place();
+	const char *p_number= p;
+	while (p < p_end && isdigit(*p)) ++p;
+	string number(p_number, p - p_number);
+	errno= 0;
+	long ret= p == p_number ? 0 : strtol(number.c_str(), nullptr, 10);
+	if (ret <= 0 || errno != 0 || (p < p_end && is_name_char(*p))) {
+		while (p < p_end && is_name_char(*p)) ++p;
+		string text(p_number, p - p_number);
+		place_number <<
+			(text.empty()
+				? fmt("expected %s", what)
+				: fmt("expected %s as a positive integer, not %s",
+					what, show(text)));
+		place_percent << fmt("in %s",
+			show(Operator_View("%" + directive)));
+		throw ERR_LOGICAL;
 	}
+	return ret;
 }
 
 int Tokenizer::read_fd(int fd, const size_t size, char **mem, size_t *mem_size)
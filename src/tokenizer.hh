@@ -1,6 +1,7 @@
 #ifndef TOKENIZER_HH
 #define TOKENIZER_HH
 
+#include "arena.hh"
 #include "backtrace.hh"
 #include "place.hh"
 #include "target.hh"
@@ -19,6 +20,7 @@ public:
 
 	static void parse_tokens_file(
 		std::vector <shared_ptr <Token> > &tokens,
+		Arena &arena,
 		Context context,
 		Place &place_end,
 		string filename,
@@ -30,6 +32,9 @@ public:
 	 * the file was not yet opened, FD is -1.  If FILENAME is "", use standard input,
 	 * but FD must be -1.
 	 *
+	 * Operators, flags and names are allocated in ARENA, which must outlive TOKENS.
+	 * Commands and pool uses are not, because rules keep them.
+	 *
 	 * Set PLACE_END to the end of the parsed file.  PLACE_DIAGNOSTIC is the place
 	 * where this file is included from, e.g. the -f option.  If ALLOW_ENOENT, an
 	 * ENOENT error on this first open() is not reported as an error, and the function
@@ -52,6 +57,9 @@ private:
 
 	std::vector <shared_ptr <Token> > &tokens;
 
+	Arena *const arena;
+	/* Null when tokens are not allocated in an arena */
+
 	/* Stacks of included files */
 	std::vector <Backtrace> &backtraces;
 	std::vector <string> &filenames;
@@ -72,6 +80,7 @@ private:
 
 	Tokenizer(
 		std::vector <shared_ptr <Token> > &tokens_,
+		Arena *arena_,
 		std::vector <Backtrace> &backtraces_,
 		std::vector <string> &filenames_,
 		std::set <string> &includes_,
@@ -83,6 +92,16 @@ private:
 		Context context,
 		const Place &place_diagnostic);
 
+	template <typename T, typename... Args>
+	void push_token(Args &&... args) {
+		if (arena)
+			tokens.push_back(std::allocate_shared <T> (
+				Arena_Allocator <T> (*arena), std::forward <Args> (args)...));
+		else
+			tokens.push_back(std::make_shared <T> (std::forward <Args> (args)...));
+	}
+	/* Append a token of type T, in the arena if there is one */
+
 	shared_ptr <Command> parse_command();
 	void parse_flag_or_name();
 	void parse_flag();
@@ -119,6 +138,14 @@ private:
 		Context context,
 		const Place &place_percent,
 		string directive);
+	void parse_pool_directive(
+		Context context,
+		const Place &place_percent,
+		string directive);
+	long parse_pool_number(
+		const Place &place_percent,
+		string directive,
+		const char *what);
 
 	bool skip_space(bool &skipped_actual_space);
 	/* Skip any whitespace (including backslash-newline combinations).  The return
@@ -127,13 +154,14 @@ private:
 
 	Place current_place() const {
 		return Place(place_base.type, (Place::Bits)0,
-			place_base.text, line, p - p_line);
+			place_base.file, line, p - p_line);
 	}
 
 	string current_mbchar() const;
 
 	static void parse_tokens_file(
 		std::vector <shared_ptr <Token> > &tokens,
+		Arena &arena,
 		Context context,
 		Place &place_end,
 		string filename,
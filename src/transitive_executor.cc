@@ -46,6 +46,10 @@ Transitive_Executor::Transitive_Executor(
 		hash_deps.push_back(t->placed_target.unparametrized());
 	assert(hash_deps.size());
 
+	if (order == Order::CRITICAL)
+		for (const Hash_Dep &hd: hash_deps)
+			critical_path= std::max(critical_path, History::get(hd));
+
 	assert((param_rule == nullptr) == (rule == nullptr));
 
 	/* Fill EXECUTORS_BY_TARGET with all targets from the rule, not just the one given
@@ -71,12 +75,6 @@ Transitive_Executor::Transitive_Executor(
 	parents[parent]= dep_link;
 }
 
-Transitive_Executor::~Transitive_Executor()
-/* Objects of this type are never deleted */
-{
-	unreachable();
-}
-
 bool Transitive_Executor::want_delete() const
 {
 	return false;
@@ -156,6 +154,14 @@ void Transitive_Executor::notify_variable(
 		result_variable_child.end());
 }
 
+void Transitive_Executor::finish_critical_path()
+{
+	/* There is no job, so the chain is that of the longest child */
+	critical_path= critical_path_children;
+	for (const Hash_Dep &hash_dep: hash_deps)
+		History::set(hash_dep, critical_path);
+}
+
 bool Transitive_Executor::optional_finished(shared_ptr <const Dep> )
 {
 	return false;
@@ -27,6 +27,7 @@ public:
 		shared_ptr <const Dep> dep, Executor *, Flags flags,
 		shared_ptr <const Dep> dep_source) override;
 	virtual void notify_variable(const std::map <string, string> &) override;
+	virtual void finish_critical_path() override;
 #ifndef NDEBUG
 	virtual void render(Parts &, Rendering= 0) const override;
 #endif /* ! NDEBUG */
@@ -35,7 +36,8 @@ protected:
 	virtual bool optional_finished(shared_ptr <const Dep> ) override;
 
 private:
-	~Transitive_Executor();
+	~Transitive_Executor()= default;
+	/* Objects of this type are only deleted by Executor::reset() */
 
 	std::vector <Hash_Dep> hash_deps;
 	/* The targets to which this executor object corresponds.  All are phonies.
@@ -0,0 +1,11 @@
+/* Automatically generated by sh/mkversion */
+
+#ifndef VERSION_HH
+#define VERSION_HH
+
+#define STU_VERSION "2.19.0"
+#define STU_VERSION_MAJOR 2
+#define STU_VERSION_MINOR 19
+#define STU_VERSION_PATCH 0
+
+#endif /* ! VERSION_HH */
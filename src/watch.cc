@@ -0,0 +1,217 @@
+#include "watch.hh"
+
+#include <poll.h>
+#include <sys/stat.h>
+
+std::unordered_map <string, Fingerprint> Watch::fingerprints_source;
+char **Watch::argv= nullptr;
+string Watch::makeflags;
+bool Watch::has_makeflags= false;
+
+void Watch::add_source(const string &filename, const struct stat *buf)
+{
+	fingerprints_source.emplace(filename, Fingerprint(buf));
+}
+
+void Watch::init(char **argv_)
+{
+	TRACE_FUNCTION();
+	argv= argv_;
+	const char *m= getenv("MAKEFLAGS");
+	has_makeflags= m;
+	if (m)
+		makeflags= m;
+}
+
+void Watch::wait()
+{
+	TRACE_FUNCTION();
+
+	/* The fingerprints seen by the build */
+	std::unordered_map <string, Fingerprint> fingerprints;
+	for (const string &filename: Stat_Cache::get_filenames()) {
+		struct stat buf;
+		fingerprints[filename]= Stat_Cache::stat(filename.c_str(), &buf, false)
+			? Fingerprint() : Fingerprint(&buf);
+	}
+	for (const auto &i: fingerprints_source)
+		fingerprints[i.first]= i.second;
+
+	/* The directories are watched before the files are compared, such that no
+	 * change is lost in between */
+	int fd= -1;
+	bool complete= false;
+	/* Whether all files are in watched directories */
+	Filenames_By_Wd filenames_by_wd;
+#if USE_INOTIFY
+	fd= inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+	if (fd >= 0) {
+		complete= true;
+		std::unordered_map <string, int> wds;
+		for (const auto &i: fingerprints) {
+			string dir, name;
+			split(i.first, dir, name);
+			auto j= wds.find(dir);
+			if (j == wds.end()) {
+				int wd= inotify_add_watch(fd, dir.c_str(), MASK_EVENTS);
+				TRACE("dir= %s; wd= %s", dir, frmt("%d", wd));
+				j= wds.emplace(dir, wd).first;
+			}
+			if (j->second < 0)
+				complete= false;
+			else
+				filenames_by_wd[j->second][name]= i.first;
+		}
+	}
+#endif /* USE_INOTIFY */
+
+	print_out("Waiting for changes");
+	fflush(stdout);
+
+	std::vector <string> filenames_changed, filenames_check;
+	bool check_all= true;
+	size_t count_changed= 0;
+	while (true) {
+		if (check_all) {
+			for (auto &i: fingerprints)
+				check(i.first, i.second, filenames_changed);
+		} else {
+			for (const string &filename: filenames_check)
+				check(filename, fingerprints[filename], filenames_changed);
+		}
+		check_all= false;
+		filenames_check.clear();
+
+		bool changed_now= filenames_changed.size() > count_changed;
+		count_changed= filenames_changed.size();
+		if (count_changed && ! changed_now)
+			break;
+
+		int milliseconds= count_changed ? MILLISECONDS_SETTLE
+			: complete ? -1 : MILLISECONDS_POLL;
+#if USE_INOTIFY
+		if (fd >= 0) {
+			if (! wait_events(fd, milliseconds, filenames_by_wd,
+					filenames_check, check_all) && ! complete)
+				check_all= true;
+			continue;
+		}
+#endif /* USE_INOTIFY */
+		assert(milliseconds >= 0);
+		poll(nullptr, 0, milliseconds);
+		check_all= true;
+	}
+
+	if (fd >= 0)
+		close(fd);
+
+	for (const string &filename: filenames_changed) {
+		if (fingerprints_source.count(filename))
+			exec_again(filename);
+		Stat_Cache::invalidate(filename);
+	}
+	Stat_Cache::invalidate_missing();
+}
+
+bool Watch::sources_changed(string &filename)
+{
+	std::vector <string> filenames_changed;
+	for (auto &i: fingerprints_source)
+		check(i.first, i.second, filenames_changed);
+	if (filenames_changed.empty())
+		return false;
+	filename= filenames_changed.front();
+	return true;
+}
+
+void Watch::check(const string &filename, Fingerprint &fingerprint,
+	std::vector <string> &filenames_changed)
+{
+	struct stat buf;
+	Fingerprint fingerprint_now= stat(filename.c_str(), &buf) < 0
+		? Fingerprint() : Fingerprint(&buf);
+	if (fingerprint_now == fingerprint)
+		return;
+	TRACE("Changed %s", filename);
+	fingerprint= fingerprint_now;
+	filenames_changed.push_back(filename);
+}
+
+void Watch::split(const string &filename, string &dir, string &name)
+{
+	size_t pos= filename.rfind('/');
+	if (pos == string::npos) {
+		dir= ".";
+		name= filename;
+	} else {
+		dir= pos == 0 ? "/" : filename.substr(0, pos);
+		name= filename.substr(pos + 1);
+	}
+}
+
+#if USE_INOTIFY
+bool Watch::wait_events(int fd, int milliseconds,
+	const Filenames_By_Wd &filenames_by_wd,
+	std::vector <string> &filenames_check, bool &check_all)
+{
+	TRACE_FUNCTION();
+	struct pollfd pollfd= {fd, POLLIN, 0};
+	int r;
+	while ((r= poll(&pollfd, 1, milliseconds)) < 0 && errno == EINTR) { }
+	if (r < 0) {
+		print_errno("poll");
+		error_exit();
+	}
+	if (r == 0)
+		return false;
+
+	alignas(struct inotify_event) char buffer[1 << 14];
+	ssize_t size;
+	while ((size= read(fd, buffer, sizeof(buffer))) > 0) {
+		for (const char *p= buffer; p < buffer + size; ) {
+			const struct inotify_event *event=
+				(const struct inotify_event *)p;
+			p += sizeof(struct inotify_event) + event->len;
+			if (event->mask & (IN_Q_OVERFLOW | IN_DELETE_SELF | IN_MOVE_SELF
+					| IN_IGNORED)) {
+				/* The directory itself has gone */
+				check_all= true;
+				continue;
+			}
+			if (event->len == 0)
+				continue;
+			auto i= filenames_by_wd.find(event->wd);
+			if (i == filenames_by_wd.end())
+				continue;
+			auto j= i->second.find(event->name);
+			if (j != i->second.end())
+				filenames_check.push_back(j->second);
+		}
+	}
+	if (size < 0 && errno != EAGAIN && errno != EINTR) {
+		print_errno("read");
+		error_exit();
+	}
+	return true;
+}
+#endif /* USE_INOTIFY */
+
+void Watch::exec_again(const string &filename)
+{
+	TRACE_FUNCTION();
+	print_out(fmt("File %s has changed, restarting", show(filename)));
+	fflush(stdout);
+	if (has_makeflags ? setenv("MAKEFLAGS", makeflags.c_str(), 1)
+		: unsetenv("MAKEFLAGS")) {
+		print_errno("setenv");
+		error_exit();
+	}
+	/* Productive signals are blocked in Stu, and the mask is inherited */
+	if (sigprocmask(SIG_SETMASK, &set_child, nullptr)) {
+		print_errno("sigprocmask");
+		error_exit();
+	}
+	execvp(argv[0], argv);
+	print_errno("execvp", argv[0]);
+	error_exit();
+}
@@ -0,0 +1,113 @@
+#ifndef WATCH_HH
+#define WATCH_HH
+
+/*
+ * Watch mode (option -w):  After each build, Stu waits until one of the files it looked
+ * at during the build changes, and then builds the same targets again.  The rules are
+ * parsed only once, and the results of stat() are kept for all files that did not
+ * change, such that the next build only stats the changed files and the files changed by
+ * jobs.  The executors themselves are created anew for each build, since File_Executor
+ * objects cannot be reset.  Errors do not end the watch; they are handled as with -k.
+ *
+ * The watched files are all files whose status is in the stat cache, i.e., the targets,
+ * the dependencies, and the files of dynamic dependencies, together with the Stu source
+ * files, including those read with %include.  A file counts as changed when its
+ * fingerprint differs from the one seen during the build.  Files written by the jobs of
+ * the build therefore do not trigger another build, while files changed by the user
+ * during the build do.  On Linux, the directories containing the watched files are
+ * watched with inotify, such that Stu sleeps until something happens in one of them;
+ * files created or replaced using rename() are noticed too.  When inotify is not
+ * available, or a directory cannot be watched because it does not exist, the files are
+ * polled instead.
+ *
+ * When a Stu source file has changed, Stu executes itself again with the same arguments
+ * and environment, instead of updating the rules in memory.
+ */
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#ifndef USE_INOTIFY
+#   if HAVE_INOTIFY
+#      define USE_INOTIFY 1
+#   else
+#      define USE_INOTIFY 0
+#   endif
+#endif
+
+#if USE_INOTIFY
+#   include <sys/inotify.h>
+#endif
+
+#include "build_log.hh"
+
+class Watch
+{
+public:
+	static void add_source(const std::string &filename, const struct stat *buf);
+	/* FILENAME was read as a Stu source file; BUF is its status when it was read */
+
+	static void init(char **argv);
+	/* Called when -w or -D is used, after the Stu source files were read and
+	 * before the first build.  ARGV is used to execute Stu again. */
+
+	static void wait();
+	/* Called after each build.  Return when at least one of the files used by the
+	 * build has changed; those files are then invalidated in the stat cache.  When a
+	 * Stu source file has changed, execute Stu again instead of returning. */
+
+	static bool sources_changed(std::string &filename);
+	/* Whether one of the Stu source files has changed since it was read; if so, set
+	 * FILENAME to it.  Used by the server. */
+
+	[[noreturn]]
+	static void exec_again(const std::string &filename);
+	/* Execute Stu again, because the Stu source file FILENAME has changed */
+
+	static void split(const std::string &filename, std::string &dir, std::string &name);
+	/* Split FILENAME into the directory and the name within it */
+
+	typedef std::unordered_map <int, std::unordered_map <std::string, std::string> >
+		Filenames_By_Wd;
+	/* For each inotify watch descriptor, the watched files in the directory, by their
+	 * name within the directory */
+
+#if USE_INOTIFY
+	static constexpr uint32_t MASK_EVENTS= IN_ATTRIB | IN_CLOSE_WRITE | IN_CREATE
+		| IN_DELETE | IN_MODIFY | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF
+		| IN_MOVE_SELF;
+	/* The events watched on directories */
+
+	static bool wait_events(int fd, int milliseconds,
+		const Filenames_By_Wd &filenames_by_wd,
+		std::vector <std::string> &filenames_check, bool &check_all);
+	/* Wait for events on the inotify file descriptor FD, at most for the given time,
+	 * or indefinitely when negative.  Add the watched files that something happened
+	 * to to FILENAMES_CHECK, or set CHECK_ALL.  Return whether anything happened. */
+#endif /* USE_INOTIFY */
+
+private:
+	static constexpr int MILLISECONDS_POLL= 1000;
+	/* Interval for polling files that are not watched using inotify */
+
+	static constexpr int MILLISECONDS_SETTLE= 100;
+	/* After a change, wait until no further change has happened in this time, such
+	 * that a file that is written in several steps does not lead to several builds */
+
+	static std::unordered_map <std::string, Fingerprint> fingerprints_source;
+	/* The Stu source files, and their fingerprints when they were read */
+
+	static char **argv;
+	static std::string makeflags;
+	static bool has_makeflags;
+	/* $MAKEFLAGS when Stu was started; Stu may change it to export its jobserver */
+
+	static void check(const std::string &filename, Fingerprint &fingerprint,
+		std::vector <std::string> &filenames_changed);
+	/* Compare the current state of the file, bypassing the stat cache, to
+	 * FINGERPRINT, which is all zero when the file did not exist.  When it has
+	 * changed, update FINGERPRINT and add the file to FILENAMES_CHANGED. */
+};
+
+#endif /* ! WATCH_HH */
@@ -0,0 +1,46 @@
+#include "worker.hh"
+
+#include <signal.h>
+
+#include "error.hh"
+
+void Worker::init(pthread_mutex_t *mutex, pthread_cond_t *cond_1, pthread_cond_t *cond_2)
+{
+	int r= pthread_mutex_init(mutex, nullptr);
+	if (r == 0)
+		r= pthread_cond_init(cond_1, nullptr);
+	if (r == 0)
+		r= pthread_cond_init(cond_2, nullptr);
+	if (r) {
+		errno= r;
+		print_errno("pthread_mutex_init");
+		error_exit();
+	}
+}
+
+int Worker::start(void *(*run)(void *))
+{
+	/* The signal mask is inherited from the creating thread */
+	sigset_t set_all, set_old;
+	if (sigfillset(&set_all)) {
+		print_errno("sigfillset");
+		error_exit();
+	}
+	int r= pthread_sigmask(SIG_SETMASK, &set_all, &set_old);
+	if (r) {
+		errno= r;
+		print_errno("pthread_sigmask");
+		error_exit();
+	}
+	pthread_t thread;
+	r= pthread_create(&thread, nullptr, run, nullptr);
+	int r_mask= pthread_sigmask(SIG_SETMASK, &set_old, nullptr);
+	if (r_mask) {
+		errno= r_mask;
+		print_errno("pthread_sigmask");
+		error_exit();
+	}
+	if (r == 0)
+		pthread_detach(thread);
+	return r;
+}
@@ -0,0 +1,25 @@
+#ifndef WORKER_HH
+#define WORKER_HH
+
+/*
+ * Helper functions for the worker threads of Stu, i.e., those of the stat cache and of
+ * the copier.  Worker threads block all signals, such that signals are handled by the
+ * main thread, and are detached, since Stu never waits for them to exit.
+ */
+
+#include <pthread.h>
+
+class Worker
+{
+public:
+	static void init(pthread_mutex_t *mutex, pthread_cond_t *cond_1,
+		pthread_cond_t *cond_2);
+	/* Initialize a mutex and two condition variables.  The static initializers of
+	 * pthreads cannot be used in C++ without warnings.  Errors are fatal. */
+
+	static int start(void *(*run)(void *));
+	/* Start a detached thread that executes RUN with all signals blocked.  Return
+	 * zero, or the error number of pthread_create(), which has not been output. */
+};
+
+#endif /* ! WORKER_HH */
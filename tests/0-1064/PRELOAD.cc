@@ -5,3 +5,11 @@ int sigwait(void *, int *)
 {
 	return EINVAL;
 }
+
+/* Make Stu fall back to sigwait() */
+extern "C"
+int signalfd(int fd, const void *mask, int flags)
+{
+	errno= ENOSYS;
+	return -1;
+}
@@ -6,3 +6,19 @@ int sigismember(void *set, int signum)
 	errno= EINVAL;
 	return -1;
 }
+
+/* Make Stu fall back to fork() */
+extern "C"
+int posix_spawn(void *pid, const char *path, const void *file_actions,
+		const void *attrp, char *const argv[], char *const envp[])
+{
+	return ENOSYS;
+}
+
+/* Make Stu fall back to sigwait() */
+extern "C"
+int signalfd(int fd, const void *mask, int flags)
+{
+	errno= ENOSYS;
+	return -1;
+}
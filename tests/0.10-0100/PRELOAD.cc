@@ -1,5 +1,6 @@
 /*
- * Test that Stu can handle PIDs being returned in any order by successive fork() calls.
+ * Test that Stu can handle PIDs being returned in any order by successive fork() and
+ * posix_spawn() calls.
  * Since many operating systems will return growing PID numbers, this test is needed to
  * make sure the code in job_list.cc can handle PIDs generated in any order.
  *
@@ -13,12 +14,14 @@
  *    encrypt to.
  *  * Mock all functions used by Stu that receive/return PIDs.  For instance, tcgetpgrp()
  *    is not mocked.
- *  * Also mock execv() in order to remove LD_PRELOAD from the environment.
+ *  * Also mock execv() in order to remove LD_PRELOAD from the environment.  For
+ *    posix_spawn(), LD_PRELOAD is removed from the passed environment.
  *  * The returned mock PIDs do not take into account the maximum PID setting of the
  *    operating system.  But that is not used by Stu.
  */
 
 #include <dlfcn.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <limits.h>
 #include <stdint.h>
@@ -105,6 +108,28 @@ pid_t fork()
 	return ret;
 }
 
+extern "C"
+int posix_spawn(pid_t *pid, const char *path, const void *file_actions,
+		const void *attrp, char *const argv[], char *const envp[])
+{
+	size_t n= 0;
+	while (envp[n]) ++n;
+	char **envp_new= (char **)malloc((n + 1) * sizeof(char *));
+	if (! envp_new) return ENOMEM;
+	size_t j= 0;
+	for (size_t i= 0; i < n; ++i)
+		if (strncmp(envp[i], "LD_PRELOAD=", 11))
+			envp_new[j++]= envp[i];
+	envp_new[j]= nullptr;
+	int ret= ((int (*)(pid_t *, const char *, const void *, const void *,
+			   char *const[], char *const[]))
+		dlsym(RTLD_NEXT, "posix_spawn"))
+		(pid, path, file_actions, attrp, argv, envp_new);
+	free(envp_new);
+	if (ret == 0 && *pid > 0) *pid= encrypt(*pid);
+	return ret;
+}
+
 extern "C"
 int execv(const char *pathname, char *const argv[])
 {
@@ -6,3 +6,11 @@ int dup2(int oldfd, int newfd)
 	errno= EINVAL;
 	return -1;
 }
+
+/* Make Stu fall back to fork() */
+extern "C"
+int posix_spawn(void *pid, const char *path, const void *file_actions,
+		const void *attrp, char *const argv[], char *const envp[])
+{
+	return ENOSYS;
+}
@@ -13,3 +13,11 @@ int sigprocmask(int how, const sigset_t *set, sigset_t *oldset)
 	return ((int (*)(int, const sigset_t *, sigset_t *))dlsym(RTLD_NEXT, "sigprocmask"))
 		(how, set, oldset);
 }
+
+/* Make Stu fall back to fork() */
+extern "C"
+int posix_spawn(void *pid, const char *path, const void *file_actions,
+		const void *attrp, char *const argv[], char *const envp[])
+{
+	return ENOSYS;
+}
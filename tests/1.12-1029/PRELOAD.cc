@@ -12,3 +12,11 @@ int execv(const char *pathname, char *const argv[])
 	return ((int (*)(const char *, char *const[]))dlsym(RTLD_NEXT, "execv"))
 		(pathname, argv);
 }
+
+/* Make Stu fall back to fork() */
+extern "C"
+int posix_spawn(void *pid, const char *path, const void *file_actions,
+		const void *attrp, char *const argv[], char *const envp[])
+{
+	return ENOSYS;
+}
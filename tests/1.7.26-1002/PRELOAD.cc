@@ -12,3 +12,11 @@ int putenv(const char *string)
 
 	return ((int (*)(const char *))dlsym(RTLD_NEXT, "putenv"))(string);
 }
+
+/* Make Stu fall back to fork() */
+extern "C"
+int posix_spawn(void *pid, const char *path, const void *file_actions,
+		const void *attrp, char *const argv[], char *const envp[])
+{
+	return ENOSYS;
+}
@@ -13,3 +13,11 @@ void *malloc(size_t size)
 	}
 	return ((void * (*)(size_t))dlsym(RTLD_NEXT, "malloc"))(size);
 }
+
+/* Make Stu fall back to fork() */
+extern "C"
+int posix_spawn(void *pid, const char *path, const void *file_actions,
+		const void *attrp, char *const argv[], char *const envp[])
+{
+	return ENOSYS;
+}
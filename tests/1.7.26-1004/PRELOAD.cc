@@ -20,3 +20,11 @@ int sprintf(char *str, const char *format, ...)
 	va_end(args);
 	return r;
 }
+
+/* Make Stu fall back to fork() */
+extern "C"
+int posix_spawn(void *pid, const char *path, const void *file_actions,
+		const void *attrp, char *const argv[], char *const envp[])
+{
+	return ENOSYS;
+}
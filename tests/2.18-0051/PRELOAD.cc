@@ -0,0 +1,12 @@
+/*
+ * When posix_spawn() fails, Stu falls back to fork() and exec().
+ */
+
+#include <errno.h>
+
+extern "C"
+int posix_spawn(void *pid, const char *path, const void *file_actions,
+		const void *attrp, char *const argv[], char *const envp[])
+{
+	return ENOSYS;
+}
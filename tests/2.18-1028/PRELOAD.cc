@@ -0,0 +1,8 @@
+#include <errno.h>
+
+extern "C"
+int epoll_wait(int epfd, void *events, int maxevents, int timeout)
+{
+	errno= EINVAL;
+	return -1;
+}